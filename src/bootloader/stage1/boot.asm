@@ -78,53 +78,64 @@ start:
     mov ax, STAGE2_LOAD_SEGMENT         ; set segment registers
     mov es, ax
 
-    mov bx, STAGE2_LOAD_OFFSET
+    xor bx, bx
 
 .loop:
     mov eax, [si]
-    add si, 4
-    mov cl, [si]
-    inc si
+    mov cl, [si + 4]
+    add si, 5
 
     cmp eax, 0
     je .read_finish
 
+.chunk:
+    test cl, cl
+    jz .loop
+
+    ; stage2 spans more than one 64 KiB page, split reads at page boundaries
+    ; so the floppy DMA never has to cross one
+    mov dx, es
+    and dx, 0FFFh
+    sub dx, 1000h
+    neg dx
+    shr dx, 5                           ; sectors left in this page
+    cmp dl, cl
+    jbe .read
+    mov dl, cl
+
+.read:
+    push cx
+    mov cl, dl
     call disk_read
+    pop cx
 
-    xor ch, ch
-    shl cx, 5
+    movzx edx, dl
+    add eax, edx
+    sub cl, dl
+
+    shl dx, 5
     mov di, es
-    add di, cx
+    add di, dx
     mov es, di
-    
-    jmp .loop
+
+    jmp .chunk
 
 .read_finish:
 
 
     mov dl, [ebr_drive_number]
     
-    mov ax, STAGE2_LOAD_SEGMENT
+    xor ax, ax
     mov ds, ax
     mov es, ax
 
-    jmp STAGE2_LOAD_SEGMENT:STAGE2_LOAD_OFFSET
-
-    jmp wait_key_and_reboot
-
-    cli
-    hlt
+    jmp 0:STAGE2_LOAD_ADDR
 
 floppy_error:
     mov si, msg_disk_read_failed
     call puts
     jmp wait_key_and_reboot
 
-kernel_not_found_error:
-    mov si, msg_kernel_not_found
-    call puts
-    jmp wait_key_and_reboot
-
 wait_key_and_reboot:
     mov ah, 0
     int 16h
@@ -252,8 +263,6 @@ disk_reset:
 
 msg_loading:            db 'Loading...', ENDL, 0
 msg_disk_read_failed:        db 'Read from disk failed!', ENDL, 0
-msg_kernel_not_found:   db 'STAGE2.BIN file not found!', ENDL, 0
-file_kernel_bin:        db 'STAGE2  BIN'
 
 have_extensions:        db 0
 extensions_dap:
@@ -264,13 +273,12 @@ extensions_dap:
     .segment:           dw 0
     .lba:               dq 0
 
-STAGE2_LOAD_SEGMENT     equ 0x0
-STAGE2_LOAD_OFFSET      equ 0x500
+; right after us, stage2's linker.ld checks it ends before 0x20000
+STAGE2_LOAD_ADDR        equ 0x7E00
+STAGE2_LOAD_SEGMENT     equ STAGE2_LOAD_ADDR >> 4
 
 
 times 510-30-($-$$) db 0
 
 stage2_location:        times 30 db 0
 dw 0AA55h
-
-buffer:
@@ -0,0 +1,149 @@
+#include "acpi.h"
+#include "memdefs.h"
+#include "memory.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ACPI_EBDA_SEGMENT           0x40E       // BDA word holding the EBDA segment
+#define ACPI_EBDA_SEARCH_SIZE       1024
+#define ACPI_BIOS_AREA_START        0xE0000
+#define ACPI_BIOS_AREA_END          0x100000
+#define ACPI_RSDP_ALIGN             16
+#define ACPI_MAX_TABLE_SIZE         0x10000     // anything longer is a corrupted header
+
+#define MADT_ENTRY_LOCAL_APIC       0
+#define MADT_LOCAL_APIC_ENABLED     (1 << 0)
+
+typedef struct
+{
+    char Signature[8];
+    uint8_t Checksum;           // over these 20 bytes, what ACPI 1.0 defined
+    char OemId[6];
+    uint8_t Revision;
+    uint32_t RsdtAddress;
+} __attribute__((packed)) acpi_Rsdp;
+
+typedef struct
+{
+    char Signature[4];
+    uint32_t Length;            // of the whole table, header included
+    uint8_t Revision;
+    uint8_t Checksum;
+    char OemId[6];
+    char OemTableId[8];
+    uint32_t OemRevision;
+    uint32_t CreatorId;
+    uint32_t CreatorRevision;
+} __attribute__((packed)) acpi_TableHeader;
+
+typedef struct
+{
+    acpi_TableHeader Header;
+    uint32_t LocalApicAddress;
+    uint32_t Flags;
+    uint8_t Entries[];
+} __attribute__((packed)) acpi_Madt;
+
+typedef struct
+{
+    uint8_t Type;
+    uint8_t Length;
+    uint8_t ProcessorId;
+    uint8_t ApicId;
+    uint32_t Flags;
+} __attribute__((packed)) acpi_MadtLocalApic;
+
+static bool acpi_Checksum(const void* data, uint32_t size)
+{
+    const uint8_t* u8Data = (const uint8_t*)data;
+    uint8_t sum = 0;
+
+    while (size--)
+        sum += *u8Data++;
+
+    return sum == 0;
+}
+
+static const acpi_Rsdp* acpi_ScanRsdp(uint32_t start, uint32_t end)
+{
+    for (uint32_t address = start; address + sizeof(acpi_Rsdp) <= end; address += ACPI_RSDP_ALIGN)
+    {
+        const acpi_Rsdp* rsdp = (const acpi_Rsdp*)(MEMORY_BASE + address);
+        if (memcmp(rsdp->Signature, "RSD PTR ", sizeof(rsdp->Signature)) == 0 && acpi_Checksum(rsdp, sizeof(acpi_Rsdp)))
+            return rsdp;
+    }
+
+    return NULL;
+}
+
+// The RSDP is in the first KiB of the EBDA or in the BIOS area below 1 MiB
+static const acpi_Rsdp* acpi_FindRsdp()
+{
+    uint32_t ebda = (uint32_t)*(const uint16_t*)(MEMORY_BASE + ACPI_EBDA_SEGMENT) << 4;
+    const acpi_Rsdp* rsdp = NULL;
+
+    if (ebda >= MEMORY_MIN && ebda < ACPI_BIOS_AREA_START)
+        rsdp = acpi_ScanRsdp(ebda, ebda + ACPI_EBDA_SEARCH_SIZE);
+
+    return rsdp != NULL ? rsdp : acpi_ScanRsdp(ACPI_BIOS_AREA_START, ACPI_BIOS_AREA_END);
+}
+
+static const acpi_TableHeader* acpi_CheckTable(uint32_t address)
+{
+    const acpi_TableHeader* table = (const acpi_TableHeader*)(MEMORY_BASE + address);
+    if (address == 0 || table->Length < sizeof(acpi_TableHeader) || table->Length > ACPI_MAX_TABLE_SIZE
+        || !acpi_Checksum(table, table->Length))
+        return NULL;
+
+    return table;
+}
+
+// Only the 32 bit RSDT is walked, every ACPI version has one
+static const acpi_TableHeader* acpi_FindTable(const char* signature)
+{
+    const acpi_Rsdp* rsdp = acpi_FindRsdp();
+    if (rsdp == NULL)
+        return NULL;
+
+    const acpi_TableHeader* rsdt = acpi_CheckTable(rsdp->RsdtAddress);
+    if (rsdt == NULL || memcmp(rsdt->Signature, "RSDT", 4) != 0)
+        return NULL;
+
+    const uint32_t* entries = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->Length - sizeof(acpi_TableHeader)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const acpi_TableHeader* table = acpi_CheckTable(entries[i]);
+        if (table != NULL && memcmp(table->Signature, signature, 4) == 0)
+            return table;
+    }
+
+    return NULL;
+}
+
+uint32_t acpi_FindProcessors(uint8_t* apicIdsOut, uint32_t maxCount)
+{
+    const acpi_Madt* madt = (const acpi_Madt*)acpi_FindTable("APIC");
+    if (madt == NULL || madt->Header.Length < sizeof(acpi_Madt))
+        return 0;
+
+    uint32_t count = 0;
+    const uint8_t* entry = madt->Entries;
+    const uint8_t* end = (const uint8_t*)madt + madt->Header.Length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end)
+    {
+        // x2APIC entries only list CPUs stage2 can't address in xAPIC mode anyway
+        const acpi_MadtLocalApic* localApic = (const acpi_MadtLocalApic*)entry;
+        if (localApic->Type == MADT_ENTRY_LOCAL_APIC && localApic->Length >= sizeof(acpi_MadtLocalApic)
+            && (localApic->Flags & MADT_LOCAL_APIC_ENABLED))
+        {
+            if (count < maxCount)
+                apicIdsOut[count] = localApic->ApicId;
+            count++;
+        }
+
+        entry += entry[1];
+    }
+
+    return count;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+// Reads the local APIC ids of the enabled processors, the BSP included, from the
+// ACPI MADT. Returns how many there are (at most maxCount are stored), 0 if the
+// firmware has no usable RSDP, RSDT or MADT. Paging has to be off: the tables
+// are found by physical address.
+uint32_t acpi_FindProcessors(uint8_t* apicIdsOut, uint32_t maxCount);
@@ -0,0 +1,557 @@
+#include "ahci.h"
+#include "pci.h"
+#include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE                 512
+
+#define AHCI_MAX_PORTS              32
+#define AHCI_MAX_SLOTS              32
+#define AHCI_MAX_PRDS               64
+#define AHCI_MAX_COMMAND_SECTORS    4096        // 2 MiB, keeps several commands in flight on big loads
+#define AHCI_TIMEOUT                10000000    // register polls before giving up
+
+#define AHCI_PCI_CLASS              0x01
+#define AHCI_PCI_SUBCLASS           0x06
+#define AHCI_PCI_PROG_IF            0x01
+#define AHCI_PCI_ABAR               (PCI_REG_BAR0 + 5 * 4)
+
+#define AHCI_CAP_SNCQ               (1 << 30)
+#define AHCI_GHC_AE                 (1u << 31)
+
+#define AHCI_PORT_CMD_ST            (1 << 0)
+#define AHCI_PORT_CMD_FRE           (1 << 4)
+#define AHCI_PORT_CMD_FR            (1 << 14)
+#define AHCI_PORT_CMD_CR            (1 << 15)
+
+#define AHCI_PORT_IS_ERRORS         0x78000000  // TFES | HBFS | HBDS | IFS
+
+#define AHCI_PORT_TFD_BSY           0x80
+#define AHCI_PORT_TFD_DRQ           0x08
+
+#define AHCI_PORT_SSTS_PRESENT      0x103       // IPM active, DET device present with phy
+#define AHCI_PORT_SIG_ATA           0x00000101
+
+#define AHCI_FIS_REG_H2D            0x27
+#define AHCI_FIS_COMMAND            0x80
+
+#define ATA_CMD_READ_DMA_EXT        0x25
+#define ATA_CMD_READ_FPDMA_QUEUED   0x60
+#define ATA_CMD_IDENTIFY            0xEC
+#define ATA_DEVICE_LBA              0x40
+
+// IDENTIFY DEVICE words
+#define ATA_ID_QUEUE_DEPTH          75
+#define ATA_ID_SATA_CAPABILITIES    76
+#define ATA_ID_COMMAND_SETS         83
+#define ATA_ID_SATA_NCQ             (1 << 8)
+#define ATA_ID_LBA48                (1 << 10)
+
+typedef volatile struct
+{
+    uint32_t CommandListBase;
+    uint32_t CommandListBaseUpper;
+    uint32_t FisBase;
+    uint32_t FisBaseUpper;
+    uint32_t InterruptStatus;
+    uint32_t InterruptEnable;
+    uint32_t Command;
+    uint32_t _Reserved0;
+    uint32_t TaskFileData;
+    uint32_t Signature;
+    uint32_t SataStatus;
+    uint32_t SataControl;
+    uint32_t SataError;
+    uint32_t SataActive;
+    uint32_t CommandIssue;
+    uint32_t SataNotification;
+    uint32_t _Reserved1[16];
+} ahci_PortRegisters;
+
+typedef volatile struct
+{
+    uint32_t Capabilities;
+    uint32_t GlobalHostControl;
+    uint32_t InterruptStatus;
+    uint32_t PortsImplemented;
+    uint32_t _Reserved[60];
+    ahci_PortRegisters Ports[AHCI_MAX_PORTS];
+} ahci_Registers;
+
+typedef struct
+{
+    uint16_t Flags;                 // bits 4:0 - command FIS length in dwords
+    uint16_t PrdtLength;
+    uint32_t PrdByteCount;
+    uint32_t TableBase;
+    uint32_t TableBaseUpper;
+    uint32_t _Reserved[4];
+} __attribute__((packed)) ahci_CommandHeader;
+
+typedef struct
+{
+    uint8_t Type;
+    uint8_t Flags;
+    uint8_t Command;
+    uint8_t FeatureLow;
+    uint8_t Lba0;
+    uint8_t Lba1;
+    uint8_t Lba2;
+    uint8_t Device;
+    uint8_t Lba3;
+    uint8_t Lba4;
+    uint8_t Lba5;
+    uint8_t FeatureHigh;
+    uint8_t CountLow;
+    uint8_t CountHigh;
+    uint8_t Icc;
+    uint8_t Control;
+    uint8_t _Reserved[4];
+} __attribute__((packed)) ahci_FisRegH2D;
+
+typedef struct
+{
+    uint32_t DataBase;
+    uint32_t DataBaseUpper;
+    uint32_t _Reserved;
+    uint32_t ByteCount;             // bytes - 1, must be odd
+} __attribute__((packed)) ahci_Prd;
+
+typedef struct
+{
+    uint8_t CommandFis[64];
+    uint8_t AtapiCommand[16];
+    uint8_t _Reserved[48];
+    ahci_Prd Prdt[AHCI_MAX_PRDS];
+} __attribute__((packed)) ahci_CommandTable;
+
+typedef struct
+{
+    bool Present;
+    bool Ncq;
+    uint8_t Depth;
+} ahci_Disk;
+
+// BIOS state of the port we borrow, INT 13h keeps working once it's restored
+typedef struct
+{
+    uint32_t CommandListBase;
+    uint32_t CommandListBaseUpper;
+    uint32_t FisBase;
+    uint32_t FisBaseUpper;
+    uint32_t InterruptEnable;
+    uint32_t Command;
+} ahci_SavedPort;
+
+// the sectors a command slot covers, starting at Done sectors into Segment
+typedef struct
+{
+    int Segment;
+    uint32_t Done;
+    uint32_t Sectors;
+} ahci_Request;
+
+// 0x000 - command list, 0x400 - received FIS, 0x600 - scratch sector, 0x800 - command tables
+#define AHCI_COMMAND_LIST           ((ahci_CommandHeader*)MEMORY_AHCI_ADDR)
+#define AHCI_RECEIVED_FIS           ((uint8_t*)MEMORY_AHCI_ADDR + 0x400)
+#define AHCI_SCRATCH                ((uint8_t*)MEMORY_AHCI_ADDR + 0x600)
+#define AHCI_COMMAND_TABLES         ((ahci_CommandTable*)((uint8_t*)MEMORY_AHCI_ADDR + 0x800))
+
+// the compiler must not move table writes past a doorbell write, or buffer reads before completion
+#define ahci_Barrier()              __asm__ volatile("" ::: "memory")
+
+static ahci_Registers* g_Hba;
+static uint8_t g_Slots;
+static bool g_HbaNcq;
+static ahci_Disk g_Disks[AHCI_MAX_PORTS];
+
+static bool ahci_WaitClear(volatile uint32_t* reg, uint32_t mask)
+{
+    for (uint32_t i = 0; i < AHCI_TIMEOUT; i++)
+        if ((*reg & mask) == 0)
+            return true;
+
+    return false;
+}
+
+static bool ahci_StopPort(ahci_PortRegisters* port)
+{
+    port->Command &= ~AHCI_PORT_CMD_ST;
+    if (!ahci_WaitClear(&port->Command, AHCI_PORT_CMD_CR))
+        return false;
+
+    port->Command &= ~AHCI_PORT_CMD_FRE;
+    return ahci_WaitClear(&port->Command, AHCI_PORT_CMD_FR);
+}
+
+static bool ahci_StartPort(ahci_PortRegisters* port, uint32_t flags)
+{
+    port->SataError = 0xFFFFFFFF;
+    port->InterruptStatus = 0xFFFFFFFF;
+
+    if (flags & AHCI_PORT_CMD_FRE)
+        port->Command |= AHCI_PORT_CMD_FRE;
+
+    if (flags & AHCI_PORT_CMD_ST)
+    {
+        if (!ahci_WaitClear(&port->TaskFileData, AHCI_PORT_TFD_BSY | AHCI_PORT_TFD_DRQ))
+            return false;
+
+        port->Command |= AHCI_PORT_CMD_ST;
+    }
+
+    return true;
+}
+
+static void ahci_ReleasePort(ahci_PortRegisters* port, const ahci_SavedPort* saved)
+{
+    ahci_StopPort(port);
+
+    port->CommandListBase = saved->CommandListBase;
+    port->CommandListBaseUpper = saved->CommandListBaseUpper;
+    port->FisBase = saved->FisBase;
+    port->FisBaseUpper = saved->FisBaseUpper;
+
+    ahci_StartPort(port, saved->Command);
+    port->InterruptEnable = saved->InterruptEnable;
+}
+
+static bool ahci_AcquirePort(ahci_PortRegisters* port, ahci_SavedPort* saved)
+{
+    saved->CommandListBase = port->CommandListBase;
+    saved->CommandListBaseUpper = port->CommandListBaseUpper;
+    saved->FisBase = port->FisBase;
+    saved->FisBaseUpper = port->FisBaseUpper;
+    saved->InterruptEnable = port->InterruptEnable;
+    saved->Command = port->Command;
+
+    if (!ahci_StopPort(port))
+    {
+        printf("AHCI: port won't stop\r\n");
+        return false;
+    }
+
+    port->InterruptEnable = 0;
+    port->CommandListBase = (uint32_t)AHCI_COMMAND_LIST;
+    port->CommandListBaseUpper = 0;
+    port->FisBase = (uint32_t)AHCI_RECEIVED_FIS;
+    port->FisBaseUpper = 0;
+
+    if (!ahci_StartPort(port, AHCI_PORT_CMD_FRE | AHCI_PORT_CMD_ST))
+    {
+        printf("AHCI: port won't start\r\n");
+        ahci_ReleasePort(port, saved);
+        return false;
+    }
+
+    return true;
+}
+
+// Fills in the command header and FIS of a slot, the PRDT must already be set up
+static void ahci_SetupCommand(int slot, uint8_t command, uint32_t lba, uint32_t sectors, int prdCount, bool queued)
+{
+    ahci_CommandHeader* header = &AHCI_COMMAND_LIST[slot];
+    ahci_CommandTable* table = &AHCI_COMMAND_TABLES[slot];
+    ahci_FisRegH2D* fis = (ahci_FisRegH2D*)table->CommandFis;
+
+    memset(fis, 0, sizeof(ahci_FisRegH2D));
+    fis->Type = AHCI_FIS_REG_H2D;
+    fis->Flags = AHCI_FIS_COMMAND;
+    fis->Command = command;
+
+    if (command != ATA_CMD_IDENTIFY)
+    {
+        fis->Device = ATA_DEVICE_LBA;
+        fis->Lba0 = lba & 0xFF;
+        fis->Lba1 = (lba >> 8) & 0xFF;
+        fis->Lba2 = (lba >> 16) & 0xFF;
+        fis->Lba3 = (lba >> 24) & 0xFF;
+    }
+
+    // NCQ moves the sector count to the features field, count carries the tag
+    if (queued)
+    {
+        fis->FeatureLow = sectors & 0xFF;
+        fis->FeatureHigh = (sectors >> 8) & 0xFF;
+        fis->CountLow = slot << 3;
+    }
+    else
+    {
+        fis->CountLow = sectors & 0xFF;
+        fis->CountHigh = (sectors >> 8) & 0xFF;
+    }
+
+    memset(header, 0, sizeof(ahci_CommandHeader));
+    header->Flags = sizeof(ahci_FisRegH2D) / sizeof(uint32_t);
+    header->PrdtLength = prdCount;
+    header->TableBase = (uint32_t)table;
+}
+
+static void ahci_SetPrd(int slot, int index, void* buffer, uint32_t bytes)
+{
+    ahci_Prd* prd = &AHCI_COMMAND_TABLES[slot].Prdt[index];
+    prd->DataBase = (uint32_t)buffer;
+    prd->DataBaseUpper = 0;
+    prd->_Reserved = 0;
+    prd->ByteCount = bytes - 1;
+}
+
+// Runs one non-queued command in slot 0 and waits for it
+static bool ahci_RunCommand(ahci_PortRegisters* port, uint8_t command, uint32_t lba, uint32_t sectors, void* buffer)
+{
+    ahci_SetPrd(0, 0, buffer, sectors * SECTOR_SIZE);
+    ahci_SetupCommand(0, command, lba, sectors, 1, false);
+
+    ahci_Barrier();
+    port->CommandIssue = 1;
+
+    for (uint32_t i = 0; i < AHCI_TIMEOUT; i++)
+    {
+        if (port->InterruptStatus & AHCI_PORT_IS_ERRORS)
+            return false;
+
+        if ((port->CommandIssue & 1) == 0)
+        {
+            ahci_Barrier();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ahci_Initialize()
+{
+    pci_Address address;
+    if (!pci_FindClass(AHCI_PCI_CLASS, AHCI_PCI_SUBCLASS, AHCI_PCI_PROG_IF, &address))
+        return false;
+
+    // upper half of the command register is the write-1-to-clear status
+    uint32_t command = pci_ConfigRead(address, PCI_REG_COMMAND) & 0xFFFF;
+    pci_ConfigWrite(address, PCI_REG_COMMAND, command | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+    // the BIOS keeps ownership of the HBA, we only borrow the boot disk's port for a while
+    g_Hba = (ahci_Registers*)(pci_ConfigRead(address, AHCI_PCI_ABAR) & 0xFFFFFFF0);
+    g_Hba->GlobalHostControl |= AHCI_GHC_AE;
+
+    uint32_t capabilities = g_Hba->Capabilities;
+    g_Slots = ((capabilities >> 8) & 0x1F) + 1;
+    g_HbaNcq = (capabilities & AHCI_CAP_SNCQ) != 0;
+
+    bool found = false;
+    for (int i = 0; i < AHCI_MAX_PORTS; i++)
+    {
+        ahci_PortRegisters* port = &g_Hba->Ports[i];
+        g_Disks[i].Present = (g_Hba->PortsImplemented & (1u << i))
+                          && (port->SataStatus & 0xF0F) == AHCI_PORT_SSTS_PRESENT
+                          && port->Signature == AHCI_PORT_SIG_ATA;
+        found |= g_Disks[i].Present;
+    }
+
+    return found;
+}
+
+int ahci_FindDisk(const void* firstSector)
+{
+    for (int i = 0; i < AHCI_MAX_PORTS; i++)
+    {
+        if (!g_Disks[i].Present)
+            continue;
+
+        ahci_PortRegisters* port = &g_Hba->Ports[i];
+        ahci_SavedPort saved;
+        if (!ahci_AcquirePort(port, &saved))
+            continue;
+
+        bool ok = ahci_RunCommand(port, ATA_CMD_IDENTIFY, 0, 1, AHCI_SCRATCH);
+        if (ok)
+        {
+            const uint16_t* identify = (const uint16_t*)AHCI_SCRATCH;
+            ok = (identify[ATA_ID_COMMAND_SETS] & ATA_ID_LBA48) != 0;
+
+            g_Disks[i].Ncq = g_HbaNcq && (identify[ATA_ID_SATA_CAPABILITIES] & ATA_ID_SATA_NCQ);
+            g_Disks[i].Depth = g_Slots;
+            if (g_Disks[i].Ncq)
+                g_Disks[i].Depth = min(g_Slots, (identify[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1);
+        }
+
+        ok = ok && ahci_RunCommand(port, ATA_CMD_READ_DMA_EXT, 0, 1, AHCI_SCRATCH);
+        ahci_ReleasePort(port, &saved);
+
+        if (ok && memcmp(AHCI_SCRATCH, firstSector, SECTOR_SIZE) == 0)
+        {
+            printf("AHCI: boot disk on port %d, %s, %u commands in flight\r\n", i, g_Disks[i].Ncq ? "NCQ" : "no NCQ", g_Disks[i].Depth);
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Builds the next command from segments[*i], *done sectors in, into the given slot
+static void ahci_BuildRead(int slot, bool queued, disk_Segment* segments, int count, int* i, uint32_t* done, ahci_Request* request)
+{
+    uint32_t lba = segments[*i].Lba + *done;
+    uint32_t sectors = 0;
+    int prdCount = 0;
+    uint8_t* prdEnd = NULL;
+
+    request->Segment = *i;
+    request->Done = *done;
+
+    while (*i < count && sectors < AHCI_MAX_COMMAND_SECTORS)
+    {
+        if (*done >= segments[*i].Count)
+        {
+            (*i)++;
+            *done = 0;
+            continue;
+        }
+
+        if (segments[*i].Lba + *done != lba + sectors)
+            break;
+
+        uint8_t* destination = (uint8_t*)segments[*i].Destination + *done * SECTOR_SIZE;
+        uint32_t take = min(segments[*i].Count - *done, AHCI_MAX_COMMAND_SECTORS - sectors);
+
+        // extend the previous PRD if the memory continues, otherwise start a new one
+        if (destination == prdEnd)
+        {
+            ahci_Prd* prd = &AHCI_COMMAND_TABLES[slot].Prdt[prdCount - 1];
+            prd->ByteCount += take * SECTOR_SIZE;
+        }
+        else if (prdCount < AHCI_MAX_PRDS)
+        {
+            ahci_SetPrd(slot, prdCount++, destination, take * SECTOR_SIZE);
+        }
+        else
+        {
+            break;
+        }
+
+        prdEnd = destination + take * SECTOR_SIZE;
+        sectors += take;
+        *done += take;
+    }
+
+    request->Sectors = sectors;
+    ahci_SetupCommand(slot, queued ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_READ_DMA_EXT, lba, sectors, prdCount, queued);
+}
+
+static void ahci_Complete(disk_Segment* segments, const ahci_Request* request)
+{
+    int i = request->Segment;
+    uint32_t done = request->Done;
+    uint32_t left = request->Sectors;
+
+    while (left > 0)
+    {
+        if (done >= segments[i].Count)
+        {
+            i++;
+            done = 0;
+            continue;
+        }
+
+        uint32_t take = min(segments[i].Count - done, left);
+        segments[i].Completed += take;
+        done += take;
+        left -= take;
+    }
+}
+
+bool ahci_ReadVectored(int portIndex, disk_Segment* segments, int count)
+{
+    ahci_PortRegisters* port = &g_Hba->Ports[portIndex];
+    const ahci_Disk* disk = &g_Disks[portIndex];
+    ahci_Request requests[AHCI_MAX_SLOTS];
+    ahci_SavedPort saved;
+
+    for (int k = 0; k < count; k++)
+    {
+        segments[k].Completed = 0;
+
+        // PRDs need word aligned buffers
+        if ((uint32_t)segments[k].Destination & 1)
+            return false;
+    }
+
+    if (!ahci_AcquirePort(port, &saved))
+        return false;
+
+    bool ok = true;
+    int i = 0;
+    uint32_t done = 0;
+    uint32_t busy = 0;
+    int inFlight = 0;
+    uint32_t spins = 0;
+
+    while (i < count || busy != 0)
+    {
+        // keep the queue full
+        while (inFlight < disk->Depth)
+        {
+            while (i < count && done >= segments[i].Count)
+            {
+                i++;
+                done = 0;
+            }
+
+            if (i >= count)
+                break;
+
+            int slot = 0;
+            while (busy & (1u << slot))
+                slot++;
+
+            ahci_BuildRead(slot, disk->Ncq, segments, count, &i, &done, &requests[slot]);
+
+            ahci_Barrier();
+            if (disk->Ncq)
+                port->SataActive = 1u << slot;
+            port->CommandIssue = 1u << slot;
+
+            busy |= 1u << slot;
+            inFlight++;
+        }
+
+        if (port->InterruptStatus & AHCI_PORT_IS_ERRORS)
+        {
+            printf("AHCI: read error, status %x\r\n", port->TaskFileData);
+            ok = false;
+            break;
+        }
+
+        uint32_t active = port->CommandIssue | (disk->Ncq ? port->SataActive : 0);
+        uint32_t finished = busy & ~active;
+        if (finished == 0)
+        {
+            if (++spins > AHCI_TIMEOUT)
+            {
+                printf("AHCI: read timed out\r\n");
+                ok = false;
+                break;
+            }
+            continue;
+        }
+
+        ahci_Barrier();
+        spins = 0;
+        for (int slot = 0; slot < AHCI_MAX_SLOTS; slot++)
+        {
+            if (finished & (1u << slot))
+            {
+                ahci_Complete(segments, &requests[slot]);
+                inFlight--;
+            }
+        }
+        busy &= ~finished;
+    }
+
+    // stopping the port also aborts whatever was still queued after an error
+    ahci_ReleasePort(port, &saved);
+    return ok;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "disk.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Finds the AHCI controller and the ports with a SATA disk attached
+bool ahci_Initialize();
+
+// Returns the port whose disk has the given first sector, or -1
+int ahci_FindDisk(const void* firstSector);
+
+// Reads the segments straight into their destinations, keeping up to one NCQ command
+// per slot in flight. Completion is polled. Segments that are adjacent on disk share
+// a command, each destination gets its own PRDT entry.
+bool ahci_ReadVectored(int port, disk_Segment* segments, int count);
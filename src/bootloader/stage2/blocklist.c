@@ -0,0 +1,170 @@
+#include "blocklist.h"
+#include "crc32.h"
+#include "fat.h"
+#include "smp.h"
+#include "stdio.h"
+#include "string.h"
+#include "memdefs.h"
+#include "minmax.h"
+#include <boot/blocklist.h>
+#include <stddef.h>
+
+#define SECTOR_SIZE 512
+#define BLOCKLIST_PIECE_SIZE 0x10000    // bytes one CPU hashes at a time
+#define BLOCKLIST_MAX_PIECES 64
+
+// kept for the kernel in the region the FAT driver would have used
+#define BLOCKLIST_BOOT_SECTOR ((uint8_t*)MEMORY_FAT_ADDR)
+#define BLOCKLIST_ROOT (BLOCKLIST_BOOT_SECTOR + SECTOR_SIZE)
+
+static uint8_t g_BlocklistSector[SECTOR_SIZE];
+
+typedef struct
+{
+    const void* Data;
+    uint32_t Size;
+    uint32_t Crc;
+} blocklist_Piece;
+
+typedef struct
+{
+    uint32_t Crc;           // of all pieces folded in so far
+    uint32_t Remaining;     // kernel bytes not handed out yet, the last sector is padding past them
+    uint32_t PieceCount;
+    blocklist_Piece Pieces[BLOCKLIST_MAX_PIECES];
+} blocklist_Checksum;
+
+static blocklist_Checksum g_Checksum;
+
+static void blocklist_HashPiece(void* argument)
+{
+    blocklist_Piece* piece = (blocklist_Piece*)argument;
+    piece->Crc = crc32(0, piece->Data, piece->Size);
+}
+
+// Waits for the outstanding pieces and appends their CRCs in file order
+static void blocklist_FoldPieces(blocklist_Checksum* checksum)
+{
+    smp_Wait();
+
+    for (uint32_t i = 0; i < checksum->PieceCount; i++)
+        checksum->Crc = crc32_Combine(checksum->Crc, checksum->Pieces[i].Crc, checksum->Pieces[i].Size);
+
+    checksum->PieceCount = 0;
+}
+
+// Splits each chunk that arrives into pieces any idle CPU can hash
+static void blocklist_ChecksumProgress(void* context, const void* data, uint32_t sectors)
+{
+    blocklist_Checksum* checksum = (blocklist_Checksum*)context;
+    uint32_t size = min(checksum->Remaining, sectors * SECTOR_SIZE);
+    const uint8_t* u8Data = (const uint8_t*)data;
+
+    checksum->Remaining -= size;
+    while (size > 0)
+    {
+        if (checksum->PieceCount == BLOCKLIST_MAX_PIECES)
+            blocklist_FoldPieces(checksum);
+
+        blocklist_Piece* piece = &checksum->Pieces[checksum->PieceCount++];
+        piece->Data = u8Data;
+        piece->Size = min(size, BLOCKLIST_PIECE_SIZE);
+        smp_Submit(blocklist_HashPiece, piece);
+
+        u8Data += piece->Size;
+        size -= piece->Size;
+    }
+}
+
+bool blocklist_LoadKernel(DISK* disk, BootParams* params)
+{
+    disk_Segment header = { 0, 1, BLOCKLIST_BOOT_SECTOR, 0 };
+    if (!disk_ReadVectored(disk, &header, 1))
+        return false;
+
+    uint16_t reservedSectors = *(const uint16_t*)(BLOCKLIST_BOOT_SECTOR + BLOCKLIST_RESERVED_OFFSET);
+    uint32_t volumeId = *(const uint32_t*)(BLOCKLIST_BOOT_SECTOR + BLOCKLIST_VOLUME_ID_OFFSET);
+    if (reservedSectors < 2)
+        return false;
+
+    disk_Segment blocklistSegment = { reservedSectors - 1, 1, g_BlocklistSector, 0 };
+    if (!disk_ReadVectored(disk, &blocklistSegment, 1))
+        return false;
+
+    const Blocklist* blocklist = (const Blocklist*)g_BlocklistSector;
+    if (blocklist->Magic != BLOCKLIST_MAGIC)
+        return false;
+
+    if (blocklist->HeaderChecksum != crc32(0, blocklist, offsetof(Blocklist, HeaderChecksum))
+        || blocklist->ExtentCount > BLOCKLIST_MAX_EXTENTS)
+    {
+        printf("BLOCKLIST: corrupted, using FAT\r\n");
+        return false;
+    }
+
+    if (blocklist->Generation != volumeId)
+    {
+        printf("BLOCKLIST: stale, using FAT\r\n");
+        return false;
+    }
+
+    // other tools leave the generation alone, but not the root directory
+    disk_Segment root = { blocklist->RootLba, blocklist->RootSectors, BLOCKLIST_ROOT, 0 };
+    if (blocklist->RootSectors == 0 || blocklist->RootSectors > BLOCKLIST_MAX_ROOT_SECTORS
+        || !disk_ReadVectored(disk, &root, 1))
+        return false;
+
+    if (crc32(0, BLOCKLIST_ROOT, blocklist->RootSectors * SECTOR_SIZE) != blocklist->RootChecksum)
+    {
+        printf("BLOCKLIST: root directory changed, using FAT\r\n");
+        return false;
+    }
+
+    disk_Segment segments[BLOCKLIST_MAX_EXTENTS];
+    uint8_t* destination = (uint8_t*)MEMORY_KERNEL_ADDR;
+    for (uint32_t i = 0; i < blocklist->ExtentCount; i++)
+    {
+        segments[i].Lba = blocklist->Extents[i].Lba;
+        segments[i].Count = blocklist->Extents[i].Count;
+        segments[i].Destination = destination;
+        destination += blocklist->Extents[i].Count * SECTOR_SIZE;
+    }
+
+    // each chunk is hashed, spread over the CPUs that have arrived by then, while
+    // the disk reads the next one
+    blocklist_Checksum* checksum = &g_Checksum;
+    checksum->Crc = 0;
+    checksum->Remaining = blocklist->KernelSize;
+    checksum->PieceCount = 0;
+
+    bool ok = disk_ReadVectoredPipelined(disk, segments, blocklist->ExtentCount, blocklist_ChecksumProgress, checksum);
+    blocklist_FoldPieces(checksum);
+    if (!ok)
+        return false;
+
+    if (checksum->Remaining != 0 || checksum->Crc != blocklist->KernelChecksum)
+    {
+        printf("BLOCKLIST: kernel checksum mismatch, using FAT\r\n");
+        return false;
+    }
+
+    BootModule* kernel = &params->Modules[0];
+    kernel->Start = (uint32_t)MEMORY_KERNEL_ADDR;
+    kernel->Size = blocklist->KernelSize;
+    kernel->Type = BOOT_MODULE_KERNEL;
+    strcpy(kernel->Name, "/kernel.bin");
+    params->ModuleCount = 1;
+
+    // the FAT itself was never read, the kernel loads it when it needs it
+    BootFilesystem* fs = &params->Filesystem;
+    fat_DescribeBootSector(fs, BLOCKLIST_BOOT_SECTOR);
+    fs->RegionStart = (uint32_t)MEMORY_FAT_ADDR;
+    fs->RegionSize = MEMORY_FAT_SIZE;
+    fs->FatStart = 0;
+    fs->FileCount = 0;
+    fs->RunCount = 1;
+    fs->Runs[0].Lba = blocklist->RootLba;
+    fs->Runs[0].Sectors = blocklist->RootSectors;
+    fs->Runs[0].Address = (uint32_t)BLOCKLIST_ROOT;
+    return true;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdbool.h>
+#include "disk.h"
+#include <boot/bootparams.h>
+
+// Loads the kernel straight from the precomputed blocklist. Returns false if there
+// is no blocklist or it is out of date, the caller then has to go through the FAT.
+bool blocklist_LoadKernel(DISK* disk, BootParams* params);
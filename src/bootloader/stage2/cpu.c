@@ -0,0 +1,68 @@
+#include "cpu.h"
+#include "x86.h"
+
+#define CPUID_EAX 0
+#define CPUID_EBX 1
+#define CPUID_ECX 2
+#define CPUID_EDX 3
+
+// leaf 1 EDX
+#define CPUID_1_EDX_FPU     (1 << 0)
+#define CPUID_1_EDX_PSE     (1 << 3)
+#define CPUID_1_EDX_TSC     (1 << 4)
+#define CPUID_1_EDX_PAE     (1 << 6)
+#define CPUID_1_EDX_APIC    (1 << 9)
+#define CPUID_1_EDX_FXSR    (1 << 24)
+#define CPUID_1_EDX_SSE     (1 << 25)
+#define CPUID_1_EDX_SSE2    (1 << 26)
+
+// leaf 7 EBX
+#define CPUID_7_EBX_ERMS    (1 << 9)
+
+static uint32_t g_CpuFeatures = 0;
+
+void cpu_Initialize()
+{
+    uint32_t regs[4];
+
+    g_CpuFeatures = 0;
+    if (!x86_CPUID_Supported())
+        return;
+
+    x86_CPUID(0, 0, regs);
+    uint32_t maxLeaf = regs[CPUID_EAX];
+
+    if (maxLeaf >= 1)
+    {
+        x86_CPUID(1, 0, regs);
+        uint32_t edx = regs[CPUID_EDX];
+
+        if (edx & CPUID_1_EDX_FPU)  g_CpuFeatures |= CPU_FEATURE_FPU;
+        if (edx & CPUID_1_EDX_PSE)  g_CpuFeatures |= CPU_FEATURE_PSE;
+        if (edx & CPUID_1_EDX_TSC)  g_CpuFeatures |= CPU_FEATURE_TSC;
+        if (edx & CPUID_1_EDX_PAE)  g_CpuFeatures |= CPU_FEATURE_PAE;
+        if (edx & CPUID_1_EDX_APIC) g_CpuFeatures |= CPU_FEATURE_APIC;
+        if (edx & CPUID_1_EDX_FXSR) g_CpuFeatures |= CPU_FEATURE_FXSR;
+
+        // SSE instructions fault until the OS sets OSFXSR, so only advertise them once enabled
+        if ((edx & CPUID_1_EDX_FXSR) && (edx & CPUID_1_EDX_SSE))
+        {
+            x86_EnableSSE();
+            g_CpuFeatures |= CPU_FEATURE_SSE;
+            if (edx & CPUID_1_EDX_SSE2)
+                g_CpuFeatures |= CPU_FEATURE_SSE2;
+        }
+    }
+
+    if (maxLeaf >= 7)
+    {
+        x86_CPUID(7, 0, regs);
+        if (regs[CPUID_EBX] & CPUID_7_EBX_ERMS)
+            g_CpuFeatures |= CPU_FEATURE_ERMS;
+    }
+}
+
+bool cpu_Has(uint32_t features)
+{
+    return (g_CpuFeatures & features) == features;
+}
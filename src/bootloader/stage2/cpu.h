@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+enum cpu_Features {
+    CPU_FEATURE_FPU     = 1 << 0,
+    CPU_FEATURE_PSE     = 1 << 1,
+    CPU_FEATURE_TSC     = 1 << 2,
+    CPU_FEATURE_PAE     = 1 << 3,
+    CPU_FEATURE_APIC    = 1 << 4,
+    CPU_FEATURE_FXSR    = 1 << 5,
+    CPU_FEATURE_SSE     = 1 << 6,   // only reported once SSE has been enabled in CR0/CR4
+    CPU_FEATURE_SSE2    = 1 << 7,
+    CPU_FEATURE_ERMS    = 1 << 8,
+};
+
+void cpu_Initialize();
+bool cpu_Has(uint32_t features);
@@ -0,0 +1,88 @@
+#include "crc32.h"
+#include <stdbool.h>
+
+static uint32_t g_Crc32Table[256];
+static bool g_Crc32TableReady = false;
+
+static void crc32_BuildTable()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; bit++)
+            value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+
+        g_Crc32Table[i] = value;
+    }
+
+    g_Crc32TableReady = true;
+}
+
+uint32_t crc32(uint32_t crc, const void* data, uint32_t size)
+{
+    const uint8_t* u8Data = (const uint8_t*)data;
+
+    if (!g_Crc32TableReady)
+        crc32_BuildTable();
+
+    crc = ~crc;
+    while (size--)
+        crc = g_Crc32Table[(crc ^ *u8Data++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+// multiplies the 32x32 GF(2) matrix by vector
+static uint32_t crc32_Gf2Times(const uint32_t* matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; vector; i++, vector >>= 1)
+        if (vector & 1)
+            sum ^= matrix[i];
+
+    return sum;
+}
+
+static void crc32_Gf2Square(uint32_t* square, const uint32_t* matrix)
+{
+    for (int i = 0; i < 32; i++)
+        square[i] = crc32_Gf2Times(matrix, matrix[i]);
+}
+
+uint32_t crc32_Combine(uint32_t crc1, uint32_t crc2, uint32_t size2)
+{
+    uint32_t even[32];      // operator for 2^n zero bytes, n even
+    uint32_t odd[32];       // and n odd
+
+    if (size2 == 0)
+        return crc1;
+
+    // operator for one zero bit
+    odd[0] = 0xEDB88320;
+    for (int i = 1; i < 32; i++)
+        odd[i] = 1 << (i - 1);
+
+    crc32_Gf2Square(even, odd);     // two zero bits
+    crc32_Gf2Square(odd, even);     // four zero bits
+
+    // append size2 zero bytes to crc1, squaring up from one byte
+    for (;;)
+    {
+        crc32_Gf2Square(even, odd);
+        if (size2 & 1)
+            crc1 = crc32_Gf2Times(even, crc1);
+        size2 >>= 1;
+        if (size2 == 0)
+            break;
+
+        crc32_Gf2Square(odd, even);
+        if (size2 & 1)
+            crc1 = crc32_Gf2Times(odd, crc1);
+        size2 >>= 1;
+        if (size2 == 0)
+            break;
+    }
+
+    return crc1 ^ crc2;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3). Pass 0 as crc to start, or a previous result to continue.
+uint32_t crc32(uint32_t crc, const void* data, uint32_t size);
+
+// CRC-32 of A followed by B, from crc32(0, A) and crc32(0, B) and B's size
+uint32_t crc32_Combine(uint32_t crc1, uint32_t crc2, uint32_t size2);
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdbool.h>
+
+bool islower(char chr);
+char toupper(char chr);
@@ -1,23 +1,81 @@
 #include "disk.h"
+#include "ahci.h"
+#include "virtio.h"
+#include "fdc.h"
+#include "ide.h"
 #include "x86.h"
 #include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE 512
+#define DISK_MAX_TRANSFER (MEMORY_LOAD_SIZE / SECTOR_SIZE)
+#define DISK_DMA_BOUNDARY 0x10000
+#define DISK_ATTEMPTS 3
+#define DISK_SPLIT_ATTEMPTS 2
+#define DISK_BOUNCE_BUFFER ((uint8_t*)MEMORY_LOAD_KERNEL)
 
 bool disk_Initialize(DISK* disk, uint8_t driveNumber)
 {
     uint8_t driveType;
     uint16_t cylinders, sectors, heads;
 
-    if (!x86_Disk_GetDriveParams(disk->id, &driveType, &cylinders, &sectors, &heads))
+    if (!x86_Disk_GetDriveParams(driveNumber, &driveType, &cylinders, &sectors, &heads))
         return false;
 
     disk->id = driveNumber;
     disk->cylinders = cylinders;
     disk->heads = heads;
     disk->sectors = sectors;
+    disk->type = DISK_TYPE_BIOS;
+    disk->port = -1;
+    disk->maxTransfer = DISK_MAX_TRANSFER;
+    disk->crossesTracks = true;
+
+    // 1.44 MB floppies are read a cylinder at a time by the controller itself
+    if (!(driveNumber & 0x80) && heads == 2 && sectors == 18 && fdc_Initialize(driveNumber, sectors))
+    {
+        disk->type = DISK_TYPE_FDC;
+        disk->port = driveNumber;
+    }
+
+    // hard disks may sit on a controller we can drive directly, which one is ours is told by the first sector
+    if ((driveNumber & 0x80) && disk_ReadSectors(disk, 0, 1, DISK_BOUNCE_BUFFER))
+    {
+        if (ahci_Initialize())
+        {
+            disk->port = ahci_FindDisk(DISK_BOUNCE_BUFFER);
+            if (disk->port >= 0)
+                disk->type = DISK_TYPE_AHCI;
+        }
+
+        if (disk->type == DISK_TYPE_BIOS && ide_Initialize())
+        {
+            disk->port = ide_FindDisk(DISK_BOUNCE_BUFFER);
+            if (disk->port >= 0)
+                disk->type = DISK_TYPE_IDE;
+        }
+
+        if (disk->type == DISK_TYPE_BIOS)
+        {
+            disk->port = virtio_FindDisk(disk, DISK_BOUNCE_BUFFER);
+            if (disk->port >= 0)
+                disk->type = DISK_TYPE_VIRTIO;
+        }
+    }
 
     return true;
 }
 
+static void disk_DisableNative(DISK* disk)
+{
+    printf("DISK: native access failed, using the BIOS\r\n");
+    disk->type = DISK_TYPE_BIOS;
+    disk->port = -1;
+}
+
 void disk_LBA2CHS(DISK* disk, uint32_t lba, uint16_t* cylinderOut, uint16_t* sectorOut, uint16_t* headOut)
 {
     // sector = (LBA % sectors per track + 1)
@@ -30,13 +88,25 @@ void disk_LBA2CHS(DISK* disk, uint32_t lba, uint16_t* cylinderOut, uint16_t* sec
     *headOut = (lba / disk->sectors) % disk->heads;
 }
 
-bool disk_ReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut)
+// Largest piece of a BIOS read starting at lba within the given limits, 0 if the
+// first sector of buffer straddles a DMA boundary
+static uint32_t disk_BiosChunk(const DISK* disk, uint32_t maxTransfer, bool crossesTracks, uint32_t lba, uint32_t sectors, const uint8_t* buffer)
+{
+    uint32_t chunk = min(sectors, maxTransfer);
+    if (!crossesTracks)
+        chunk = min(chunk, disk->sectors - lba % disk->sectors);
+
+    // floppy reads go through ISA DMA, which can't cross a 64 KiB boundary
+    return min(chunk, (DISK_DMA_BOUNDARY - (uint32_t)buffer % DISK_DMA_BOUNDARY) / SECTOR_SIZE);
+}
+
+static bool disk_BiosRead(DISK* disk, uint32_t lba, uint32_t sectors, void* dataOut, int attempts)
 {
     uint16_t cylinder, sector, head;
 
     disk_LBA2CHS(disk, lba, &cylinder, &sector, &head);
 
-    for (int i = 0; i < 3; i++)
+    for (int i = 0; i < attempts; i++)
     {
         if (x86_Disk_Read(disk->id, cylinder, sector, head, sectors, dataOut))
             return true;
@@ -46,3 +116,278 @@ bool disk_ReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut)
 
     return false;
 }
+
+static bool disk_BiosReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut)
+{
+    uint8_t* buffer = (uint8_t*)dataOut;
+
+    // lowered limits are only kept once the range that failed has been read with
+    // them; a bad sector has to fail the read, not slow down every later one
+    uint32_t maxTransfer = disk->maxTransfer;
+    bool crossesTracks = disk->crossesTracks;
+    uint32_t trialEnd = lba;
+
+    while (sectors > 0)
+    {
+        uint32_t chunk = disk_BiosChunk(disk, maxTransfer, crossesTracks, lba, sectors, buffer);
+        uint8_t* target = chunk > 0 ? buffer : DISK_BOUNCE_BUFFER;
+        if (chunk == 0)
+            chunk = 1;
+
+        // single sectors get all the retries, larger pieces one before they are split
+        if (!disk_BiosRead(disk, lba, chunk, target, chunk > 1 ? DISK_SPLIT_ATTEMPTS : DISK_ATTEMPTS))
+        {
+            if (chunk == 1)
+                return false;
+
+            // two sectors across the same track boundary tell whether crossing it or the size is the problem
+            uint32_t trackEnd = (lba / disk->sectors + 1) * disk->sectors;
+            if (crossesTracks && lba + chunk > trackEnd && !disk_BiosRead(disk, trackEnd - 1, 2, target, DISK_SPLIT_ATTEMPTS))
+            {
+                crossesTracks = false;
+            }
+            else
+            {
+                // the next power of two down, which keeps pieces aligned
+                maxTransfer = 1;
+                while (maxTransfer * 2 < chunk)
+                    maxTransfer *= 2;
+            }
+
+            trialEnd = max(trialEnd, lba + chunk);
+            continue;
+        }
+
+        if (target != buffer)
+            memcpy(buffer, target, SECTOR_SIZE);
+
+        lba += chunk;
+        buffer += chunk * SECTOR_SIZE;
+        sectors -= chunk;
+
+        if (lba >= trialEnd && crossesTracks != disk->crossesTracks)
+        {
+            disk->crossesTracks = crossesTracks;
+            printf("DISK: reads across tracks fail, splitting them\r\n");
+        }
+
+        if (lba >= trialEnd && maxTransfer != disk->maxTransfer)
+        {
+            disk->maxTransfer = maxTransfer;
+            printf("DISK: larger reads fail, using %lu sectors\r\n", maxTransfer);
+        }
+    }
+
+    return true;
+}
+
+bool disk_ReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut)
+{
+    if (disk->type == DISK_TYPE_AHCI)
+    {
+        disk_Segment segment = { lba, sectors, dataOut, 0 };
+        if (ahci_ReadVectored(disk->port, &segment, 1))
+            return true;
+
+        disk_DisableNative(disk);
+    }
+
+    if (disk->type == DISK_TYPE_IDE)
+    {
+        disk_Segment segment = { lba, sectors, dataOut, 0 };
+        if (ide_ReadVectored(disk->port, &segment, 1, NULL, NULL))
+            return true;
+
+        disk_DisableNative(disk);
+    }
+
+    // once stage2 owns the virtio device the BIOS can't reach it anymore
+    if (disk->type == DISK_TYPE_VIRTIO)
+    {
+        disk_Segment segment = { lba, sectors, dataOut, 0 };
+        return virtio_ReadVectored(disk->port, &segment, 1);
+    }
+
+    if (disk->type == DISK_TYPE_FDC)
+    {
+        disk_Segment segment = { lba, sectors, dataOut, 0 };
+        if (fdc_ReadVectored(&segment, 1))
+            return true;
+
+        disk_DisableNative(disk);
+    }
+
+    return disk_BiosReadSectors(disk, lba, sectors, dataOut);
+}
+
+
+// Direct transfers must be reachable from real mode and can't cross a 64 KiB DMA boundary
+static bool disk_CanReadDirect(const uint8_t* destination, uint32_t sectors)
+{
+    uint32_t start = (uint32_t)destination;
+    uint32_t end = start + sectors * SECTOR_SIZE;
+
+    return end <= MEMORY_LOWMEM_LIMIT && (start & ~(DISK_DMA_BOUNDARY - 1)) == ((end - 1) & ~(DISK_DMA_BOUNDARY - 1));
+}
+
+static bool disk_BiosReadVectored(DISK* disk, disk_Segment* segments, int count)
+{
+    bool ok = true;
+    int i = 0;
+    uint32_t done = 0;  // sectors of segments[i] already handled
+
+    for (int k = 0; k < count; k++)
+        segments[k].Completed = 0;
+
+    while (i < count)
+    {
+        if (done >= segments[i].Count)
+        {
+            i++;
+            done = 0;
+            continue;
+        }
+
+        // gather the longest run of disk-adjacent sectors that fits one transfer
+        uint32_t lba = segments[i].Lba + done;
+        uint8_t* start = (uint8_t*)segments[i].Destination + done * SECTOR_SIZE;
+        uint32_t sectors = 0;
+        bool contiguous = true;
+
+        int j = i;
+        uint32_t jdone = done;
+        while (j < count && sectors < DISK_MAX_TRANSFER)
+        {
+            if (jdone >= segments[j].Count)
+            {
+                j++;
+                jdone = 0;
+                continue;
+            }
+
+            if (segments[j].Lba + jdone != lba + sectors)
+                break;
+
+            if ((uint8_t*)segments[j].Destination + jdone * SECTOR_SIZE != start + sectors * SECTOR_SIZE)
+                contiguous = false;
+
+            uint32_t take = min(segments[j].Count - jdone, DISK_MAX_TRANSFER - sectors);
+            sectors += take;
+            jdone += take;
+        }
+
+        bool direct = contiguous && disk_CanReadDirect(start, sectors);
+        if (!disk_BiosReadSectors(disk, lba, sectors, direct ? start : DISK_BOUNCE_BUFFER))
+        {
+            // give up on this segment only, the ones merged after it get their own attempt
+            printf("DISK: read of %lu sectors at lba %lu failed\r\n", sectors, lba);
+            ok = false;
+            i++;
+            done = 0;
+            continue;
+        }
+
+        // hand the sectors out to the segments they belong to
+        uint32_t offset = 0;
+        while (offset < sectors)
+        {
+            if (done >= segments[i].Count)
+            {
+                i++;
+                done = 0;
+                continue;
+            }
+
+            uint32_t take = min(segments[i].Count - done, sectors - offset);
+            if (!direct)
+                memcpy((uint8_t*)segments[i].Destination + done * SECTOR_SIZE, DISK_BOUNCE_BUFFER + offset * SECTOR_SIZE, take * SECTOR_SIZE);
+
+            segments[i].Completed += take;
+            done += take;
+            offset += take;
+        }
+    }
+
+    return ok;
+}
+
+bool disk_ReadVectored(DISK* disk, disk_Segment* segments, int count)
+{
+    if (disk->type == DISK_TYPE_AHCI)
+    {
+        if (ahci_ReadVectored(disk->port, segments, count))
+            return true;
+
+        disk_DisableNative(disk);
+    }
+
+    if (disk->type == DISK_TYPE_IDE)
+    {
+        if (ide_ReadVectored(disk->port, segments, count, NULL, NULL))
+            return true;
+
+        disk_DisableNative(disk);
+    }
+
+    if (disk->type == DISK_TYPE_VIRTIO)
+        return virtio_ReadVectored(disk->port, segments, count);
+
+    if (disk->type == DISK_TYPE_FDC)
+    {
+        if (fdc_ReadVectored(segments, count))
+            return true;
+
+        disk_DisableNative(disk);
+    }
+
+    return disk_BiosReadVectored(disk, segments, count);
+}
+
+bool disk_ReadVectoredPipelined(DISK* disk, disk_Segment* segments, int count, disk_ProgressCallback progress, void* context)
+{
+    if (disk->type == DISK_TYPE_IDE)
+    {
+        if (ide_ReadVectored(disk->port, segments, count, progress, context))
+            return true;
+
+        // progress has seen a prefix of the data in segment order, the BIOS reads the rest
+        disk_DisableNative(disk);
+
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t completed = segments[i].Completed;
+            if (completed >= segments[i].Count)
+                continue;
+
+            disk_Segment rest = {
+                segments[i].Lba + completed,
+                segments[i].Count - completed,
+                (uint8_t*)segments[i].Destination + completed * SECTOR_SIZE,
+                0
+            };
+
+            disk_BiosReadVectored(disk, &rest, 1);
+            segments[i].Completed = completed + rest.Completed;
+            if (rest.Completed > 0)
+                progress(context, rest.Destination, rest.Completed);
+
+            // progress must see the data in order, so stop at the first hole
+            if (rest.Completed < rest.Count)
+                return false;
+        }
+
+        return true;
+    }
+
+    bool ok = disk_ReadVectored(disk, segments, count);
+    for (int i = 0; i < count; i++)
+    {
+        if (segments[i].Completed > 0)
+            progress(context, segments[i].Destination, segments[i].Completed);
+
+        if (segments[i].Completed < segments[i].Count)
+            return false;
+    }
+
+    return ok;
+}
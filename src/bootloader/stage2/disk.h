@@ -2,13 +2,57 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <boot/bootparams.h>
+
+// same values as BootDiskType, so the kernel can be told how the disk was reached
+enum disk_Type {
+    DISK_TYPE_BIOS = BOOT_DISK_BIOS,        // INT 13h
+    DISK_TYPE_AHCI = BOOT_DISK_AHCI,        // SATA port, see ahci.h
+    DISK_TYPE_VIRTIO = BOOT_DISK_VIRTIO,    // virtio-blk device, see virtio.h
+    DISK_TYPE_FDC = BOOT_DISK_FDC,          // floppy controller, see fdc.h
+    DISK_TYPE_IDE = BOOT_DISK_IDE,          // bus-master IDE, see ide.h
+};
 
 typedef struct {
     uint8_t id;
     uint16_t cylinders;
     uint16_t sectors;
     uint16_t heads;
+    uint8_t type;
+    int port;                   // controller port or device index for non-BIOS disks
+    uint8_t maxTransfer;        // BIOS reads: sectors per call, lowered once smaller ones work where larger failed
+    bool crossesTracks;         // BIOS reads: may span tracks, cleared once split reads work where spanning ones failed
 } DISK;
 
+typedef struct {
+    uint32_t Lba;
+    uint32_t Count;         // sectors to read
+    void* Destination;
+    uint32_t Completed;     // out: sectors actually read
+} disk_Segment;
+
+// Gets sectors of a pipelined read in segment order, as soon as they are in memory
+typedef void (*disk_ProgressCallback)(void* context, const void* data, uint32_t sectors);
+
 bool disk_Initialize(DISK* disk, uint8_t driveNumber);
+void disk_LBA2CHS(DISK* disk, uint32_t lba, uint16_t* cylinderOut, uint16_t* sectorOut, uint16_t* headOut);
+// BIOS reads are split into the largest pieces the BIOS has handled so far. A
+// failing piece is retried, then split at track boundaries if a small read across
+// one fails too, else cut to the next power of two down. The disk remembers what
+// it learned for later reads.
 bool disk_ReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut);
+
+// Reads a list of segments using as few transfers as possible. Consecutive segments
+// that are adjacent on disk are merged into one transfer, transfers are only split
+// at the BIOS/DMA limits. Destinations may be anywhere, memory the BIOS can't write
+// to directly goes through a bounce buffer. Disks found on a native controller are
+// read straight into the destinations, falling back to the BIOS if that fails and
+// the BIOS can still reach the disk.
+// Returns false if any segment is incomplete.
+bool disk_ReadVectored(DISK* disk, disk_Segment* segments, int count);
+
+// Same as disk_ReadVectored, but calls progress for each piece of the segments in order
+// as soon as it has been read. With bus-master IDE the next piece is already being read
+// while progress runs, so checksumming or copying the data costs no extra time; other
+// backends report each segment once the whole read is done.
+bool disk_ReadVectoredPipelined(DISK* disk, disk_Segment* segments, int count, disk_ProgressCallback progress, void* context);
@@ -0,0 +1,276 @@
+#include "diskbench.h"
+#include "x86.h"
+#include "cpu.h"
+#include "pit.h"
+#include "stdio.h"
+#include "memdefs.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE                 512
+#define DISKBENCH_CELL_SECTORS      256         // read per measurement, at least two transfers
+#define DISKBENCH_FLOPPY_CELL       36          // two tracks, every random read on a floppy seeks
+#define DISKBENCH_COLUMN_WIDTH      8
+#define DISKBENCH_GOOD_ENOUGH       90          // percent of the best throughput
+
+#define PIT_CALIBRATE_MS            10
+#define PIT_TIMEOUT                 10000000    // port reads before giving up on the PIT
+
+enum diskbench_Path {
+    DISKBENCH_PATH_CHS,
+    DISKBENCH_PATH_LBA,
+    DISKBENCH_PATH_NATIVE,      // disk_ReadSectors on a disk with a native backend
+    DISKBENCH_PATH_COUNT,
+};
+
+enum diskbench_Pattern {
+    DISKBENCH_SEQUENTIAL,       // consecutive, starting on a multiple of the size
+    DISKBENCH_MISALIGNED,       // consecutive, one sector off
+    DISKBENCH_RANDOM,           // multiples of the size all over the disk
+    DISKBENCH_PATTERN_COUNT,
+};
+
+static const uint8_t g_Sizes[] = { 1, 2, 4, 8, 16, 32, 64, 127 };
+#define DISKBENCH_SIZE_COUNT        (sizeof(g_Sizes) / sizeof(g_Sizes[0]))
+
+static const char* const g_PathNames[DISKBENCH_PATH_COUNT] = { "chs", "lba", "nat" };
+static const char* const g_PatternNames[DISKBENCH_PATTERN_COUNT] = { " seq", "  +1", " rnd" };
+
+#define DISKBENCH_BUFFER ((uint8_t*)MEMORY_LOAD_KERNEL)
+
+// KiB/s per size, path and pattern, 0 if any read failed
+static uint32_t g_Results[DISKBENCH_SIZE_COUNT][DISKBENCH_PATH_COUNT][DISKBENCH_PATTERN_COUNT];
+static uint32_t g_SizeCount;        // sizes measured on this disk
+static uint32_t g_CellSectors;
+static uint32_t g_Random;
+
+static uint64_t diskbench_Rdtsc()
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// TSC ticks per millisecond, against a PIT one-shot
+static uint32_t diskbench_CalibrateTsc()
+{
+    pit_StartTimeout(PIT_CALIBRATE_MS);
+    uint64_t start = diskbench_Rdtsc();
+    uint32_t i = 0;
+    while (!pit_TimedOut() && i < PIT_TIMEOUT)
+        i++;
+    uint64_t end = diskbench_Rdtsc();
+
+    if (i == PIT_TIMEOUT)
+        return 0;
+
+    return (uint32_t)((end - start) / PIT_CALIBRATE_MS);
+}
+
+static uint32_t diskbench_NextRandom()
+{
+    g_Random = g_Random * 1103515245 + 12345;
+    return g_Random >> 8;
+}
+
+static bool diskbench_Read(DISK* disk, int path, uint32_t lba, uint32_t sectors)
+{
+    uint16_t cylinder, sector, head;
+
+    switch (path)
+    {
+    case DISKBENCH_PATH_CHS:
+        disk_LBA2CHS(disk, lba, &cylinder, &sector, &head);
+        if (x86_Disk_Read(disk->id, cylinder, sector, head, sectors, DISKBENCH_BUFFER))
+            return true;
+        break;
+
+    case DISKBENCH_PATH_LBA:
+        if (x86_Disk_ExtendedRead(disk->id, lba, sectors, DISKBENCH_BUFFER))
+            return true;
+        break;
+
+    case DISKBENCH_PATH_NATIVE:
+        return disk->type != DISK_TYPE_BIOS && disk_ReadSectors(disk, lba, sectors, DISKBENCH_BUFFER);
+    }
+
+    // a failed BIOS read may leave the controller in a state the next one trips over
+    x86_Disk_Reset(disk->id);
+    return false;
+}
+
+// Returns KiB/s, 0 if any of the reads failed
+static uint32_t diskbench_Measure(DISK* disk, int path, int pattern, uint32_t size, uint32_t totalSectors, uint32_t ticksPerMs)
+{
+    uint32_t transfers = g_CellSectors / size;
+    if (transfers < 2)
+        transfers = 2;
+
+    uint32_t first = pattern == DISKBENCH_MISALIGNED ? 1 : 0;
+    if (first + transfers * size > totalSectors)
+        return 0;
+
+    uint64_t start = diskbench_Rdtsc();
+    for (uint32_t i = 0; i < transfers; i++)
+    {
+        uint32_t lba = first + i * size;
+        if (pattern == DISKBENCH_RANDOM)
+            lba = diskbench_NextRandom() % (totalSectors / size) * size;
+
+        if (!diskbench_Read(disk, path, lba, size))
+            return 0;
+    }
+    uint64_t ticks = diskbench_Rdtsc() - start;
+
+    // KiB/s = sectors / 2 * ticks per second / ticks
+    uint64_t rate = (uint64_t)transfers * size * ticksPerMs * 500 / (ticks > 0 ? ticks : 1);
+    return rate > 0 ? (uint32_t)rate : 1;
+}
+
+static void diskbench_PrintColumn(const char* text, uint32_t value)
+{
+    uint32_t width = 0;
+    if (text != NULL)
+        while (text[width] != '\0')
+            width++;
+    else
+        for (uint32_t rest = value; width == 0 || rest > 0; rest /= 10)
+            width++;
+
+    for (; width < DISKBENCH_COLUMN_WIDTH; width++)
+        printf(" ");
+
+    if (text != NULL)
+        printf("%s", text);
+    else
+        printf("%lu", value);
+}
+
+static void diskbench_PrintTable(const bool* havePath)
+{
+    printf(" KiB/s");
+    for (int path = 0; path < DISKBENCH_PATH_COUNT; path++)
+        if (havePath[path])
+            for (int pattern = 0; pattern < DISKBENCH_PATTERN_COUNT; pattern++)
+                printf(" %s%s", g_PathNames[path], g_PatternNames[pattern]);
+    printf("\r\n");
+
+    for (uint32_t i = 0; i < g_SizeCount; i++)
+    {
+        printf("   ");
+        if (g_Sizes[i] < 100) printf(" ");
+        if (g_Sizes[i] < 10) printf(" ");
+        printf("%u", g_Sizes[i]);
+
+        for (int path = 0; path < DISKBENCH_PATH_COUNT; path++)
+            if (havePath[path])
+                for (int pattern = 0; pattern < DISKBENCH_PATTERN_COUNT; pattern++)
+                    diskbench_PrintColumn(g_Results[i][path][pattern] == 0 ? "fail" : NULL, g_Results[i][path][pattern]);
+        printf("\r\n");
+    }
+}
+
+// Returns the best sequential speed of the sizes up to the first one that ever
+// failed, that size in maxOut and the smallest one close to the best in preferredOut
+static uint32_t diskbench_Evaluate(int path, uint32_t* maxOut, uint32_t* preferredOut)
+{
+    uint32_t best = 0;
+    int largest = -1;
+    for (uint32_t i = 0; i < g_SizeCount; i++)
+    {
+        if (g_Results[i][path][DISKBENCH_SEQUENTIAL] == 0 || g_Results[i][path][DISKBENCH_MISALIGNED] == 0 || g_Results[i][path][DISKBENCH_RANDOM] == 0)
+            break;
+
+        largest = i;
+        if (g_Results[i][path][DISKBENCH_SEQUENTIAL] > best)
+            best = g_Results[i][path][DISKBENCH_SEQUENTIAL];
+    }
+
+    *maxOut = 1;
+    *preferredOut = 1;
+    if (largest < 0)
+        return 0;
+
+    *maxOut = g_Sizes[largest];
+    for (int i = largest; i >= 0; i--)
+        if ((uint64_t)g_Results[i][path][DISKBENCH_SEQUENTIAL] * 100 >= (uint64_t)best * DISKBENCH_GOOD_ENOUGH)
+            *preferredOut = g_Sizes[i];
+
+    return best;
+}
+
+bool diskbench_Run(DISK* disk, diskbench_Policy* policyOut)
+{
+    policyOut->UseLba = false;
+    policyOut->MaxSectors = 1;
+    policyOut->PreferredSectors = 1;
+    policyOut->CrossesTracks = false;
+
+    if (!cpu_Has(CPU_FEATURE_TSC))
+    {
+        printf("DISKBENCH: needs a CPU with a time stamp counter\r\n");
+        return false;
+    }
+
+    uint32_t ticksPerMs = diskbench_CalibrateTsc();
+    if (ticksPerMs == 0)
+    {
+        printf("DISKBENCH: PIT didn't count down, can't calibrate the TSC\r\n");
+        return false;
+    }
+
+    // a failing native read switches the disk to the BIOS, the caller's copy keeps its backend
+    DISK probe = *disk;
+    uint32_t totalSectors = (uint32_t)disk->cylinders * disk->heads * disk->sectors;
+    bool havePath[DISKBENCH_PATH_COUNT];
+    // a native driver owns its controller, BIOS reads behind its back would leave
+    // the hardware in a state neither side expects
+    havePath[DISKBENCH_PATH_CHS] = disk->type == DISK_TYPE_BIOS;
+    havePath[DISKBENCH_PATH_LBA] = havePath[DISKBENCH_PATH_CHS] && x86_Disk_ExtensionsPresent(disk->id);
+    havePath[DISKBENCH_PATH_NATIVE] = disk->type != DISK_TYPE_BIOS;
+
+    // on floppies, stop at transfers of a track and read less per measurement
+    bool floppy = disk->id < 0x80;
+    g_CellSectors = floppy ? DISKBENCH_FLOPPY_CELL : DISKBENCH_CELL_SECTORS;
+    g_SizeCount = 0;
+    while (g_SizeCount < DISKBENCH_SIZE_COUNT && (!floppy || g_Sizes[g_SizeCount] <= disk->sectors))
+        g_SizeCount++;
+
+    printf("DISKBENCH: drive %x, %u/%u/%u CHS, %lu sectors, TSC at %lu kHz\r\n",
+           disk->id, disk->cylinders, disk->heads, disk->sectors, totalSectors, ticksPerMs);
+
+    g_Random = 1;
+    for (uint32_t i = 0; i < g_SizeCount; i++)
+        for (int path = 0; path < DISKBENCH_PATH_COUNT; path++)
+            for (int pattern = 0; pattern < DISKBENCH_PATTERN_COUNT; pattern++)
+                g_Results[i][path][pattern] = havePath[path] ? diskbench_Measure(&probe, path, pattern, g_Sizes[i], totalSectors, ticksPerMs) : 0;
+
+    diskbench_PrintTable(havePath);
+
+    // two sectors from the last one of the first track (next head), and of the first cylinder
+    bool crossesHeads = false, crossesCylinders = false;
+    if (havePath[DISKBENCH_PATH_CHS])
+    {
+        crossesHeads = diskbench_Read(&probe, DISKBENCH_PATH_CHS, disk->sectors - 1, 2);
+        crossesCylinders = diskbench_Read(&probe, DISKBENCH_PATH_CHS, (uint32_t)disk->sectors * disk->heads - 1, 2);
+        printf("DISKBENCH: CHS reads across heads %s, across cylinders %s\r\n",
+               crossesHeads ? "work" : "fail", crossesCylinders ? "work" : "fail");
+    }
+
+    // the policy is about BIOS reads, which are only a fallback for native disks
+    if (!havePath[DISKBENCH_PATH_CHS])
+        return true;
+
+    uint32_t chsMax, chsPreferred, lbaMax, lbaPreferred;
+    uint32_t chsBest = diskbench_Evaluate(DISKBENCH_PATH_CHS, &chsMax, &chsPreferred);
+    uint32_t lbaBest = havePath[DISKBENCH_PATH_LBA] ? diskbench_Evaluate(DISKBENCH_PATH_LBA, &lbaMax, &lbaPreferred) : 0;
+
+    policyOut->UseLba = lbaBest > 0 && lbaBest >= chsBest;
+    policyOut->MaxSectors = policyOut->UseLba ? lbaMax : chsMax;
+    policyOut->PreferredSectors = policyOut->UseLba ? lbaPreferred : chsPreferred;
+    policyOut->CrossesTracks = crossesHeads && crossesCylinders;
+
+    printf("DISKBENCH: use %s reads of %lu sectors (up to %lu work)%s\r\n",
+           policyOut->UseLba ? "LBA" : "CHS", policyOut->PreferredSectors, policyOut->MaxSectors,
+           policyOut->UseLba || policyOut->CrossesTracks ? "" : ", split at track boundaries");
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+
+typedef struct
+{
+    bool UseLba;                // INT 13h extensions beat (or replace) CHS reads
+    uint32_t MaxSectors;        // largest transfer that never failed
+    uint32_t PreferredSectors;  // smallest transfer within 10% of the best throughput
+    bool CrossesTracks;         // CHS reads may span heads and cylinders
+} diskbench_Policy;
+
+// Times reads of different sizes, alignments and patterns with the TSC, through
+// CHS and the INT 13h extensions on BIOS disks and through the native backend on
+// the others, prints a table in KiB/s and the transfer policy it recommends.
+// Reads only; on floppies only up to a track at a time. Returns false without a TSC.
+bool diskbench_Run(DISK* disk, diskbench_Policy* policyOut);
@@ -8,10 +8,19 @@
 #include "minmax.h"
 
 #define SECTOR_SIZE 512
-#define MAX_PATH_SIZE 256
-#define MAX_FILE_HANDLES 10
 #define ROOT_DIRECTORY_HANDLE -1
 
+// handle buffers hold this many clusters (a power of two), or less if the pool wouldn't fit
+#define FAT_BUFFER_CLUSTERS 1
+#define FAT_MIN_HANDLES 2
+#define FAT_MAX_HANDLES 16
+
+#define FAT_LFN_LAST_ENTRY 0x40
+#define FAT_LFN_ORDER_MASK 0x1F
+#define FAT_LFN_MAX_ORDER 20
+#define FAT_LFN_CHARS_PER_ENTRY 13
+#define FAT_DELETED_ENTRY 0xE5
+
 typedef struct
 {
     uint8_t BootJumpInstruction[3];
@@ -40,12 +49,14 @@ typedef struct
 
 typedef struct
 {
-    uint8_t Buffer[SECTOR_SIZE];
+    uint8_t* Buffer;    // one window of g_BufferSectors sectors: part of a cluster, or whole clusters
     fat_File Public;
     bool Opened;
     uint32_t FirstCluster;
-    uint32_t CurrentCluster;
+    uint32_t CurrentCluster;            // where the window starts, in sectors for the root directory
     uint32_t CurrentSectorInCluster;
+    bool BufferStale;   // the buffer doesn't hold the window yet, it is filled on first use
+    int NextFree;
 } fat_FileData;
 
 typedef struct
@@ -57,7 +68,6 @@ typedef struct
     } BS;
 
     fat_FileData RootDirectory;
-    fat_FileData OpenedFiles[MAX_FILE_HANDLES];
 } fat_Data;
 
 static fat_Data* g_Data;
@@ -65,6 +75,17 @@ static fat_Data* g_Data;
 static uint8_t* g_Fat = NULL;
 static uint32_t g_DataSectionLba;
 
+// handle pool, carved out of the FAT memory behind the FAT itself
+static fat_FileData* g_Handles;
+static int g_HandleCount;
+static int g_FreeHandle;
+static uint32_t g_BufferSectors;
+static uint32_t g_BufferSize;
+
+// every path fat_Open resolved, for the kernel
+static BootFsFile g_Resolved[BOOT_MAX_FS_FILES];
+static uint32_t g_ResolvedCount;
+
 bool fat_readBootSector(DISK* disk)
 {
     return disk_ReadSectors(disk, 0, 1, g_Data->BS.BootSectorBytes);
@@ -75,6 +96,48 @@ bool fat_ReadFat(DISK* disk)
     return disk_ReadSectors(disk, g_Data->BS.BootSector.ReservedSectors, g_Data->BS.BootSector.SectorsPerFat, g_Fat);
 }
 
+// Picks the largest buffer size that still leaves room for FAT_MIN_HANDLES handles
+// plus the root directory, then as many handles as fit, up to FAT_MAX_HANDLES
+static bool fat_CreatePool(uint8_t* start)
+{
+    uint8_t* limit = (uint8_t*)MEMORY_FAT_ADDR + MEMORY_FAT_SIZE;
+    uint32_t available = limit - start;
+
+    for (g_BufferSectors = g_Data->BS.BootSector.SectorsPerCluster * FAT_BUFFER_CLUSTERS; g_BufferSectors > 0; g_BufferSectors /= 2)
+    {
+        g_BufferSize = g_BufferSectors * SECTOR_SIZE;
+
+        // the root directory's buffer and aligning the buffers to a sector come first
+        if (available < g_BufferSize + SECTOR_SIZE)
+            continue;
+
+        g_HandleCount = min((available - g_BufferSize - SECTOR_SIZE) / (sizeof(fat_FileData) + g_BufferSize), FAT_MAX_HANDLES);
+        if (g_HandleCount >= FAT_MIN_HANDLES)
+            break;
+    }
+
+    if (g_BufferSectors == 0)
+        return false;
+
+    g_Handles = (fat_FileData*)start;
+    uint8_t* buffers = (uint8_t*)(((uintptr_t)(g_Handles + g_HandleCount) + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1));
+
+    g_Data->RootDirectory.Buffer = buffers;
+    g_FreeHandle = -1;
+    for (int i = g_HandleCount - 1; i >= 0; i--)
+    {
+        g_Handles[i].Buffer = buffers + (i + 1) * g_BufferSize;
+        g_Handles[i].Opened = false;
+        g_Handles[i].BufferStale = true;
+        g_Handles[i].NextFree = g_FreeHandle;
+        g_FreeHandle = i;
+    }
+
+    return true;
+}
+
+static bool fat_ReloadIfStale(DISK* disk, fat_FileData* fd);
+
 bool fat_Initialize(DISK* disk)
 {
     g_Data = (fat_Data*)MEMORY_FAT_ADDR;
@@ -85,6 +148,7 @@ bool fat_Initialize(DISK* disk)
         return false;
     }
 
+    g_ResolvedCount = 0;
     g_Fat = (uint8_t*)g_Data + sizeof(fat_Data);
     uint32_t fatSize = g_Data->BS.BootSector.BytesPerSector * g_Data->BS.BootSector.SectorsPerFat;
     if (sizeof(fat_Data) + fatSize >= MEMORY_FAT_SIZE)
@@ -98,30 +162,34 @@ bool fat_Initialize(DISK* disk)
         printf("FAT: read fat failed\r\n");
         return false;
     }
+
+    if (!fat_CreatePool(g_Fat + fatSize))
+    {
+        printf("FAT: not enough memory for %d file handles\r\n", FAT_MIN_HANDLES);
+        return false;
+    }
+
     uint32_t rootDirLba = g_Data->BS.BootSector.ReservedSectors + g_Data->BS.BootSector.SectorsPerFat * g_Data->BS.BootSector.FatCount;
     uint32_t rootDirSize = sizeof(fat_DirectoryEntry) * g_Data->BS.BootSector.DirEntryCount;
+    uint32_t rootDirSectors = (rootDirSize + g_Data->BS.BootSector.BytesPerSector - 1) / g_Data->BS.BootSector.BytesPerSector;
+    g_DataSectionLba = rootDirLba + rootDirSectors;
 
     g_Data->RootDirectory.Public.Handle = ROOT_DIRECTORY_HANDLE;
     g_Data->RootDirectory.Public.isDirectory = true;
     g_Data->RootDirectory.Public.Position = 0;
-    g_Data->RootDirectory.Public.Size = sizeof(fat_DirectoryEntry) * g_Data->BS.BootSector.DirEntryCount;
+    g_Data->RootDirectory.Public.Size = rootDirSize;
     g_Data->RootDirectory.Opened = true;
     g_Data->RootDirectory.FirstCluster = rootDirLba;
     g_Data->RootDirectory.CurrentCluster = rootDirLba;
     g_Data->RootDirectory.CurrentSectorInCluster = 0;
+    g_Data->RootDirectory.BufferStale = true;
 
-    if (!disk_ReadSectors(disk, rootDirLba, 1, g_Data->RootDirectory.Buffer))
+    if (!fat_ReloadIfStale(disk, &g_Data->RootDirectory))
     {
         printf("FAT: failed to read root directory");
         return false;
     }
 
-    uint32_t rootDirSectors = (rootDirSize + g_Data->BS.BootSector.BytesPerSector - 1) / g_Data->BS.BootSector.BytesPerSector;
-    g_DataSectionLba = rootDirLba + rootDirSectors;
-
-    for (int i = 0; i < MAX_FILE_HANDLES; i++)
-        g_Data->OpenedFiles[i].Opened = false;
-
     return true;
 }
 
@@ -130,22 +198,18 @@ uint32_t fat_ClusterToLba(uint32_t cluster)
     return g_DataSectionLba + (cluster - 2) * g_Data->BS.BootSector.SectorsPerCluster;
 }
 
-fat_File* fat_OpenEntry(DISK* disk, fat_DirectoryEntry* entry)
+fat_File* fat_OpenEntry(fat_DirectoryEntry* entry)
 {
-    int handle = -1;
-    for (int i = 0; i < MAX_FILE_HANDLES && handle < 0; i++)
-    {
-        if (!g_Data->OpenedFiles[i].Opened)
-            handle = i;
-    }
-
-    if (handle < 0)
+    if (g_FreeHandle < 0)
     {
         printf("FAT: out of handles\r\n");
-        return false;
+        return NULL;
     }
 
-    fat_FileData* fd = &g_Data->OpenedFiles[handle];
+    int handle = g_FreeHandle;
+    fat_FileData* fd = &g_Handles[handle];
+    g_FreeHandle = fd->NextFree;
+
     fd->Public.Handle = handle;
     fd->Public.isDirectory = (entry->Attributes & FAT_ATTRIBUTE_DIRECTORY) != 0;
     fd->Public.Position = 0;
@@ -153,12 +217,9 @@ fat_File* fat_OpenEntry(DISK* disk, fat_DirectoryEntry* entry)
     fd->FirstCluster = entry->FirstClusterLow + ((uint32_t)entry->FirstClusterHigh << 16);
     fd->CurrentCluster = fd->FirstCluster;
     fd->CurrentSectorInCluster = 0;
-
-    if (!disk_ReadSectors(disk, fat_ClusterToLba(fd->CurrentCluster), 1, fd->Buffer))
-    {
-        printf("FAT: read error\r\n");
-        return false;
-    }
+    // the first window is only read once somebody actually reads from the file,
+    // so opening a file just to look at its size or extents costs no I/O
+    fd->BufferStale = true;
 
     fd->Opened = true;
     return &fd->Public;
@@ -178,9 +239,103 @@ uint32_t fat_NextCluster(uint32_t currentCluster)
     }
 }
 
+static fat_FileData* fat_FileDataOf(fat_File* file)
+{
+    return (file->Handle == ROOT_DIRECTORY_HANDLE) ? &g_Data->RootDirectory : &g_Handles[file->Handle];
+}
+
+// Reads the handle's current window to destination, merging adjacent clusters into one vectored transfer
+static bool fat_ReadWindow(DISK* disk, fat_FileData* fd, void* destination)
+{
+    uint32_t sectorsPerCluster = g_Data->BS.BootSector.SectorsPerCluster;
+    disk_Segment segments[FAT_BUFFER_CLUSTERS];
+    int count = 1;
+
+    if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
+    {
+        segments[0] = (disk_Segment){ fd->CurrentCluster, min(g_BufferSectors, g_DataSectionLba - fd->CurrentCluster), destination, 0 };
+    }
+    else if (g_BufferSectors <= sectorsPerCluster)
+    {
+        segments[0] = (disk_Segment){ fat_ClusterToLba(fd->CurrentCluster) + fd->CurrentSectorInCluster, g_BufferSectors, destination, 0 };
+    }
+    else
+    {
+        uint8_t* u8Destination = (uint8_t*)destination;
+        uint32_t cluster = fd->CurrentCluster;
+
+        count = 0;
+        for (uint32_t i = 0; i < g_BufferSectors / sectorsPerCluster && cluster >= 2 && cluster < 0xFF8; i++)
+        {
+            uint32_t lba = fat_ClusterToLba(cluster);
+            if (count > 0 && segments[count - 1].Lba + segments[count - 1].Count == lba)
+                segments[count - 1].Count += sectorsPerCluster;
+            else
+                segments[count++] = (disk_Segment){ lba, sectorsPerCluster, u8Destination, 0 };
+
+            u8Destination += sectorsPerCluster * SECTOR_SIZE;
+            cluster = fat_NextCluster(cluster);
+        }
+    }
+
+    return disk_ReadVectored(disk, segments, count);
+}
+
+static bool fat_ReloadIfStale(DISK* disk, fat_FileData* fd)
+{
+    if (!fd->BufferStale)
+        return true;
+
+    if (!fat_ReadWindow(disk, fd, fd->Buffer))
+    {
+        printf("FAT read oopsies!\r\n");
+        return false;
+    }
+
+    fd->BufferStale = false;
+    return true;
+}
+
+// Moves the handle to the window following the current one, its buffer is
+// filled when it is used. Returns false at the end of the cluster chain.
+static bool fat_NextWindow(fat_FileData* fd)
+{
+    uint32_t sectorsPerCluster = g_Data->BS.BootSector.SectorsPerCluster;
+
+    fd->BufferStale = true;
+    if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
+    {
+        fd->CurrentCluster += g_BufferSectors;
+        return true;
+    }
+
+    if (g_BufferSectors < sectorsPerCluster)
+    {
+        fd->CurrentSectorInCluster += g_BufferSectors;
+        if (fd->CurrentSectorInCluster < sectorsPerCluster)
+            return true;
+
+        fd->CurrentSectorInCluster = 0;
+        fd->CurrentCluster = fat_NextCluster(fd->CurrentCluster);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < g_BufferSectors / sectorsPerCluster && fd->CurrentCluster < 0xFF8; i++)
+            fd->CurrentCluster = fat_NextCluster(fd->CurrentCluster);
+    }
+
+    if (fd->CurrentCluster >= 0xFF8)
+    {
+        fd->Public.Size = fd->Public.Position;
+        return false;
+    }
+
+    return true;
+}
+
 uint32_t fat_Read(DISK* disk, fat_File* file, uint32_t byteCount, void* dataOut)
 {
-    fat_FileData* fd = (file->Handle == ROOT_DIRECTORY_HANDLE) ? &g_Data->RootDirectory : &g_Data->OpenedFiles[file->Handle];
+    fat_FileData* fd = fat_FileDataOf(file);
 
     uint8_t* u8DataOut = (uint8_t*)dataOut;
 
@@ -189,50 +344,76 @@ uint32_t fat_Read(DISK* disk, fat_File* file, uint32_t byteCount, void* dataOut)
 
     while (byteCount > 0)
     {
-        uint32_t leftInBuffer = SECTOR_SIZE - (fd->Public.Position % SECTOR_SIZE);
-        uint32_t take = min(byteCount, leftInBuffer);
+        uint32_t offset = fd->Public.Position % g_BufferSize;
+        uint32_t take;
+
+        // whole windows the caller wants go straight to its buffer, if DMA can write there
+        if (offset == 0 && byteCount >= g_BufferSize && fd->BufferStale && !fd->Public.isDirectory
+            && ((uint32_t)u8DataOut & 1) == 0)
+        {
+            if (!fat_ReadWindow(disk, fd, u8DataOut))
+            {
+                printf("FAT read oopsies!\r\n");
+                break;
+            }
+
+            take = g_BufferSize;
+        }
+        else
+        {
+            if (!fat_ReloadIfStale(disk, fd))
+                break;
+
+            take = min(byteCount, g_BufferSize - offset);
+            memcpy(u8DataOut, fd->Buffer + offset, take);
+        }
 
-        memcpy(u8DataOut, fd->Buffer + fd->Public.Position % SECTOR_SIZE, take);
         u8DataOut += take;
         fd->Public.Position += take;
         byteCount -= take;
 
-        if (leftInBuffer == take)
+        if (offset + take == g_BufferSize && !fat_NextWindow(fd))
+            break;
+    }
+
+    return u8DataOut - (uint8_t*)dataOut;
+}
+
+int fat_GetExtents(fat_File* file, fat_Extent* extentsOut, int maxExtents)
+{
+    if (file->Handle == ROOT_DIRECTORY_HANDLE)
+        return -1;
+
+    fat_FileData* fd = &g_Handles[file->Handle];
+    uint32_t sectorsPerCluster = g_Data->BS.BootSector.SectorsPerCluster;
+    uint32_t sectorsLeft = (fd->Public.Size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t cluster = fd->FirstCluster;
+    int count = 0;
+
+    while (sectorsLeft > 0 && cluster >= 2 && cluster < 0xFF8)
+    {
+        uint32_t lba = fat_ClusterToLba(cluster);
+        uint32_t take = min(sectorsLeft, sectorsPerCluster);
+
+        if (count > 0 && extentsOut[count - 1].Lba + extentsOut[count - 1].Sectors == lba)
         {
-            if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
-            {
-                ++fd->CurrentCluster;
+            extentsOut[count - 1].Sectors += take;
+        }
+        else
+        {
+            if (count == maxExtents)
+                return -1;
 
-                if (!disk_ReadSectors(disk, fd->CurrentCluster, 1, fd->Buffer))
-                {
-                    printf("FAT read oopsies!\r\n");
-                    break;
-                }
-            }
-            else
-            {
-                if (++fd->CurrentSectorInCluster >= g_Data->BS.BootSector.SectorsPerCluster)
-                {
-                    fd->CurrentSectorInCluster = 0;
-                    fd->CurrentCluster = fat_NextCluster(fd->CurrentCluster);
-                }
-
-                if (fd->CurrentCluster >= 0xFF8)
-                {
-                    fd->Public.Size = fd->Public.Position;
-                    break;
-                }
-
-                if (!disk_ReadSectors(disk, fat_ClusterToLba(fd->CurrentCluster) + fd->CurrentSectorInCluster, 1, fd->Buffer))
-                {
-                    printf("Fat read oopsies! =(\r\n");
-                    break;
-                }
-            }
+            extentsOut[count].Lba = lba;
+            extentsOut[count].Sectors = take;
+            count++;
         }
+
+        sectorsLeft -= take;
+        cluster = fat_NextCluster(cluster);
     }
 
-    return u8DataOut - (uint8_t*)dataOut;
+    return sectorsLeft == 0 ? count : -1;
 }
 
 bool fat_ReadEntry(DISK* disk, fat_File* file, fat_DirectoryEntry* dirEntry)
@@ -245,18 +426,191 @@ void fat_Close(fat_File* file)
     if (file->Handle == ROOT_DIRECTORY_HANDLE)
     {
         file->Position = 0;
+        if (g_Data->RootDirectory.CurrentCluster != g_Data->RootDirectory.FirstCluster)
+            g_Data->RootDirectory.BufferStale = true;
         g_Data->RootDirectory.CurrentCluster = g_Data->RootDirectory.FirstCluster;
     } 
-    else 
+    else if (g_Handles[file->Handle].Opened)
+    {
+        g_Handles[file->Handle].Opened = false;
+        g_Handles[file->Handle].NextFree = g_FreeHandle;
+        g_FreeHandle = file->Handle;
+    }
+}
+
+static uint8_t fat_LFNChecksum(const uint8_t* shortName)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++)
+        sum = ((sum & 1) << 7) + (sum >> 1) + shortName[i];
+
+    return sum;
+}
+
+static void fat_LFNReset(fat_LFNState* lfn)
+{
+    lfn->Length = 0;
+    lfn->NextOrder = 0;
+    lfn->Skip = false;
+}
+
+static uint16_t fat_LFNChar(const fat_LFNEntry* entry, int i)
+{
+    if (i < 5)
+        return entry->Name1[i];
+    if (i < 11)
+        return entry->Name2[i - 5];
+    return entry->Name3[i - 11];
+}
+
+// LFN entries are stored last part first, so the first one we see tells us the
+// full length. If it doesn't match wantLength the chain is marked Skip and its
+// other entries never get here, see fat_ReadDirFiltered.
+static void fat_LFNFeed(fat_LFNState* lfn, const fat_DirectoryEntry* dirEntry, int wantLength)
+{
+    const fat_LFNEntry* entry = (const fat_LFNEntry*)dirEntry;
+    uint8_t order = entry->Order & FAT_LFN_ORDER_MASK;
+
+    if (entry->Order == FAT_DELETED_ENTRY || order == 0 || order > FAT_LFN_MAX_ORDER)
+    {
+        fat_LFNReset(lfn);
+        return;
+    }
+
+    if (entry->Order & FAT_LFN_LAST_ENTRY)
+    {
+        int count = 0;
+        while (count < FAT_LFN_CHARS_PER_ENTRY && fat_LFNChar(entry, count) != 0x0000)
+            count++;
+
+        lfn->Length = (order - 1) * FAT_LFN_CHARS_PER_ENTRY + count;
+        lfn->Checksum = entry->Checksum;
+        if (lfn->Length > FAT_LFN_MAX_LENGTH)
+        {
+            fat_LFNReset(lfn);
+            return;
+        }
+
+        lfn->Skip = wantLength >= 0 && lfn->Length != wantLength;
+        if (lfn->Skip)
+        {
+            lfn->NextOrder = order - 1;
+            return;
+        }
+
+        lfn->Name[lfn->Length] = '\0';
+    }
+    else if (order != lfn->NextOrder || entry->Checksum != lfn->Checksum)
+    {
+        fat_LFNReset(lfn);
+        return;
+    }
+
+    uint32_t pos = (order - 1) * FAT_LFN_CHARS_PER_ENTRY;
+    for (int i = 0; i < FAT_LFN_CHARS_PER_ENTRY && pos < lfn->Length; i++, pos++)
+    {
+        uint16_t c = fat_LFNChar(entry, i);
+        lfn->Name[pos] = c < 0x80 ? (char)c : '?';
+    }
+
+    lfn->NextOrder = order - 1;
+}
+
+static bool fat_LFNComplete(const fat_LFNState* lfn, const fat_DirectoryEntry* shortEntry)
+{
+    return lfn->Length != 0 && lfn->NextOrder == 0 && fat_LFNChecksum(shortEntry->Name) == lfn->Checksum;
+}
+
+bool fat_OpenDir(DISK* disk, fat_File* file, fat_Dir* dirOut)
+{
+    if (!file->isDirectory)
+        return false;
+
+    dirOut->File = file;
+    dirOut->Pending = false;
+    dirOut->End = false;
+    fat_LFNReset(&dirOut->LFN);
+
+    return fat_ReloadIfStale(disk, fat_FileDataOf(file));
+}
+
+// Walks the handle's buffer in place. LFN entries are folded into dir->LFN,
+// deleted entries and volume labels are skipped and the 0x00 end marker stops the walk.
+static const fat_DirectoryEntry* fat_ReadDirFiltered(DISK* disk, fat_Dir* dir, int wantLength)
+{
+    fat_FileData* fd = fat_FileDataOf(dir->File);
+
+    fat_LFNReset(&dir->LFN);
+    while (!dir->End)
+    {
+        if (dir->Pending)
+        {
+            dir->Pending = false;
+            fd->Public.Position += sizeof(fat_DirectoryEntry);
+            if (fd->Public.Position % g_BufferSize == 0 && !fat_NextWindow(fd))
+                break;
+        }
+
+        if (fd->Public.Size != 0 && fd->Public.Position >= fd->Public.Size)
+            break;
+
+        if (!fat_ReloadIfStale(disk, fd))
+            break;
+
+        const fat_DirectoryEntry* entry = (const fat_DirectoryEntry*)(fd->Buffer + fd->Public.Position % g_BufferSize);
+        dir->Pending = true;
+
+        if (entry->Name[0] == 0x00)
+            break;
+
+        if (entry->Attributes == FAT_ATTRIBUTE_LFN)
+        {
+            // the rest of a chain the length prefilter rejected only has to carry its checksum
+            const fat_LFNEntry* lfnEntry = (const fat_LFNEntry*)entry;
+            if (dir->LFN.Skip && dir->LFN.NextOrder != 0 && lfnEntry->Checksum == dir->LFN.Checksum
+                && !(lfnEntry->Order & FAT_LFN_LAST_ENTRY))
+                dir->LFN.NextOrder--;
+            else
+                fat_LFNFeed(&dir->LFN, entry, wantLength);
+            continue;
+        }
+
+        if (entry->Name[0] == FAT_DELETED_ENTRY || (entry->Attributes & FAT_ATTRIBUTE_VOLUME_ID))
+        {
+            fat_LFNReset(&dir->LFN);
+            continue;
+        }
+
+        if (dir->LFN.Skip || !fat_LFNComplete(&dir->LFN, entry))
+            fat_LFNReset(&dir->LFN);
+
+        return entry;
+    }
+
+    dir->End = true;
+    fat_LFNReset(&dir->LFN);
+    return NULL;
+}
+
+const fat_DirectoryEntry* fat_ReadDir(DISK* disk, fat_Dir* dir)
+{
+    return fat_ReadDirFiltered(disk, dir, -1);
+}
+
+static bool fat_NameEqualsNoCase(const char* a, const char* b)
+{
+    while (*a && toupper(*a) == toupper(*b))
     {
-        g_Data->OpenedFiles[file->Handle].Opened = false;
+        a++;
+        b++;
     }
+
+    return *a == *b;
 }
 
 bool fat_findFile(DISK* disk, fat_File* file, const char* name, fat_DirectoryEntry* entryOut)
 {
     char fatName[12];
-    fat_DirectoryEntry entry;
 
     memset(fatName, ' ', sizeof(fatName));
     fatName[11] = '\0';
@@ -274,11 +628,29 @@ bool fat_findFile(DISK* disk, fat_File* file, const char* name, fat_DirectoryEnt
             fatName[i + 8] = toupper(ext[i + 1]);
     }
 
-    while (fat_ReadEntry(disk, file, &entry))
+    // names that don't fit in 8.3 can only be found through their long name
+    unsigned nameLength = strlen(name);
+    unsigned baseLength = (ext != name + 11) ? (unsigned)(ext - name) : nameLength;
+    bool isShortName = baseLength <= 8 && nameLength - baseLength <= 4;
+    char firstChar = toupper(name[0]);
+
+    fat_Dir dir;
+    if (!fat_OpenDir(disk, file, &dir))
+        return false;
+
+    const fat_DirectoryEntry* entry;
+    while ((entry = fat_ReadDirFiltered(disk, &dir, nameLength)) != NULL)
     {
-        if (memcmp(fatName, entry.Name, 11) == 0)
+        bool found = false;
+        if (dir.LFN.Length != 0 && !dir.LFN.Skip)
+            found = toupper(dir.LFN.Name[0]) == firstChar && fat_NameEqualsNoCase(dir.LFN.Name, name);
+
+        if (!found && isShortName)
+            found = memcmp(fatName, entry->Name, 11) == 0;
+
+        if (found)
         {
-            *entryOut = entry;
+            *entryOut = *entry;
             return true;
         }
     }
@@ -286,6 +658,32 @@ bool fat_findFile(DISK* disk, fat_File* file, const char* name, fat_DirectoryEnt
     return false;
 }
 
+static void fat_Remember(const char* path, uint32_t length, const fat_DirectoryEntry* entry)
+{
+    if (length + 2 > BOOT_FS_PATH_SIZE)
+        return;
+
+    BootFsFile* file = NULL;
+    for (uint32_t i = 0; i < g_ResolvedCount && file == NULL; i++)
+        if (strlen(g_Resolved[i].Path) == length + 1 && memcmp(g_Resolved[i].Path + 1, path, length) == 0)
+            file = &g_Resolved[i];
+
+    if (file == NULL)
+    {
+        if (g_ResolvedCount == BOOT_MAX_FS_FILES)
+            return;
+
+        file = &g_Resolved[g_ResolvedCount++];
+        file->Path[0] = '/';
+        memcpy(file->Path + 1, path, length);
+        file->Path[length + 1] = '\0';
+    }
+
+    file->FirstCluster = entry->FirstClusterLow + ((uint32_t)entry->FirstClusterHigh << 16);
+    file->Size = entry->Size;
+    file->Attributes = entry->Attributes;
+}
+
 fat_File* fat_Open(DISK* disk, const char* path)
 {
     char name[MAX_PATH_SIZE];
@@ -293,6 +691,8 @@ fat_File* fat_Open(DISK* disk, const char* path)
     if (path[0] == '/')
         path++;
 
+    const char* fullPath = path;
+
     fat_File* current = &g_Data->RootDirectory.Public;
 
     while (*path) {
@@ -301,14 +701,14 @@ fat_File* fat_Open(DISK* disk, const char* path)
         if (delim != NULL)
         {
             memcpy(name, path, delim - path);
-            name[delim - path + 1] = '\0';
+            name[delim - path] = '\0';
             path = delim + 1;
         }
         else
         {
             unsigned len = strlen(path);
             memcpy(name, path, len);
-            name[len + 1] = '\0';
+            name[len] = '\0';
             path += len;
             isLast = true;
         }
@@ -317,13 +717,14 @@ fat_File* fat_Open(DISK* disk, const char* path)
         if (fat_findFile(disk, current, name, &entry))
         {
             fat_Close(current);
+            fat_Remember(fullPath, (isLast ? path : path - 1) - fullPath, &entry);
 
             if (!isLast && entry.Attributes & FAT_ATTRIBUTE_DIRECTORY == 0)
             {
                 printf("FAT: %s not a directory\r\n", name);
                 return NULL;
             }
-            current = fat_OpenEntry(disk, &entry);
+            current = fat_OpenEntry(&entry);
         }
         else
         {
@@ -335,3 +736,80 @@ fat_File* fat_Open(DISK* disk, const char* path)
 
     return current;
 }
+
+static void fat_AddRun(BootFilesystem* fs, uint32_t lba, uint32_t sectors, const uint8_t* address)
+{
+    if (fs->RunCount == BOOT_MAX_FS_RUNS)
+        return;
+
+    BootFsRun* run = &fs->Runs[fs->RunCount++];
+    run->Lba = lba;
+    run->Sectors = sectors;
+    run->Address = (uint32_t)address;
+}
+
+// Adds the sectors in the handle's buffer, one run per cluster if the window spans several
+static void fat_DescribeBuffer(BootFilesystem* fs, const fat_FileData* fd)
+{
+    uint32_t sectorsPerCluster = g_Data->BS.BootSector.SectorsPerCluster;
+
+    if (fd->BufferStale)
+        return;
+
+    if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
+    {
+        fat_AddRun(fs, fd->CurrentCluster, min(g_BufferSectors, g_DataSectionLba - fd->CurrentCluster), fd->Buffer);
+    }
+    else if (g_BufferSectors <= sectorsPerCluster)
+    {
+        fat_AddRun(fs, fat_ClusterToLba(fd->CurrentCluster) + fd->CurrentSectorInCluster, g_BufferSectors, fd->Buffer);
+    }
+    else
+    {
+        uint32_t cluster = fd->CurrentCluster;
+        for (uint32_t i = 0; i < g_BufferSectors / sectorsPerCluster && cluster >= 2 && cluster < 0xFF8; i++)
+        {
+            fat_AddRun(fs, fat_ClusterToLba(cluster), sectorsPerCluster, fd->Buffer + i * sectorsPerCluster * SECTOR_SIZE);
+            cluster = fat_NextCluster(cluster);
+        }
+    }
+}
+
+void fat_DescribeBootSector(BootFilesystem* fs, const void* bootSector)
+{
+    const fat_BootSector* bs = (const fat_BootSector*)bootSector;
+
+    fs->FatType = 12;
+    fs->BytesPerSector = bs->BytesPerSector;
+    fs->SectorsPerCluster = bs->SectorsPerCluster;
+    fs->ReservedSectors = bs->ReservedSectors;
+    fs->FatCount = bs->FatCount;
+    fs->RootEntryCount = bs->DirEntryCount;
+    fs->SectorsPerFat = bs->SectorsPerFat;
+    fs->TotalSectors = bs->TotalSectors != 0 ? bs->TotalSectors : bs->LargeSectorCount;
+    fs->VolumeId = bs->VolumeId;
+
+    fs->FatLba = bs->ReservedSectors;
+    fs->RootDirectoryLba = bs->ReservedSectors + bs->SectorsPerFat * bs->FatCount;
+    fs->DataLba = fs->RootDirectoryLba + (sizeof(fat_DirectoryEntry) * bs->DirEntryCount + bs->BytesPerSector - 1) / bs->BytesPerSector;
+    fs->ClusterCount = (fs->TotalSectors - fs->DataLba) / bs->SectorsPerCluster;
+
+    fs->BootSectorStart = (uint32_t)bootSector;
+}
+
+void fat_Describe(BootFilesystem* fs)
+{
+    fat_DescribeBootSector(fs, g_Data->BS.BootSectorBytes);
+    fs->RegionStart = (uint32_t)MEMORY_FAT_ADDR;
+    fs->RegionSize = MEMORY_FAT_SIZE;
+    fs->FatStart = (uint32_t)g_Fat;
+
+    fs->FileCount = g_ResolvedCount;
+    memcpy(fs->Files, g_Resolved, g_ResolvedCount * sizeof(BootFsFile));
+
+    // closed handles keep their last window too
+    fs->RunCount = 0;
+    fat_DescribeBuffer(fs, &g_Data->RootDirectory);
+    for (int i = 0; i < g_HandleCount; i++)
+        fat_DescribeBuffer(fs, &g_Handles[i]);
+}
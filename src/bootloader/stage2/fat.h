@@ -1,6 +1,9 @@
 #pragma once
 #include "stdint.h"
 #include "disk.h"
+#include <boot/bootparams.h>
+
+#define MAX_PATH_SIZE 256
 
 typedef struct 
 {
@@ -18,6 +21,29 @@ typedef struct
     uint32_t Size;
 } __attribute__((packed)) fat_DirectoryEntry;
 
+#define FAT_LFN_MAX_LENGTH 255
+
+typedef struct
+{
+    uint8_t Order;
+    uint16_t Name1[5];
+    uint8_t Attributes;
+    uint8_t LongEntryType;
+    uint8_t Checksum;
+    uint16_t Name2[6];
+    uint16_t FirstClusterLow;
+    uint16_t Name3[2];
+} __attribute__((packed)) fat_LFNEntry;
+
+typedef struct
+{
+    char Name[FAT_LFN_MAX_LENGTH + 1];
+    uint16_t Length;
+    uint8_t Checksum;
+    uint8_t NextOrder;  // order of the next entry we expect, 0 once the name is done
+    bool Skip;          // rejected by the length prefilter, the rest of the chain is passed over
+} fat_LFNState;
+
 typedef struct {
     int Handle;
     bool isDirectory;
@@ -25,6 +51,20 @@ typedef struct {
     uint32_t Size;
 } fat_File;
 
+typedef struct
+{
+    uint32_t Lba;
+    uint32_t Sectors;
+} fat_Extent;
+
+typedef struct
+{
+    fat_File* File;
+    bool Pending;       // the entry at File->Position was already returned
+    bool End;
+    fat_LFNState LFN;   // long name of the last returned entry, Length is 0 if it has none
+} fat_Dir;
+
 enum fat_atributes {
     FAT_ATTRIBUTE_READ_ONLY = 0x01,
     FAT_ATTRIBUTE_HIDDEN = 0x02,
@@ -39,4 +79,18 @@ bool fat_Initialize(DISK* disk);
 fat_File* fat_Open(DISK* disk, const char* path);
 uint32_t fat_Read(DISK* disk, fat_File* file, uint32_t byteCount, void* dataOut);
 bool fat_ReadEntry(DISK* disk, fat_File* file, fat_DirectoryEntry* dataOut);
+bool fat_OpenDir(DISK* disk, fat_File* file, fat_Dir* dirOut);
+const fat_DirectoryEntry* fat_ReadDir(DISK* disk, fat_Dir* dir);
+
+// Resolves the file's cluster chain into runs of contiguous sectors using only
+// the in-memory FAT. Returns the number of extents, or -1 if they don't fit.
+int fat_GetExtents(fat_File* file, fat_Extent* extentsOut, int maxExtents);
 void fat_Close(fat_File* file); 
+
+// Describes the mounted volume, the paths resolved so far and the sectors still
+// in the handle buffers, so the kernel can adopt them instead of reading them again
+void fat_Describe(BootFilesystem* fs);
+
+// Fills in the BPB and the layout derived from it, for a volume fat_Initialize
+// didn't mount. The caller describes the memory it holds.
+void fat_DescribeBootSector(BootFilesystem* fs, const void* bootSector);
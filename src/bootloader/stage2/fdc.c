@@ -0,0 +1,303 @@
+#include "fdc.h"
+#include "x86.h"
+#include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+
+#define SECTOR_SIZE                 512
+#define FDC_HEADS                   2
+#define FDC_RETRIES                 3
+#define FDC_TIMEOUT                 1000000     // status register polls before giving up
+#define FDC_MOTOR_SPINUP            300000      // microseconds
+
+#define FDC_REG_DOR                 0x3F2
+#define FDC_REG_MSR                 0x3F4
+#define FDC_REG_FIFO                0x3F5
+#define FDC_REG_CCR                 0x3F7
+
+#define FDC_DOR_NOT_RESET           0x04
+#define FDC_DOR_DMA_IRQ             0x08
+#define FDC_DOR_MOTOR(drive)        (0x10 << (drive))
+
+#define FDC_MSR_DIO                 0x40
+#define FDC_MSR_RQM                 0x80
+
+#define FDC_CMD_SPECIFY             0x03
+#define FDC_CMD_READ_DATA           0x06
+#define FDC_CMD_RECALIBRATE         0x07
+#define FDC_CMD_SENSE_INTERRUPT     0x08
+#define FDC_CMD_VERSION             0x10
+#define FDC_CMD_CONFIGURE           0x13
+#define FDC_CMD_MT                  0x80
+#define FDC_CMD_MFM                 0x40
+
+#define FDC_VERSION_82077           0x90
+#define FDC_RATE_500K               0x00        // 1.44 MB media
+#define FDC_SECTOR_SIZE_512         0x02
+#define FDC_GAP3_1440K              0x1B
+
+// ISA DMA controller, channel 2
+#define DMA_REG_MASK                0x0A
+#define DMA_REG_MODE                0x0B
+#define DMA_REG_FLIP_FLOP           0x0C
+#define DMA_REG_ADDRESS_2           0x04
+#define DMA_REG_COUNT_2             0x05
+#define DMA_REG_PAGE_2              0x81
+#define DMA_CHANNEL                 2
+#define DMA_MASK_ON                 0x04
+#define DMA_MODE_WRITE_SINGLE       0x44        // device to memory, single transfer
+
+#define FDC_CYLINDER_BUFFER         ((uint8_t*)MEMORY_FDC_ADDR)
+
+static uint8_t g_Drive;
+static uint16_t g_SectorsPerTrack;
+static bool g_MotorOn;
+static int g_CachedCylinder = -1;
+
+// ~1us per access to the POST diagnostic port
+static void fdc_Delay(uint32_t microseconds)
+{
+    while (microseconds--)
+        x86_outb(0x80, 0);
+}
+
+static bool fdc_WaitReady(uint8_t direction)
+{
+    for (uint32_t i = 0; i < FDC_TIMEOUT; i++)
+    {
+        uint8_t msr = x86_inb(FDC_REG_MSR);
+        if ((msr & (FDC_MSR_RQM | FDC_MSR_DIO)) == (FDC_MSR_RQM | direction))
+            return true;
+    }
+
+    return false;
+}
+
+static bool fdc_Write(uint8_t value)
+{
+    if (!fdc_WaitReady(0))
+        return false;
+
+    x86_outb(FDC_REG_FIFO, value);
+    return true;
+}
+
+static bool fdc_Read(uint8_t* valueOut)
+{
+    if (!fdc_WaitReady(FDC_MSR_DIO))
+        return false;
+
+    *valueOut = x86_inb(FDC_REG_FIFO);
+    return true;
+}
+
+static bool fdc_Command(const uint8_t* bytes, int count)
+{
+    for (int i = 0; i < count; i++)
+        if (!fdc_Write(bytes[i]))
+            return false;
+
+    return true;
+}
+
+static bool fdc_SenseInterrupt(uint8_t* st0Out, uint8_t* cylinderOut)
+{
+    return fdc_Write(FDC_CMD_SENSE_INTERRUPT) && fdc_Read(st0Out) && fdc_Read(cylinderOut);
+}
+
+static uint8_t fdc_DorValue(bool motor)
+{
+    uint8_t dor = g_Drive | FDC_DOR_NOT_RESET | FDC_DOR_DMA_IRQ;
+    if (motor)
+        dor |= FDC_DOR_MOTOR(g_Drive);
+
+    return dor;
+}
+
+static void fdc_SetDor(bool motor)
+{
+    x86_outb(FDC_REG_DOR, fdc_DorValue(motor));
+}
+
+static void fdc_MotorOn()
+{
+    // The BIOS timer interrupt switches the motor off a couple of seconds after
+    // the last INT 13h floppy access, and INT 13h rewrites the DOR, so g_MotorOn
+    // doesn't survive a real mode call. The 82077 DOR reads back.
+    if (g_MotorOn && x86_inb(FDC_REG_DOR) == fdc_DorValue(true))
+        return;
+
+    fdc_SetDor(true);
+    fdc_Delay(FDC_MOTOR_SPINUP);
+    g_MotorOn = true;
+}
+
+static bool fdc_Recalibrate()
+{
+    uint8_t st0, cylinder;
+
+    // 80 cylinders may need more steps than one recalibrate does
+    for (int i = 0; i < 2; i++)
+    {
+        uint8_t command[] = { FDC_CMD_RECALIBRATE, g_Drive };
+        if (!fdc_Command(command, sizeof(command)))
+            return false;
+
+        // seeks have no result phase, wait for the drive to stop stepping instead of IRQ6
+        for (uint32_t j = 0; j < FDC_TIMEOUT && (x86_inb(FDC_REG_MSR) & (1 << g_Drive)); j++)
+            ;
+
+        if (!fdc_SenseInterrupt(&st0, &cylinder))
+            return false;
+
+        if (cylinder == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static bool fdc_Reset()
+{
+    uint8_t st0, cylinder;
+
+    x86_outb(FDC_REG_DOR, 0);
+    fdc_Delay(10);
+    fdc_SetDor(g_MotorOn);
+
+    // with polling mode still on after a reset, each of the four drives reports once
+    for (int i = 0; i < 4; i++)
+        if (!fdc_SenseInterrupt(&st0, &cylinder))
+            return false;
+
+    x86_outb(FDC_REG_CCR, FDC_RATE_500K);
+
+    // implied seeks let READ DATA step to the cylinder itself, so no seek interrupt is needed
+    uint8_t configure[] = { FDC_CMD_CONFIGURE, 0, 0x57, 0 };    // implied seek, FIFO on, polling off, threshold 8
+
+    // step rate 3ms, head unload 240ms, head load 16ms, DMA mode
+    uint8_t specify[] = { FDC_CMD_SPECIFY, 0xDF, 0x02 };
+
+    return fdc_Command(configure, sizeof(configure))
+        && fdc_Command(specify, sizeof(specify))
+        && fdc_Recalibrate();
+}
+
+static void fdc_SetupDma(void* buffer, uint32_t bytes)
+{
+    uint32_t address = (uint32_t)buffer;
+    uint32_t count = bytes - 1;
+
+    x86_outb(DMA_REG_MASK, DMA_MASK_ON | DMA_CHANNEL);
+    x86_outb(DMA_REG_FLIP_FLOP, 0xFF);
+    x86_outb(DMA_REG_MODE, DMA_MODE_WRITE_SINGLE | DMA_CHANNEL);
+    x86_outb(DMA_REG_ADDRESS_2, address & 0xFF);
+    x86_outb(DMA_REG_ADDRESS_2, (address >> 8) & 0xFF);
+    x86_outb(DMA_REG_PAGE_2, (address >> 16) & 0xFF);
+    x86_outb(DMA_REG_FLIP_FLOP, 0xFF);
+    x86_outb(DMA_REG_COUNT_2, count & 0xFF);
+    x86_outb(DMA_REG_COUNT_2, (count >> 8) & 0xFF);
+    x86_outb(DMA_REG_MASK, DMA_CHANNEL);
+}
+
+// Reads both heads of a cylinder with one multi-track command
+static bool fdc_ReadCylinder(int cylinder)
+{
+    uint32_t bytes = g_SectorsPerTrack * FDC_HEADS * SECTOR_SIZE;
+
+    fdc_MotorOn();
+
+    for (int attempt = 0; attempt < FDC_RETRIES; attempt++)
+    {
+        fdc_SetupDma(FDC_CYLINDER_BUFFER, bytes);
+
+        uint8_t command[] = {
+            FDC_CMD_READ_DATA | FDC_CMD_MT | FDC_CMD_MFM,
+            g_Drive,                    // head 0
+            cylinder,
+            0,                          // head
+            1,                          // first sector
+            FDC_SECTOR_SIZE_512,
+            g_SectorsPerTrack,          // last sector of the track, MT continues on head 1
+            FDC_GAP3_1440K,
+            0xFF,                       // data length, unused with 512 byte sectors
+        };
+
+        uint8_t result[7] = { 0 };
+        bool ok = fdc_Command(command, sizeof(command));
+        for (int i = 0; ok && i < (int)sizeof(result); i++)
+            ok = fdc_Read(&result[i]);
+
+        // ST0 interrupt code 00 is normal termination
+        if (ok && (result[0] & 0xC0) == 0)
+        {
+            g_CachedCylinder = cylinder;
+            return true;
+        }
+
+        printf("FDC: read of cylinder %d failed, ST0=%x ST1=%x ST2=%x\r\n", cylinder, result[0], result[1], result[2]);
+        g_CachedCylinder = -1;
+        if (!fdc_Reset())
+            break;
+    }
+
+    return false;
+}
+
+bool fdc_Initialize(uint8_t drive, uint16_t sectorsPerTrack)
+{
+    uint8_t version;
+
+    g_Drive = drive;
+    g_SectorsPerTrack = sectorsPerTrack;
+    g_MotorOn = false;
+    g_CachedCylinder = -1;
+
+    // a cylinder has to fit the DMA buffer without crossing a 64 KiB boundary
+    if (drive > 1 || sectorsPerTrack * FDC_HEADS * SECTOR_SIZE > MEMORY_FDC_SIZE)
+        return false;
+
+    if (!fdc_Write(FDC_CMD_VERSION) || !fdc_Read(&version) || version != FDC_VERSION_82077)
+        return false;
+
+    // the motor bit also selects the drive, recalibrating needs it
+    fdc_MotorOn();
+    if (!fdc_Reset())
+    {
+        printf("FDC: controller reset failed\r\n");
+        fdc_SetDor(false);
+        g_MotorOn = false;
+        return false;
+    }
+
+    return true;
+}
+
+bool fdc_ReadVectored(disk_Segment* segments, int count)
+{
+    uint32_t sectorsPerCylinder = g_SectorsPerTrack * FDC_HEADS;
+
+    for (int i = 0; i < count; i++)
+    {
+        segments[i].Completed = 0;
+
+        while (segments[i].Completed < segments[i].Count)
+        {
+            uint32_t lba = segments[i].Lba + segments[i].Completed;
+            int cylinder = lba / sectorsPerCylinder;
+            uint32_t offset = lba % sectorsPerCylinder;
+
+            if (cylinder != g_CachedCylinder && !fdc_ReadCylinder(cylinder))
+                return false;
+
+            uint32_t take = min(segments[i].Count - segments[i].Completed, sectorsPerCylinder - offset);
+            memcpy((uint8_t*)segments[i].Destination + segments[i].Completed * SECTOR_SIZE,
+                   FDC_CYLINDER_BUFFER + offset * SECTOR_SIZE,
+                   take * SECTOR_SIZE);
+            segments[i].Completed += take;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "disk.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Takes over an 82077 compatible floppy controller for the given drive (0 or 1),
+// which has to hold a 1.44 MB disk
+bool fdc_Initialize(uint8_t drive, uint16_t sectorsPerTrack);
+
+// Reads whole cylinders (both heads in one multi-track command) over ISA DMA channel 2
+// into a low memory buffer and copies the requested sectors out. The last cylinder
+// stays cached and the motor is left running between calls. No interrupts are used,
+// completion is polled on the main status register.
+bool fdc_ReadVectored(disk_Segment* segments, int count);
@@ -0,0 +1,458 @@
+#include "ide.h"
+#include "pci.h"
+#include "x86.h"
+#include "pit.h"
+#include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE                 512
+
+#define IDE_CHANNELS                2
+#define IDE_DRIVES                  (IDE_CHANNELS * 2)
+#define IDE_MAX_PRDS                64
+#define IDE_CHUNK_SECTORS           128         // one command; small enough to overlap, big enough to amortize setup
+#define IDE_LBA28_MAX_SECTORS       256
+#define IDE_DMA_BOUNDARY            0x10000
+#define IDE_BUSY_TIMEOUT_MS         1000
+#define IDE_DMA_TIMEOUT_MS          5000        // one chunk, with room for a spin-up
+
+#define IDE_PCI_CLASS               0x01
+#define IDE_PCI_SUBCLASS            0x01
+#define IDE_PCI_PROG_IF_NATIVE(ch)  (1 << ((ch) * 2))
+#define IDE_PCI_PROG_IF_BUS_MASTER  0x80
+#define IDE_PCI_BAR_BUS_MASTER      (PCI_REG_BAR0 + 4 * 4)
+
+// task file, relative to the channel's command block
+#define ATA_REG_DATA                0
+#define ATA_REG_SECTOR_COUNT        2
+#define ATA_REG_LBA_LOW             3
+#define ATA_REG_LBA_MID             4
+#define ATA_REG_LBA_HIGH            5
+#define ATA_REG_DEVICE              6
+#define ATA_REG_COMMAND             7
+#define ATA_REG_STATUS              7
+
+#define ATA_STATUS_ERR              0x01
+#define ATA_STATUS_DRQ              0x08
+#define ATA_STATUS_DF               0x20
+#define ATA_STATUS_BSY              0x80
+#define ATA_STATUS_FLOATING         0xFF        // nothing drives the bus: no controller or no drives behind it
+
+#define ATA_CONTROL_NIEN            0x02
+#define ATA_DEVICE_LBA              0x40
+#define ATA_DEVICE_SLAVE            0x10
+
+#define ATA_CMD_READ_DMA            0xC8
+#define ATA_CMD_READ_DMA_EXT        0x25
+#define ATA_CMD_IDENTIFY            0xEC
+
+// IDENTIFY DEVICE words
+#define ATA_ID_CAPABILITIES         49
+#define ATA_ID_COMMAND_SETS         83
+#define ATA_ID_DMA                  (1 << 8)
+#define ATA_ID_LBA48                (1 << 10)
+
+// bus-master registers, relative to the channel's block in BAR4
+#define BM_REG_COMMAND              0
+#define BM_REG_STATUS               2
+#define BM_REG_PRDT                 4
+
+#define BM_COMMAND_START            0x01
+#define BM_COMMAND_READ             0x08        // device to memory
+#define BM_STATUS_ACTIVE            0x01
+#define BM_STATUS_ERROR             0x02
+#define BM_STATUS_INTERRUPT         0x04
+
+#define IDE_PRD_END_OF_TABLE        0x8000
+
+typedef struct
+{
+    uint32_t Base;
+    uint16_t ByteCount;         // 0 means 64 KiB
+    uint16_t Flags;
+} __attribute__((packed)) ide_Prd;
+
+typedef struct
+{
+    uint16_t CommandBase;
+    uint16_t ControlBase;
+    uint16_t BusMasterBase;
+} ide_Channel;
+
+typedef struct
+{
+    bool Present;
+    bool Lba48;
+} ide_Disk;
+
+// the sectors a command covers, starting at Done sectors into Segment
+typedef struct
+{
+    int Segment;
+    uint32_t Done;
+    uint32_t Lba;
+    uint32_t Sectors;
+} ide_Request;
+
+// 0x000 - PRD table 0, 0x200 - PRD table 1, 0x400 - scratch sector
+#define IDE_PRD_TABLE(i)            ((ide_Prd*)((uint8_t*)MEMORY_IDE_ADDR + (i) * 0x200))
+#define IDE_SCRATCH                 ((uint8_t*)MEMORY_IDE_ADDR + 0x400)
+
+// the compiler must not move PRD writes past the start of a transfer, or buffer reads before its end
+#define ide_Barrier()               __asm__ volatile("" ::: "memory")
+
+static ide_Channel g_Channels[IDE_CHANNELS];
+static ide_Disk g_Disks[IDE_DRIVES];
+
+static bool ide_WaitNotBusy(const ide_Channel* channel, uint8_t* statusOut)
+{
+    pit_StartTimeout(IDE_BUSY_TIMEOUT_MS);
+    do
+    {
+        uint8_t status = x86_inb(channel->CommandBase + ATA_REG_STATUS);
+        if ((status & ATA_STATUS_BSY) == 0)
+        {
+            *statusOut = status;
+            return true;
+        }
+    } while (!pit_TimedOut());
+
+    return false;
+}
+
+static void ide_Select(const ide_Channel* channel, int drive, uint8_t lbaHigh)
+{
+    x86_outb(channel->CommandBase + ATA_REG_DEVICE, 0xA0 | ATA_DEVICE_LBA | ((drive & 1) ? ATA_DEVICE_SLAVE : 0) | lbaHigh);
+
+    // reading the alternate status four times gives the drive the 400ns it needs after a select
+    for (int i = 0; i < 4; i++)
+        x86_inb(channel->ControlBase);
+}
+
+static bool ide_Identify(int drive)
+{
+    const ide_Channel* channel = &g_Channels[drive / 2];
+    uint16_t* identify = (uint16_t*)IDE_SCRATCH;
+    uint8_t status;
+
+    ide_Select(channel, drive, 0);
+
+    // skip absent drives before sending a command that would have to time out
+    status = x86_inb(channel->CommandBase + ATA_REG_STATUS);
+    if (status == 0 || status == ATA_STATUS_FLOATING)
+        return false;
+
+    x86_outb(channel->ControlBase, ATA_CONTROL_NIEN);
+    x86_outb(channel->CommandBase + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    // no drive at all, or an ATAPI one that aborts IDENTIFY DEVICE
+    if (x86_inb(channel->CommandBase + ATA_REG_STATUS) == 0 || !ide_WaitNotBusy(channel, &status))
+        return false;
+
+    if ((status & (ATA_STATUS_ERR | ATA_STATUS_DRQ)) != ATA_STATUS_DRQ
+        || x86_inb(channel->CommandBase + ATA_REG_LBA_MID) != 0
+        || x86_inb(channel->CommandBase + ATA_REG_LBA_HIGH) != 0)
+        return false;
+
+    for (int i = 0; i < SECTOR_SIZE / 2; i++)
+        identify[i] = x86_inw(channel->CommandBase + ATA_REG_DATA);
+
+    g_Disks[drive].Lba48 = (identify[ATA_ID_COMMAND_SETS] & ATA_ID_LBA48) != 0;
+    return (identify[ATA_ID_CAPABILITIES] & ATA_ID_DMA) != 0;
+}
+
+static void ide_Release(const ide_Channel* channel)
+{
+    x86_outb(channel->BusMasterBase + BM_REG_COMMAND, 0);
+    x86_outb(channel->BusMasterBase + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+
+    // the BIOS may still be needed for this channel
+    x86_outb(channel->ControlBase, 0);
+}
+
+// Fills PRD table from segments[*i], *done sectors in; PRDs may not cross a 64 KiB boundary
+static bool ide_BuildRead(ide_Prd* table, bool lba48, disk_Segment* segments, int count, int* i, uint32_t* done, ide_Request* request)
+{
+    uint32_t maxSectors = lba48 ? IDE_CHUNK_SECTORS : min(IDE_CHUNK_SECTORS, IDE_LBA28_MAX_SECTORS);
+    int prdCount = 0;
+
+    while (*i < count && *done >= segments[*i].Count)
+    {
+        (*i)++;
+        *done = 0;
+    }
+
+    if (*i >= count)
+        return false;
+
+    request->Segment = *i;
+    request->Done = *done;
+    request->Lba = segments[*i].Lba + *done;
+    request->Sectors = 0;
+
+    while (*i < count && request->Sectors < maxSectors)
+    {
+        if (*done >= segments[*i].Count)
+        {
+            (*i)++;
+            *done = 0;
+            continue;
+        }
+
+        if (segments[*i].Lba + *done != request->Lba + request->Sectors)
+            break;
+
+        uint32_t address = (uint32_t)segments[*i].Destination + *done * SECTOR_SIZE;
+        uint32_t toBoundary = IDE_DMA_BOUNDARY - (address & (IDE_DMA_BOUNDARY - 1));
+        uint32_t take = min(segments[*i].Count - *done, maxSectors - request->Sectors);
+        take = min(take, toBoundary / SECTOR_SIZE);
+
+        // a sector straddling a 64 KiB boundary needs two PRDs
+        uint32_t bytes = take > 0 ? take * SECTOR_SIZE : SECTOR_SIZE;
+        int needed = take > 0 ? 1 : 2;
+        if (prdCount + needed > IDE_MAX_PRDS)
+            break;
+
+        if (take > 0)
+        {
+            table[prdCount].Base = address;
+            table[prdCount].ByteCount = bytes & 0xFFFF;
+            table[prdCount].Flags = 0;
+            prdCount++;
+        }
+        else
+        {
+            table[prdCount].Base = address;
+            table[prdCount].ByteCount = toBoundary;
+            table[prdCount].Flags = 0;
+            table[prdCount + 1].Base = address + toBoundary;
+            table[prdCount + 1].ByteCount = SECTOR_SIZE - toBoundary;
+            table[prdCount + 1].Flags = 0;
+            prdCount += 2;
+            take = 1;
+        }
+
+        request->Sectors += take;
+        *done += take;
+    }
+
+    table[prdCount - 1].Flags = IDE_PRD_END_OF_TABLE;
+    return true;
+}
+
+static void ide_Start(const ide_Channel* channel, int drive, bool lba48, const ide_Prd* table, const ide_Request* request)
+{
+    uint16_t bm = channel->BusMasterBase;
+    uint32_t lba = request->Lba;
+
+    x86_outb(bm + BM_REG_COMMAND, 0);
+    x86_outb(bm + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+    x86_outl(bm + BM_REG_PRDT, (uint32_t)table);
+    x86_outb(bm + BM_REG_COMMAND, BM_COMMAND_READ);
+
+    if (lba48)
+    {
+        ide_Select(channel, drive, 0);
+        x86_outb(channel->CommandBase + ATA_REG_SECTOR_COUNT, (request->Sectors >> 8) & 0xFF);
+        x86_outb(channel->CommandBase + ATA_REG_LBA_LOW, (lba >> 24) & 0xFF);
+        x86_outb(channel->CommandBase + ATA_REG_LBA_MID, 0);
+        x86_outb(channel->CommandBase + ATA_REG_LBA_HIGH, 0);
+    }
+    else
+    {
+        ide_Select(channel, drive, (lba >> 24) & 0x0F);
+    }
+
+    // a count of 0 means 256 sectors (65536 with LBA48), which is what the truncation gives
+    x86_outb(channel->CommandBase + ATA_REG_SECTOR_COUNT, request->Sectors & 0xFF);
+    x86_outb(channel->CommandBase + ATA_REG_LBA_LOW, lba & 0xFF);
+    x86_outb(channel->CommandBase + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+    x86_outb(channel->CommandBase + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF);
+
+    ide_Barrier();
+    x86_outb(channel->CommandBase + ATA_REG_COMMAND, lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+    x86_outb(bm + BM_REG_COMMAND, BM_COMMAND_READ | BM_COMMAND_START);
+}
+
+static bool ide_Wait(const ide_Channel* channel)
+{
+    uint16_t bm = channel->BusMasterBase;
+    uint8_t bmStatus = 0, status = 0;
+    bool finished = false;
+
+    pit_StartTimeout(IDE_DMA_TIMEOUT_MS);
+    do
+    {
+        bmStatus = x86_inb(bm + BM_REG_STATUS);
+        finished = (bmStatus & (BM_STATUS_INTERRUPT | BM_STATUS_ERROR)) || !(bmStatus & BM_STATUS_ACTIVE);
+    } while (!finished && !pit_TimedOut());
+
+    x86_outb(bm + BM_REG_COMMAND, 0);
+    x86_outb(bm + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+
+    // reading the status register also acknowledges the drive's interrupt
+    bool ok = finished && !(bmStatus & BM_STATUS_ERROR)
+           && ide_WaitNotBusy(channel, &status)
+           && !(status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+
+    if (!ok)
+        printf("IDE: read failed, status %x bus-master status %x\r\n", status, bmStatus);
+
+    ide_Barrier();
+    return ok;
+}
+
+static void ide_Complete(disk_Segment* segments, const ide_Request* request, disk_ProgressCallback progress, void* context)
+{
+    int i = request->Segment;
+    uint32_t done = request->Done;
+    uint32_t left = request->Sectors;
+
+    while (left > 0)
+    {
+        if (done >= segments[i].Count)
+        {
+            i++;
+            done = 0;
+            continue;
+        }
+
+        uint32_t take = min(segments[i].Count - done, left);
+        if (progress != NULL)
+            progress(context, (uint8_t*)segments[i].Destination + done * SECTOR_SIZE, take);
+
+        segments[i].Completed += take;
+        done += take;
+        left -= take;
+    }
+}
+
+bool ide_Initialize()
+{
+    pci_Address address;
+    uint32_t classReg = 0;
+    bool found = false;
+
+    for (int index = 0; pci_FindSubclass(IDE_PCI_CLASS, IDE_PCI_SUBCLASS, index, &address); index++)
+    {
+        classReg = pci_ConfigRead(address, PCI_REG_CLASS);
+        if ((classReg >> 8) & IDE_PCI_PROG_IF_BUS_MASTER)
+        {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    uint32_t command = pci_ConfigRead(address, PCI_REG_COMMAND) & 0xFFFF;
+    pci_ConfigWrite(address, PCI_REG_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    uint8_t progIf = (classReg >> 8) & 0xFF;
+    uint16_t busMaster = pci_ConfigRead(address, IDE_PCI_BAR_BUS_MASTER) & 0xFFFC;
+    for (int ch = 0; ch < IDE_CHANNELS; ch++)
+    {
+        ide_Channel* channel = &g_Channels[ch];
+
+        // native mode channels have their own BARs, compatibility mode ones sit at the ISA addresses
+        if (progIf & IDE_PCI_PROG_IF_NATIVE(ch))
+        {
+            channel->CommandBase = pci_ConfigRead(address, PCI_REG_BAR0 + ch * 8) & 0xFFFC;
+            channel->ControlBase = (pci_ConfigRead(address, PCI_REG_BAR0 + ch * 8 + 4) & 0xFFFC) + 2;
+        }
+        else
+        {
+            channel->CommandBase = ch == 0 ? 0x1F0 : 0x170;
+            channel->ControlBase = ch == 0 ? 0x3F6 : 0x376;
+        }
+
+        channel->BusMasterBase = busMaster + ch * 8;
+    }
+
+    found = false;
+    for (int drive = 0; drive < IDE_DRIVES; drive++)
+    {
+        g_Disks[drive].Present = ide_Identify(drive);
+        ide_Release(&g_Channels[drive / 2]);
+        found |= g_Disks[drive].Present;
+    }
+
+    return found;
+}
+
+int ide_FindDisk(const void* firstSector)
+{
+    for (int drive = 0; drive < IDE_DRIVES; drive++)
+    {
+        if (!g_Disks[drive].Present)
+            continue;
+
+        disk_Segment segment = { 0, 1, IDE_SCRATCH, 0 };
+        if (ide_ReadVectored(drive, &segment, 1, NULL, NULL) && memcmp(IDE_SCRATCH, firstSector, SECTOR_SIZE) == 0)
+        {
+            printf("IDE: boot disk is drive %d, %s\r\n", drive, g_Disks[drive].Lba48 ? "LBA48" : "LBA28");
+            return drive;
+        }
+    }
+
+    return -1;
+}
+
+bool ide_ReadVectored(int drive, disk_Segment* segments, int count, disk_ProgressCallback progress, void* context)
+{
+    const ide_Channel* channel = &g_Channels[drive / 2];
+    bool lba48 = g_Disks[drive].Lba48;
+    ide_Request requests[2];
+
+    for (int k = 0; k < count; k++)
+    {
+        segments[k].Completed = 0;
+
+        // PRDs need word aligned buffers below 4 GiB, and the end of the disk has to be addressable
+        if ((uint32_t)segments[k].Destination & 1)
+            return false;
+        if (!lba48 && segments[k].Lba + segments[k].Count > (1u << 28))
+            return false;
+    }
+
+    int i = 0;
+    uint32_t done = 0;
+    int current = 0;
+    bool ok = true;
+
+    if (!ide_BuildRead(IDE_PRD_TABLE(current), lba48, segments, count, &i, &done, &requests[current]))
+        return true;
+
+    x86_outb(channel->ControlBase, ATA_CONTROL_NIEN);
+    ide_Start(channel, drive, lba48, IDE_PRD_TABLE(current), &requests[current]);
+
+    for (;;)
+    {
+        // the other table is free, prepare the next command while this one runs
+        int next = current ^ 1;
+        bool more = ide_BuildRead(IDE_PRD_TABLE(next), lba48, segments, count, &i, &done, &requests[next]);
+
+        if (!ide_Wait(channel))
+        {
+            ok = false;
+            break;
+        }
+
+        if (more)
+            ide_Start(channel, drive, lba48, IDE_PRD_TABLE(next), &requests[next]);
+
+        ide_Complete(segments, &requests[current], progress, context);
+
+        if (!more)
+            break;
+
+        current = next;
+    }
+
+    ide_Release(channel);
+    return ok;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "disk.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Finds a bus-master capable IDE controller and the ATA disks on its two channels
+bool ide_Initialize();
+
+// Returns the drive (channel * 2 + slave) whose disk has the given first sector, or -1
+int ide_FindDisk(const void* firstSector);
+
+// Reads the segments in order with bus-master DMA straight into their destinations.
+// There are two PRD tables: the next command is built while the current one runs and
+// is started as soon as it completes, then progress (if not NULL) is called for the
+// finished chunk while the disk is busy with the next one. Completion is polled on the
+// bus-master status register.
+bool ide_ReadVectored(int drive, disk_Segment* segments, int count, disk_ProgressCallback progress, void* context);
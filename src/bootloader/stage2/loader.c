@@ -0,0 +1,387 @@
+#include "loader.h"
+#include "fat.h"
+#include "stdio.h"
+#include "string.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE 512
+#define LOADER_MAX_SEGMENTS 256
+#define LOADER_MANIFEST_SIZE 1024
+#define LOADER_FILE_ALIGN 0x1000
+#define LOADER_DEFAULT_KERNEL "/kernel.bin"
+
+static disk_Segment g_Segments[LOADER_MAX_SEGMENTS];
+static int g_SegmentCount;
+static fat_Extent g_Extents[LOADER_MAX_SEGMENTS];
+static uint8_t* g_LoadEnd;
+static char g_Manifest[LOADER_MANIFEST_SIZE + 1];
+
+static uint8_t* loader_Align(uint8_t* address)
+{
+    return (uint8_t*)(((uintptr_t)address + LOADER_FILE_ALIGN - 1) & ~(LOADER_FILE_ALIGN - 1));
+}
+
+static uint32_t loader_Sectors(uint32_t bytes)
+{
+    return (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+// Reads all queued segments in one ascending LBA pass, so the disk layer can
+// merge segments that are adjacent on disk even if they belong to different files.
+static bool loader_Flush(DISK* disk)
+{
+    for (int i = 1; i < g_SegmentCount; i++)
+    {
+        disk_Segment segment = g_Segments[i];
+        int j = i - 1;
+        while (j >= 0 && g_Segments[j].Lba > segment.Lba)
+        {
+            g_Segments[j + 1] = g_Segments[j];
+            j--;
+        }
+        g_Segments[j + 1] = segment;
+    }
+
+    bool ok = disk_ReadVectored(disk, g_Segments, g_SegmentCount);
+    if (!ok)
+    {
+        for (int i = 0; i < g_SegmentCount; i++)
+            if (g_Segments[i].Completed != g_Segments[i].Count)
+                printf("LOADER: read only %lu of %lu sectors at lba %lu\r\n", g_Segments[i].Completed, g_Segments[i].Count, g_Segments[i].Lba);
+    }
+
+    g_SegmentCount = 0;
+    return ok;
+}
+
+// Resolves the file's extents into g_Extents, returns their count or -1.
+static int loader_Resolve(DISK* disk, const char* path, uint32_t* sizeOut)
+{
+    fat_File* fd = fat_Open(disk, path);
+    if (fd == NULL)
+        return -1;
+
+    *sizeOut = fd->Size;
+    int extentCount = fat_GetExtents(fd, g_Extents, LOADER_MAX_SEGMENTS);
+    fat_Close(fd);
+
+    if (extentCount < 0)
+        printf("LOADER: %s is too fragmented\r\n", path);
+
+    return extentCount;
+}
+
+// Queues sectors [firstSector, firstSector + sectors) of the resolved file to destination.
+static bool loader_QueueRange(int extentCount, uint32_t firstSector, uint32_t sectors, uint8_t* destination)
+{
+    for (int i = 0; i < extentCount && sectors > 0; i++)
+    {
+        if (firstSector >= g_Extents[i].Sectors)
+        {
+            firstSector -= g_Extents[i].Sectors;
+            continue;
+        }
+
+        if (g_SegmentCount == LOADER_MAX_SEGMENTS)
+        {
+            printf("LOADER: out of segments\r\n");
+            return false;
+        }
+
+        uint32_t take = min(g_Extents[i].Sectors - firstSector, sectors);
+        disk_Segment* segment = &g_Segments[g_SegmentCount++];
+        segment->Lba = g_Extents[i].Lba + firstSector;
+        segment->Count = take;
+        segment->Destination = destination;
+
+        destination += take * SECTOR_SIZE;
+        sectors -= take;
+        firstSector = 0;
+    }
+
+    return true;
+}
+
+static void loader_AddModule(BootParams* params, const char* path, uint32_t type, uint32_t size)
+{
+    BootModule* module = &params->Modules[params->ModuleCount++];
+    module->Start = (uint32_t)g_LoadEnd;
+    module->Size = size;
+    module->Type = type;
+
+    unsigned nameLength = min(strlen(path), BOOT_MODULE_NAME_SIZE - 1);
+    memcpy(module->Name, path, nameLength);
+    module->Name[nameLength] = '\0';
+}
+
+// Resolves the file's extents and reserves its destination, but doesn't read anything yet.
+static bool loader_Queue(DISK* disk, const char* path, uint32_t type, BootParams* params)
+{
+    uint32_t size;
+
+    if (params->ModuleCount >= BOOT_MAX_MODULES)
+    {
+        printf("LOADER: too many modules, skipping %s\r\n", path);
+        return false;
+    }
+
+    int extentCount = loader_Resolve(disk, path, &size);
+    if (extentCount < 0)
+        return false;
+
+    // extents cover whole sectors, the file alignment leaves room for the tail of the last one
+    int firstSegment = g_SegmentCount;
+    if (!loader_QueueRange(extentCount, 0, loader_Sectors(size), g_LoadEnd))
+    {
+        g_SegmentCount = firstSegment;
+        printf("LOADER: can't load %s\r\n", path);
+        return false;
+    }
+
+    loader_AddModule(params, path, type, size);
+    g_LoadEnd = loader_Align(g_LoadEnd + size);
+    return true;
+}
+
+// Looks for a section table in the part of the kernel already read to its load address.
+static const KernelImageHeader* loader_FindKernelHeader(uint32_t headBytes, uint32_t fileSize)
+{
+    for (uint32_t offset = 0; offset + sizeof(KernelImageHeader) <= headBytes; offset += 4)
+    {
+        const KernelImageHeader* header = (const KernelImageHeader*)(g_LoadEnd + offset);
+        if (header->Magic != KERNEL_IMAGE_MAGIC)
+            continue;
+
+        if (header->SectionCount > KERNEL_IMAGE_MAX_SECTIONS
+            || offset + sizeof(KernelImageHeader) + header->SectionCount * sizeof(KernelSection) > headBytes)
+        {
+            printf("LOADER: bad kernel section table\r\n");
+            return NULL;
+        }
+
+        for (uint32_t i = 0; i < header->SectionCount; i++)
+        {
+            const KernelSection* section = &header->Sections[i];
+            if (section->FileOffset % SECTOR_SIZE != 0 || section->MemoryOffset % SECTOR_SIZE != 0
+                || section->FileOffset > fileSize || section->Size > fileSize - section->FileOffset)
+            {
+                printf("LOADER: bad kernel section %lu\r\n", i);
+                return NULL;
+            }
+        }
+
+        return header;
+    }
+
+    return NULL;
+}
+
+// Like loader_Queue, unless the kernel carries a section table: then only the eager
+// sections are read and BootParams.KernelImage tells the kernel where the lazy ones are.
+static bool loader_QueueKernel(DISK* disk, const char* path, BootParams* params)
+{
+    BootKernelImage* image = &params->KernelImage;
+    uint32_t size;
+
+    int extentCount = loader_Resolve(disk, path, &size);
+    if (extentCount < 0)
+        return false;
+
+    uint32_t sectors = loader_Sectors(size);
+    uint32_t headSectors = 0;
+    const KernelImageHeader* header = NULL;
+
+    // lazy sections are only possible if the whole extent list can be handed over
+    if (extentCount <= BOOT_MAX_KERNEL_EXTENTS)
+    {
+        headSectors = min(sectors, KERNEL_IMAGE_SEARCH_SIZE / SECTOR_SIZE);
+        if (!loader_QueueRange(extentCount, 0, headSectors, g_LoadEnd) || !loader_Flush(disk))
+            return false;
+
+        header = loader_FindKernelHeader(min(size, headSectors * SECTOR_SIZE), size);
+    }
+
+    uint32_t footprint = size;
+    if (header == NULL)
+    {
+        if (!loader_QueueRange(extentCount, headSectors, sectors - headSectors, g_LoadEnd + headSectors * SECTOR_SIZE))
+            return false;
+    }
+    else
+    {
+        footprint = 0;
+        for (uint32_t i = 0; i < header->SectionCount; i++)
+        {
+            const KernelSection* section = &header->Sections[i];
+            uint32_t first = section->FileOffset / SECTOR_SIZE;
+            uint32_t count = loader_Sectors(section->Size);
+            footprint = max(footprint, section->MemoryOffset + count * SECTOR_SIZE);
+
+            if (section->Flags & KERNEL_SECTION_LAZY)
+                continue;
+
+            // the part of the head that is already in place doesn't have to be read again
+            uint32_t skip = 0;
+            if (section->FileOffset == section->MemoryOffset && first < headSectors)
+                skip = min(count, headSectors - first);
+
+            uint8_t* destination = g_LoadEnd + section->MemoryOffset + skip * SECTOR_SIZE;
+            if (!loader_QueueRange(extentCount, first + skip, count - skip, destination))
+                return false;
+        }
+
+        // copy the table now, the section reads may overwrite it
+        image->SectionCount = header->SectionCount;
+        memcpy(image->Sections, header->Sections, header->SectionCount * sizeof(KernelSection));
+
+        image->DiskType = disk->type;
+        image->DiskPort = disk->type == DISK_TYPE_BIOS ? disk->id : disk->port;
+        image->Cylinders = disk->cylinders;
+        image->Heads = disk->heads;
+        image->SectorsPerTrack = disk->sectors;
+        image->ExtentCount = extentCount;
+        for (int i = 0; i < extentCount; i++)
+        {
+            image->Extents[i].Lba = g_Extents[i].Lba;
+            image->Extents[i].Sectors = g_Extents[i].Sectors;
+        }
+    }
+
+    loader_AddModule(params, path, BOOT_MODULE_KERNEL, size);
+    g_LoadEnd = loader_Align(g_LoadEnd + footprint);
+    return true;
+}
+
+// Splits the next non-empty, non-comment line into keyword and value.
+static bool loader_NextLine(const char** cursor, const char** keyOut, unsigned* keyLengthOut, char* valueOut)
+{
+    const char* line = *cursor;
+
+    while (*line)
+    {
+        const char* end = strchr(line, '\n');
+        if (end == NULL)
+            end = line + strlen(line);
+
+        *cursor = *end ? end + 1 : end;
+
+        while (line < end && (*line == ' ' || *line == '\t'))
+            line++;
+
+        const char* key = line;
+        while (line < end && *line != ' ' && *line != '\t' && *line != '\r')
+            line++;
+        unsigned keyLength = line - key;
+
+        while (line < end && (*line == ' ' || *line == '\t'))
+            line++;
+
+        const char* value = line;
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+            end--;
+
+        if (keyLength > 0 && *key != '#' && end > value && end - value < MAX_PATH_SIZE)
+        {
+            *keyOut = key;
+            *keyLengthOut = keyLength;
+            memcpy(valueOut, value, end - value);
+            valueOut[end - value] = '\0';
+            return true;
+        }
+
+        line = *cursor;
+    }
+
+    return false;
+}
+
+static bool loader_KeyEquals(const char* key, unsigned keyLength, const char* keyword)
+{
+    return keyLength == strlen(keyword) && memcmp(key, keyword, keyLength) == 0;
+}
+
+static void loader_ParsePaging(const char* value, BootPaging* paging)
+{
+    unsigned length = strlen(value);
+
+    if (loader_KeyEquals(value, length, "off"))
+        paging->Mode = BOOT_PAGING_OFF;
+    else if (loader_KeyEquals(value, length, "pse"))
+        paging->Mode = BOOT_PAGING_PSE;
+    else if (loader_KeyEquals(value, length, "pae"))
+        paging->Mode = BOOT_PAGING_PAE;
+    else if (loader_KeyEquals(value, length, "auto"))
+        paging->Mode = BOOT_PAGING_AUTO;
+    else
+        printf("LOADER: unknown paging mode %s\r\n", value);
+}
+
+static bool loader_ReadManifest(DISK* disk, const char* manifestPath)
+{
+    fat_File* fd = fat_Open(disk, manifestPath);
+    if (fd == NULL)
+        return false;
+
+    if (fd->Size > LOADER_MANIFEST_SIZE)
+    {
+        printf("LOADER: %s is too big\r\n", manifestPath);
+        fat_Close(fd);
+        return false;
+    }
+
+    uint32_t read = fat_Read(disk, fd, fd->Size, g_Manifest);
+    g_Manifest[read] = '\0';
+    fat_Close(fd);
+    return true;
+}
+
+bool loader_LoadManifest(DISK* disk, const char* manifestPath, BootParams* params)
+{
+    const char* key;
+    unsigned keyLength;
+    char path[MAX_PATH_SIZE];
+    const char* cursor;
+
+    g_SegmentCount = 0;
+    g_LoadEnd = (uint8_t*)MEMORY_KERNEL_ADDR;
+    params->ModuleCount = 0;
+    params->Paging.Mode = BOOT_PAGING_OFF;
+    params->KernelImage.SectionCount = 0;
+    params->KernelImage.ExtentCount = 0;
+
+    if (!loader_ReadManifest(disk, manifestPath))
+        g_Manifest[0] = '\0';
+
+    // the kernel always goes first, to MEMORY_KERNEL_ADDR
+    bool haveKernel = false;
+    cursor = g_Manifest;
+    while (!haveKernel && loader_NextLine(&cursor, &key, &keyLength, path))
+        haveKernel = loader_KeyEquals(key, keyLength, "kernel");
+
+    if (!haveKernel)
+        strcpy(path, LOADER_DEFAULT_KERNEL);
+
+    if (!loader_QueueKernel(disk, path, params))
+    {
+        printf("LOADER: failed to load kernel %s\r\n", path);
+        return false;
+    }
+
+    cursor = g_Manifest;
+    while (loader_NextLine(&cursor, &key, &keyLength, path))
+    {
+        if (loader_KeyEquals(key, keyLength, "initrd"))
+            loader_Queue(disk, path, BOOT_MODULE_INITRD, params);
+        else if (loader_KeyEquals(key, keyLength, "module"))
+            loader_Queue(disk, path, BOOT_MODULE_MODULE, params);
+        else if (loader_KeyEquals(key, keyLength, "paging"))
+            loader_ParsePaging(path, &params->Paging);
+        else if (!loader_KeyEquals(key, keyLength, "kernel"))
+            printf("LOADER: unknown manifest entry for %s\r\n", path);
+    }
+
+    return loader_Flush(disk);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+#include "disk.h"
+#include <boot/bootparams.h>
+
+// Loads the kernel, initrd and modules listed in the manifest. Every file's
+// cluster chain is resolved before the first data sector is read, then all
+// extents are read in one LBA-sorted pass. Without a manifest only
+// /kernel.bin is loaded.
+//
+// If the kernel has a section table (see boot/kernelimage.h) only its eager
+// sections are read; the lazy ones are left to the kernel, which finds the
+// boot disk and kernel extents in BootParams.KernelImage.
+//
+// Manifest format, one entry per line, '#' starts a comment:
+//     kernel /kernel.bin
+//     initrd /initrd.img
+//     module /modules/serial.mod
+//     paging auto                     (off, pse, pae or auto; off by default)
+bool loader_LoadManifest(DISK* disk, const char* manifestPath, BootParams* params);
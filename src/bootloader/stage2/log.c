@@ -0,0 +1,128 @@
+#include "log.h"
+#include "stdio.h"
+#include "serial.h"
+#include <stddef.h>
+
+#define LOG_RECORD_COUNT        128         // 16 KiB
+
+static uint8_t g_LogMemory[sizeof(LogRing) + LOG_RECORD_COUNT * sizeof(LogRecord)] __attribute__((aligned(64)));
+static LogRing* const g_Log = (LogRing*)g_LogMemory;
+static uint32_t g_ReportedDropped;
+
+void log_Initialize()
+{
+    g_Log->Magic = LOG_RING_MAGIC;
+    g_Log->RecordCount = LOG_RECORD_COUNT;
+    g_Log->Dropped = 0;
+    g_Log->Draining = 0;
+    g_Log->Head = 0;
+    g_Log->Tail = 0;
+    for (uint32_t i = 0; i < LOG_RECORD_COUNT; i++)
+        g_Log->Records[i].State = i;
+
+    serial_Initialize();
+}
+
+static LogRecord* log_TryReserve()
+{
+    uint32_t position = __atomic_load_n(&g_Log->Head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        LogRecord* record = &g_Log->Records[position % LOG_RECORD_COUNT];
+        uint32_t state = __atomic_load_n(&record->State, __ATOMIC_ACQUIRE);
+
+        if (state == position)
+        {
+            if (__atomic_compare_exchange_n(&g_Log->Head, &position, position + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                record->Sequence = position;
+                return record;
+            }
+        }
+        else if ((int32_t)(state - position) < 0)
+            return NULL;        // still holds last lap's record
+        else
+            position = __atomic_load_n(&g_Log->Head, __ATOMIC_RELAXED);
+    }
+}
+
+LogRecord* log_Reserve()
+{
+    LogRecord* record = log_TryReserve();
+    if (record == NULL)
+    {
+        log_Drain();
+        record = log_TryReserve();
+    }
+
+    if (record == NULL)
+        __atomic_fetch_add(&g_Log->Dropped, 1, __ATOMIC_RELAXED);
+
+    return record;
+}
+
+void log_Commit(LogRecord* record, uint32_t length)
+{
+    record->Length = length;
+    __atomic_store_n(&record->State, record->Sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void log_Print(const char* text, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        putc(text[i]);
+        serial_Putc(text[i]);
+    }
+}
+
+static void log_PrintUnsigned(uint32_t number)
+{
+    char buffer[10];
+    int pos = 0;
+
+    do
+    {
+        buffer[pos++] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+
+    while (--pos >= 0)
+        log_Print(&buffer[pos], 1);
+}
+
+void log_Drain()
+{
+    if (__atomic_exchange_n(&g_Log->Draining, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    uint32_t tail = g_Log->Tail;
+    for (;;)
+    {
+        LogRecord* record = &g_Log->Records[tail % LOG_RECORD_COUNT];
+        if (__atomic_load_n(&record->State, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+
+        log_Print(record->Text, record->Length);
+        __atomic_store_n(&record->State, tail + LOG_RECORD_COUNT, __ATOMIC_RELEASE);
+        tail++;
+    }
+    __atomic_store_n(&g_Log->Tail, tail, __ATOMIC_RELEASE);
+
+    uint32_t dropped = __atomic_load_n(&g_Log->Dropped, __ATOMIC_RELAXED);
+    if (dropped != g_ReportedDropped)
+    {
+        log_Print("LOG: ", 5);
+        log_PrintUnsigned(dropped - g_ReportedDropped);
+        log_Print(" messages dropped\r\n", 19);
+        g_ReportedDropped = dropped;
+    }
+
+    __atomic_store_n(&g_Log->Draining, 0, __ATOMIC_RELEASE);
+}
+
+void log_Describe(BootLog* log)
+{
+    log->RingStart = (uint32_t)g_Log;
+    log->RingSize = sizeof(g_LogMemory);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include <boot/bootparams.h>
+#include <boot/logring.h>
+
+void log_Initialize();
+
+// Claims the next record for the caller to fill in, NULL (and counted as dropped)
+// if the ring is full even after a drain. Never waits for other CPUs.
+LogRecord* log_Reserve();
+void log_Commit(LogRecord* record, uint32_t length);
+
+// Prints committed records to the screen and serial port, up to the first one
+// still being written. Returns right away if another CPU is already draining.
+void log_Drain();
+
+void log_Describe(BootLog* log);
@@ -5,15 +5,31 @@
 #include "fat.h"
 #include "memdefs.h"
 #include "memory.h"
+#include "cpu.h"
+#include "loader.h"
+#include "blocklist.h"
+#include "paging.h"
+#include "smp.h"
+#include "memmap.h"
+#include "log.h"
+#include "diskbench.h"
+#include <boot/bootparams.h>
 
-uint8_t* KernelLoadBuffer = (uint8_t*)MEMORY_LOAD_KERNEL;
 uint8_t* Kernel = (uint8_t*)MEMORY_KERNEL_ADDR;
 
-typedef void (*KernelStart)();
+static BootParams g_BootParams;
+
+typedef void (*KernelStart)(BootParams* bootParams);
 
 void __attribute__((cdecl)) start(uint16_t bootDrive)
 {
     clrscr();
+    log_Initialize();
+    cpu_Initialize();
+    memory_Initialize();
+    smp_Start();
+    memmap_Detect(&g_BootParams.MemoryMap);
+
     DISK disk;
     if (!disk_Initialize(&disk, bootDrive))
     {
@@ -21,24 +37,44 @@ void __attribute__((cdecl)) start(uint16_t bootDrive)
         goto end;
     }
 
-    if (!fat_Initialize(&disk))
+    g_BootParams.BootDevice = bootDrive;
+
+    // B pressed during boot: characterize the disk, then carry on once it has been read
+    uint16_t key = x86_Keyboard_Poll() & 0xFF;
+    if (key == 'b' || key == 'B')
     {
-        printf("FAT init error\r\n");
-        goto end;
+        diskbench_Policy policy;
+        diskbench_Run(&disk, &policy);
+        printf("Press any key to continue booting\r\n");
+        while (x86_Keyboard_Poll() == 0)
+            ;
     }
 
-    fat_File* fd = fat_Open(&disk, "/kernel.bin");
-    uint32_t read;
-    uint8_t* kernelBuffer = Kernel;
-    while ((read = fat_Read(&disk, fd, MEMORY_LOAD_SIZE, KernelLoadBuffer)))
+    // unchanged image: skip the FAT entirely
+    if (!blocklist_LoadKernel(&disk, &g_BootParams))
     {
-        memcpy(kernelBuffer, KernelLoadBuffer, read);
-        kernelBuffer += read;
+        if (!fat_Initialize(&disk))
+        {
+            printf("FAT init error\r\n");
+            goto end;
+        }
+
+        if (!loader_LoadManifest(&disk, "/boot.cfg", &g_BootParams))
+        {
+            printf("Kernel load error\r\n");
+            goto end;
+        }
+
+        fat_Describe(&g_BootParams.Filesystem);
     }
-    fat_Close(fd);
+
+    smp_Park(&g_BootParams.Smp);
+    paging_Setup(&g_BootParams.Paging);
+    log_Describe(&g_BootParams.Log);
+    paging_Enable(&g_BootParams.Paging);
 
     KernelStart kernelStart = (KernelStart)Kernel;
-    kernelStart();
+    kernelStart(&g_BootParams);
 end:
     for (;;);
 }
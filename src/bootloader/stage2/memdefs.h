@@ -1,24 +1,57 @@
 #pragma once
 
+// Physical addresses, stage2 runs identity mapped. tools/bench builds stage2 with
+// MEMORY_BASE pointing at the buffer standing in for the low megabyte.
+#ifndef MEMORY_BASE
+#define MEMORY_BASE         0
+#endif
+
 // 0x00000000 - 0x000003FF - interrupt vector table
 // 0x00000400 - 0x000004FF - BIOS data area
 
 #define MEMORY_MIN          0x00000500
 #define MEMORY_MAX          0x00080000
 
-// 0x00000500 - 0x00010500 - FAT driver
-#define MEMORY_FAT_ADDR     ((void*)0x20000)
+// 0x00000500 - 0x00007BFF - stage2 stack (see entry.asm)
+// 0x00007C00 - 0x00007DFF - stage1
+// 0x00007E00 - 0x0001FFFF - stage2, linker.ld fails the build if it grows past this
+
+#define MEMORY_FAT_ADDR     ((void*)(MEMORY_BASE + 0x20000))
 #define MEMORY_FAT_SIZE     0x00010000
 
-#define MEMORY_LOAD_KERNEL  ((void*)0x30000)
+// bounce buffer for disk reads, 64 KiB aligned so transfers never cross a DMA boundary
+#define MEMORY_LOAD_KERNEL  ((void*)(MEMORY_BASE + 0x30000))
 #define MEMORY_LOAD_SIZE    0x00010000
 
-// 0x00020000 - 0x00030000 - stage2
+// AHCI command list, received FIS and command tables
+#define MEMORY_AHCI_ADDR    ((void*)(MEMORY_BASE + 0x40000))
+#define MEMORY_AHCI_SIZE    0x00010000
+
+// virtio-blk virtqueue, indirect descriptor tables and request headers
+#define MEMORY_VIRTIO_ADDR  ((void*)(MEMORY_BASE + 0x50000))
+#define MEMORY_VIRTIO_SIZE  0x00010000
+
+// floppy DMA buffer, holds one cylinder and stays within one 64 KiB DMA page
+#define MEMORY_FDC_ADDR     ((void*)(MEMORY_BASE + 0x60000))
+#define MEMORY_FDC_SIZE     0x00008000
 
-// 0x00030000 - 0x00080000 - free
+// page tables built for the kernel, stay in use after the jump
+#define MEMORY_PAGING_ADDR  ((void*)(MEMORY_BASE + 0x68000))
+#define MEMORY_PAGING_SIZE  0x00008000
+
+// bus-master IDE PRD tables and scratch sector
+#define MEMORY_IDE_ADDR     ((void*)(MEMORY_BASE + 0x70000))
+#define MEMORY_IDE_SIZE     0x00001000
+
+// AP startup trampoline (page aligned for the SIPI vector), then one stack per AP
+#define MEMORY_SMP_ADDR     ((void*)(MEMORY_BASE + 0x71000))
+#define MEMORY_SMP_SIZE     0x0000F000
 
 // 0x00080000 - 0x0009FFFF - Extended BIOS data area
 // 0x000A0000 - 0x000C7FFF - Video
 // 0x000C8000 - 0x000FFFFF - BIOS
 
-#define MEMORY_KERNEL_ADDR  ((void*)0x100000)
\ No newline at end of file
+// the BIOS can only transfer to memory below this
+#define MEMORY_LOWMEM_LIMIT 0x00100000
+
+#define MEMORY_KERNEL_ADDR  ((void*)(MEMORY_BASE + 0x100000))
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "memmap.h"
+#include "x86.h"
+#include "stdio.h"
+
+#define E820_ACPI_VALID 0x01
+
+bool memmap_Detect(BootMemoryMap* map)
+{
+    x86_E820Block block;
+    uint32_t continuation = 0;
+
+    map->RegionCount = 0;
+    do
+    {
+        // a BIOS that only fills 20 bytes leaves the entry valid
+        block.Acpi = E820_ACPI_VALID;
+        if (x86_E820GetNextBlock(&block, &continuation) < 0)
+            break;
+
+        if (!(block.Acpi & E820_ACPI_VALID) || block.Length == 0)
+            continue;
+
+        // insertion sort, the BIOS usually returns them in order already
+        int i = map->RegionCount++;
+        while (i > 0 && map->Regions[i - 1].Base > block.Base)
+        {
+            map->Regions[i] = map->Regions[i - 1];
+            i--;
+        }
+
+        map->Regions[i].Base = block.Base;
+        map->Regions[i].Length = block.Length;
+        map->Regions[i].Type = block.Type;
+    } while (continuation != 0 && map->RegionCount < BOOT_MAX_MEMORY_REGIONS);
+
+    if (map->RegionCount == 0)
+    {
+        printf("MEMMAP: no E820 memory map\r\n");
+        return false;
+    }
+
+    return true;
+}
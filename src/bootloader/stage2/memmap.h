@@ -0,0 +1,7 @@
+#pragma once
+#include <stdbool.h>
+#include <boot/bootparams.h>
+
+// Collects the BIOS memory map with INT 15h E820 and sorts it by base.
+// Returns false if the BIOS doesn't support E820.
+bool memmap_Detect(BootMemoryMap* map);
@@ -0,0 +1,179 @@
+#include "memory.h"
+#include "cpu.h"
+#include <stddef.h>
+
+// copies shorter than this aren't worth aligning the destination for,
+// it also guarantees at least one full 64 byte block after alignment
+#define MEMORY_SSE2_THRESHOLD 128
+
+typedef void* (*memcpy_Function)(void* dst, const void* src, uint32_t num);
+typedef void* (*memset_Function)(void* ptr, int value, uint32_t num);
+
+static memcpy_Function g_Memcpy = memcpy_movsd;
+static memset_Function g_Memset = memset_stosd;
+static const char* g_MemoryImplementation = "movsd";
+
+void* memcpy_movsd(void* dst, const void* src, uint32_t num)
+{
+    void* d = dst;
+    uint32_t dwords = num >> 2;
+    uint32_t bytes = num & 3;
+
+    __asm__ volatile("rep movsl" : "+D"(d), "+S"(src), "+c"(dwords) : : "memory");
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(bytes) : : "memory");
+    return dst;
+}
+
+void* memcpy_erms(void* dst, const void* src, uint32_t num)
+{
+    void* d = dst;
+
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(num) : : "memory");
+    return dst;
+}
+
+__attribute__((target("sse2")))
+void* memcpy_sse2(void* dst, const void* src, uint32_t num)
+{
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (num >= MEMORY_SSE2_THRESHOLD)
+    {
+        // align the destination so the stores can use movdqa
+        uint32_t head = (uint32_t)(-(uintptr_t)d & 15);
+        memcpy_movsd(d, s, head);
+        d += head;
+        s += head;
+        num -= head;
+
+        uint32_t blocks = num / 64;
+        num %= 64;
+
+        __asm__ volatile(
+            "1:\n\t"
+            "movdqu   (%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movdqa %%xmm0,   (%0)\n\t"
+            "movdqa %%xmm1, 16(%0)\n\t"
+            "movdqa %%xmm2, 32(%0)\n\t"
+            "movdqa %%xmm3, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "add $64, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b"
+            : "+r"(d), "+r"(s), "+r"(blocks)
+            :
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+
+    memcpy_movsd(d, s, num);
+    return dst;
+}
+
+void* memset_stosd(void* ptr, int value, uint32_t num)
+{
+    void* p = ptr;
+    uint32_t pattern = (uint8_t)value * 0x01010101u;
+    uint32_t dwords = num >> 2;
+    uint32_t bytes = num & 3;
+
+    __asm__ volatile("rep stosl" : "+D"(p), "+c"(dwords) : "a"(pattern) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(p), "+c"(bytes) : "a"(pattern) : "memory");
+    return ptr;
+}
+
+void* memset_erms(void* ptr, int value, uint32_t num)
+{
+    void* p = ptr;
+
+    __asm__ volatile("rep stosb" : "+D"(p), "+c"(num) : "a"(value) : "memory");
+    return ptr;
+}
+
+__attribute__((target("sse2")))
+void* memset_sse2(void* ptr, int value, uint32_t num)
+{
+    uint8_t* p = (uint8_t*)ptr;
+
+    if (num >= MEMORY_SSE2_THRESHOLD)
+    {
+        uint32_t head = (uint32_t)(-(uintptr_t)p & 15);
+        memset_stosd(p, value, head);
+        p += head;
+        num -= head;
+
+        uint32_t blocks = num / 64;
+        uint32_t pattern = (uint8_t)value * 0x01010101u;
+        num %= 64;
+
+        __asm__ volatile(
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movdqa %%xmm0,   (%0)\n\t"
+            "movdqa %%xmm0, 16(%0)\n\t"
+            "movdqa %%xmm0, 32(%0)\n\t"
+            "movdqa %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b"
+            : "+r"(p), "+r"(blocks)
+            : "r"(pattern)
+            : "memory", "xmm0");
+    }
+
+    memset_stosd(p, value, num);
+    return ptr;
+}
+
+void memory_Initialize()
+{
+    if (cpu_Has(CPU_FEATURE_ERMS))
+    {
+        g_Memcpy = memcpy_erms;
+        g_Memset = memset_erms;
+        g_MemoryImplementation = "erms";
+    }
+    else if (cpu_Has(CPU_FEATURE_SSE | CPU_FEATURE_SSE2))
+    {
+        g_Memcpy = memcpy_sse2;
+        g_Memset = memset_sse2;
+        g_MemoryImplementation = "sse2";
+    }
+    else
+    {
+        g_Memcpy = memcpy_movsd;
+        g_Memset = memset_stosd;
+        g_MemoryImplementation = "movsd";
+    }
+}
+
+const char* memory_Implementation()
+{
+    return g_MemoryImplementation;
+}
+
+void* memcpy(void* dst, const void* src, uint32_t num)
+{
+    return g_Memcpy(dst, src, num);
+}
+
+void* memset(void* ptr, int value, uint32_t num)
+{
+    return g_Memset(ptr, value, num);
+}
+
+int memcmp(const void* ptr1, const void* ptr2, uint32_t num)
+{
+    const uint8_t* u8Ptr1 = (const uint8_t*)ptr1;
+    const uint8_t* u8Ptr2 = (const uint8_t*)ptr2;
+
+    for (uint32_t i = 0; i < num; i++)
+        if (u8Ptr1[i] != u8Ptr2[i])
+            return u8Ptr1[i] - u8Ptr2[i];
+
+    return 0;
+}
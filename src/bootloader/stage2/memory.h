@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+// memcpy/memset dispatch to the best variant for the current CPU. They are safe
+// to call before memory_Initialize, which just switches to the faster versions.
+void memory_Initialize();
+const char* memory_Implementation();
+
+void* memcpy(void* dst, const void* src, uint32_t num);
+void* memset(void* ptr, int value, uint32_t num);
+int memcmp(const void* ptr1, const void* ptr2, uint32_t num);
+
+// individual variants, exposed for benchmarking
+void* memcpy_movsd(void* dst, const void* src, uint32_t num);
+void* memcpy_sse2(void* dst, const void* src, uint32_t num);
+void* memcpy_erms(void* dst, const void* src, uint32_t num);
+void* memset_stosd(void* ptr, int value, uint32_t num);
+void* memset_sse2(void* ptr, int value, uint32_t num);
+void* memset_erms(void* ptr, int value, uint32_t num);
@@ -0,0 +1,98 @@
+#include "paging.h"
+#include "cpu.h"
+#include "x86.h"
+#include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+
+#define PAGING_MAPPED_SIZE      0x40000000      // 1 GiB, all that fits above BOOT_KERNEL_VIRTUAL_BASE
+
+#define PAGE_PRESENT            0x001
+#define PAGE_WRITE              0x002
+#define PAGE_LARGE              0x080
+
+#define PSE_PAGE_SHIFT          22              // 4 MiB
+#define PAE_PAGE_SHIFT          21              // 2 MiB
+#define PAE_DIRECTORIES         4
+#define PAE_DIRECTORY_ENTRIES   512
+
+#define CR4_PSE                 (1 << 4)
+#define CR4_PAE                 (1 << 5)
+
+// 0x0000 - page directory (PSE) or PDPT (PAE), 0x1000 - PAE page directories
+#define PAGING_TOP_TABLE        ((uint8_t*)MEMORY_PAGING_ADDR)
+#define PAGING_PAE_DIRECTORIES  ((uint64_t*)((uint8_t*)MEMORY_PAGING_ADDR + 0x1000))
+
+static void paging_BuildPse(BootPaging* paging)
+{
+    uint32_t* directory = (uint32_t*)PAGING_TOP_TABLE;
+    memset(directory, 0, 0x1000);
+
+    for (uint32_t address = 0; address < PAGING_MAPPED_SIZE; address += 1 << PSE_PAGE_SHIFT)
+    {
+        uint32_t entry = address | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE;
+        directory[address >> PSE_PAGE_SHIFT] = entry;
+        directory[(BOOT_KERNEL_VIRTUAL_BASE + address) >> PSE_PAGE_SHIFT] = entry;
+    }
+
+    paging->TablesSize = 0x1000;
+}
+
+static void paging_BuildPae(BootPaging* paging)
+{
+    uint64_t* pdpt = (uint64_t*)PAGING_TOP_TABLE;
+    uint64_t* directories = PAGING_PAE_DIRECTORIES;
+    memset(pdpt, 0, 0x1000 + PAE_DIRECTORIES * 0x1000);
+
+    // PDPT entries only have the present bit, RW and US are reserved
+    for (int i = 0; i < PAE_DIRECTORIES; i++)
+        pdpt[i] = (uint32_t)(directories + i * PAE_DIRECTORY_ENTRIES) | PAGE_PRESENT;
+
+    // the directories are consecutive, so a 2 MiB page number indexes all of them at once
+    for (uint32_t address = 0; address < PAGING_MAPPED_SIZE; address += 1 << PAE_PAGE_SHIFT)
+    {
+        uint64_t entry = address | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE;
+        directories[address >> PAE_PAGE_SHIFT] = entry;
+        directories[(BOOT_KERNEL_VIRTUAL_BASE + address) >> PAE_PAGE_SHIFT] = entry;
+    }
+
+    paging->TablesSize = 0x1000 + PAE_DIRECTORIES * 0x1000;
+}
+
+void paging_Setup(BootPaging* paging)
+{
+    if (paging->Mode == BOOT_PAGING_AUTO)
+        paging->Mode = cpu_Has(CPU_FEATURE_PSE) ? BOOT_PAGING_PSE : BOOT_PAGING_PAE;
+
+    if ((paging->Mode == BOOT_PAGING_PSE && !cpu_Has(CPU_FEATURE_PSE))
+        || (paging->Mode == BOOT_PAGING_PAE && !cpu_Has(CPU_FEATURE_PAE)))
+    {
+        printf("PAGING: CPU has no large pages, kernel gets paging off\r\n");
+        paging->Mode = BOOT_PAGING_OFF;
+    }
+
+    paging->Cr3 = 0;
+    paging->TablesStart = 0;
+    paging->TablesSize = 0;
+    paging->MappedSize = 0;
+
+    if (paging->Mode == BOOT_PAGING_OFF)
+        return;
+
+    if (paging->Mode == BOOT_PAGING_PSE)
+        paging_BuildPse(paging);
+    else
+        paging_BuildPae(paging);
+
+    paging->Cr3 = (uint32_t)PAGING_TOP_TABLE;
+    paging->TablesStart = (uint32_t)MEMORY_PAGING_ADDR;
+    paging->MappedSize = PAGING_MAPPED_SIZE;
+}
+
+void paging_Enable(const BootPaging* paging)
+{
+    if (paging->Mode == BOOT_PAGING_PSE)
+        x86_EnablePaging(paging->Cr3, CR4_PSE);
+    else if (paging->Mode == BOOT_PAGING_PAE)
+        x86_EnablePaging(paging->Cr3, CR4_PAE);
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdbool.h>
+#include <boot/bootparams.h>
+
+// Builds the page tables for the requested paging->Mode and fills in the rest of
+// paging. Falls back to BOOT_PAGING_OFF if the CPU can't do the requested mode.
+void paging_Setup(BootPaging* paging);
+
+// Turns paging on with the tables from paging_Setup. Nothing may call into the
+// BIOS afterwards, so this has to be the last step before entering the kernel.
+void paging_Enable(const BootPaging* paging);
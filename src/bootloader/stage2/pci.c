@@ -0,0 +1,63 @@
+#include "pci.h"
+#include "x86.h"
+
+#define PCI_CONFIG_ADDRESS      0xCF8
+#define PCI_CONFIG_DATA         0xCFC
+
+uint32_t pci_ConfigRead(pci_Address address, uint8_t offset)
+{
+    x86_outl(PCI_CONFIG_ADDRESS, 0x80000000 | (address.Bus << 16) | (address.Device << 11) | (address.Function << 8) | (offset & 0xFC));
+    return x86_inl(PCI_CONFIG_DATA);
+}
+
+void pci_ConfigWrite(pci_Address address, uint8_t offset, uint32_t value)
+{
+    x86_outl(PCI_CONFIG_ADDRESS, 0x80000000 | (address.Bus << 16) | (address.Device << 11) | (address.Function << 8) | (offset & 0xFC));
+    x86_outl(PCI_CONFIG_DATA, value);
+}
+
+// Walks all functions, returning the index-th one whose register matches value under mask
+static bool pci_Find(uint8_t reg, uint32_t mask, uint32_t value, int index, pci_Address* addressOut)
+{
+    for (int bus = 0; bus < 256; bus++)
+    {
+        for (int device = 0; device < 32; device++)
+        {
+            pci_Address address = { bus, device, 0 };
+            if ((pci_ConfigRead(address, PCI_REG_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+                continue;
+
+            // only multi-function devices implement functions 1-7
+            int functions = (pci_ConfigRead(address, PCI_REG_HEADER_TYPE) & 0x00800000) ? 8 : 1;
+            for (int function = 0; function < functions; function++)
+            {
+                address.Function = function;
+                if ((pci_ConfigRead(address, PCI_REG_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+                    continue;
+
+                if ((pci_ConfigRead(address, reg) & mask) == value && index-- == 0)
+                {
+                    *addressOut = address;
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool pci_FindClass(uint8_t classCode, uint8_t subclass, uint8_t progIf, pci_Address* addressOut)
+{
+    return pci_Find(PCI_REG_CLASS, 0xFFFFFF00, (classCode << 24) | (subclass << 16) | (progIf << 8), 0, addressOut);
+}
+
+bool pci_FindSubclass(uint8_t classCode, uint8_t subclass, int index, pci_Address* addressOut)
+{
+    return pci_Find(PCI_REG_CLASS, 0xFFFF0000, (classCode << 24) | (subclass << 16), index, addressOut);
+}
+
+bool pci_FindDevice(uint16_t vendorId, uint16_t deviceId, int index, pci_Address* addressOut)
+{
+    return pci_Find(PCI_REG_VENDOR_ID, 0xFFFFFFFF, ((uint32_t)deviceId << 16) | vendorId, index, addressOut);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t Bus;
+    uint8_t Device;
+    uint8_t Function;
+} pci_Address;
+
+#define PCI_REG_VENDOR_ID       0x00
+#define PCI_REG_COMMAND         0x04
+#define PCI_REG_CLASS           0x08
+#define PCI_REG_HEADER_TYPE     0x0C
+#define PCI_REG_BAR0            0x10
+
+#define PCI_COMMAND_IO          (1 << 0)
+#define PCI_COMMAND_MEMORY      (1 << 1)
+#define PCI_COMMAND_BUS_MASTER  (1 << 2)
+
+uint32_t pci_ConfigRead(pci_Address address, uint8_t offset);
+void pci_ConfigWrite(pci_Address address, uint8_t offset, uint32_t value);
+
+// Finds the first function with the given class/subclass/programming interface
+bool pci_FindClass(uint8_t classCode, uint8_t subclass, uint8_t progIf, pci_Address* addressOut);
+
+// Finds the index-th function with the given class/subclass, whatever its programming interface
+bool pci_FindSubclass(uint8_t classCode, uint8_t subclass, int index, pci_Address* addressOut);
+
+// Finds the index-th function with the given vendor and device id
+bool pci_FindDevice(uint16_t vendorId, uint16_t deviceId, int index, pci_Address* addressOut);
@@ -0,0 +1,53 @@
+#include "pit.h"
+#include "x86.h"
+#include "minmax.h"
+
+#define PIT_FREQUENCY           1193182
+#define PIT_MAX_SHOT_MS         50          // the 16 bit counter runs out at 54.9 ms
+
+#define PIT_PORT_CHANNEL2       0x42
+#define PIT_PORT_COMMAND        0x43
+#define PIT_PORT_CONTROL        0x61
+
+#define PIT_CONTROL_GATE2       0x01
+#define PIT_CONTROL_SPEAKER     0x02
+#define PIT_CONTROL_OUT2        0x20
+#define PIT_COMMAND_ONE_SHOT2   0xB0        // channel 2, low then high byte, mode 0
+
+static uint32_t g_Remaining;
+
+static void pit_OneShot(uint32_t ms)
+{
+    uint8_t control = x86_inb(PIT_PORT_CONTROL) & ~(PIT_CONTROL_GATE2 | PIT_CONTROL_SPEAKER);
+    x86_outb(PIT_PORT_CONTROL, control);
+
+    uint16_t count = max(PIT_FREQUENCY * ms / 1000, 1);
+    x86_outb(PIT_PORT_COMMAND, PIT_COMMAND_ONE_SHOT2);
+    x86_outb(PIT_PORT_CHANNEL2, count & 0xFF);
+    x86_outb(PIT_PORT_CHANNEL2, count >> 8);
+
+    // OUT2 drops when the count is written and goes high again when it reaches 0
+    x86_outb(PIT_PORT_CONTROL, control | PIT_CONTROL_GATE2);
+}
+
+void pit_StartTimeout(uint32_t ms)
+{
+    uint32_t shot = min(ms, PIT_MAX_SHOT_MS);
+    g_Remaining = ms - shot;
+    pit_OneShot(shot);
+}
+
+bool pit_TimedOut()
+{
+    if (!(x86_inb(PIT_PORT_CONTROL) & PIT_CONTROL_OUT2))
+        return false;
+
+    if (g_Remaining == 0)
+        return true;
+
+    // longer timeouts are a chain of one-shots
+    uint32_t shot = min(g_Remaining, PIT_MAX_SHOT_MS);
+    g_Remaining -= shot;
+    pit_OneShot(shot);
+    return false;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Millisecond timeouts off PIT channel 2 (the speaker channel), polled, so they
+// work with interrupts off and don't depend on how fast the loop around them is.
+// There is one timer: starting a timeout abandons the previous one.
+void pit_StartTimeout(uint32_t ms);
+bool pit_TimedOut();
@@ -0,0 +1,52 @@
+#include "serial.h"
+#include "x86.h"
+
+#define SERIAL_PORT             0x3F8       // COM1
+#define SERIAL_REG_DATA         0
+#define SERIAL_REG_IER          1
+#define SERIAL_REG_FCR          2
+#define SERIAL_REG_LCR          3
+#define SERIAL_REG_MCR          4
+#define SERIAL_REG_LSR          5
+#define SERIAL_REG_SCRATCH      7
+
+#define SERIAL_LCR_DLAB         0x80
+#define SERIAL_LCR_8N1          0x03
+#define SERIAL_LSR_THR_EMPTY    0x20
+#define SERIAL_DIVISOR          1           // 115200 baud
+#define SERIAL_TIMEOUT          100000      // LSR polls before a character is given up on
+
+static bool g_SerialPresent;
+
+bool serial_Initialize()
+{
+    // no UART answers the scratch register with what was written to it
+    x86_outb(SERIAL_PORT + SERIAL_REG_SCRATCH, 0xA5);
+    g_SerialPresent = x86_inb(SERIAL_PORT + SERIAL_REG_SCRATCH) == 0xA5;
+    if (!g_SerialPresent)
+        return false;
+
+    x86_outb(SERIAL_PORT + SERIAL_REG_IER, 0);
+    x86_outb(SERIAL_PORT + SERIAL_REG_LCR, SERIAL_LCR_DLAB);
+    x86_outb(SERIAL_PORT + SERIAL_REG_DATA, SERIAL_DIVISOR & 0xFF);
+    x86_outb(SERIAL_PORT + SERIAL_REG_IER, SERIAL_DIVISOR >> 8);
+    x86_outb(SERIAL_PORT + SERIAL_REG_LCR, SERIAL_LCR_8N1);
+    x86_outb(SERIAL_PORT + SERIAL_REG_FCR, 0xC7);       // FIFOs on and cleared, 14 byte threshold
+    x86_outb(SERIAL_PORT + SERIAL_REG_MCR, 0x03);       // DTR, RTS
+    return true;
+}
+
+void serial_Putc(char c)
+{
+    if (!g_SerialPresent)
+        return;
+
+    for (int i = 0; i < SERIAL_TIMEOUT; i++)
+    {
+        if (x86_inb(SERIAL_PORT + SERIAL_REG_LSR) & SERIAL_LSR_THR_EMPTY)
+        {
+            x86_outb(SERIAL_PORT + SERIAL_REG_DATA, c);
+            return;
+        }
+    }
+}
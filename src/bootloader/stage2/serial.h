@@ -0,0 +1,7 @@
+#pragma once
+#include <stdbool.h>
+
+// COM1 at 115200 8N1, polled. Returns false if there is no UART, after which
+// serial_Putc does nothing.
+bool serial_Initialize();
+void serial_Putc(char c);
@@ -0,0 +1,83 @@
+;
+; Application processor startup trampoline. smp.c copies everything between
+; smp_Trampoline and smp_TrampolineEnd to a page below 1 MiB, fills in the
+; parameter block and points the startup IPI at it. APs arrive in real mode at
+; offset 0 with CS = page address >> 4, so the real mode part only uses CS
+; relative addresses and the protected mode part addresses through ebx.
+;
+
+%define TRAMPOLINE_OFFSET(label) (label - smp_Trampoline)
+
+global smp_Trampoline
+global smp_TrampolineParams
+global smp_TrampolineProtectedMode
+global smp_TrampolineEnd
+
+smp_Trampoline:
+    [bits 16]
+    cli
+    cld
+    jmp short trampoline_RealMode
+
+    align 4
+
+; see smp_TrampolineParamBlock in smp.c, filled in after the copy
+smp_TrampolineParams:
+trampoline_Gdtr:        dw 0            ; stage2's GDT, from sgdt on the BSP
+                        dd 0
+                        dw 0
+trampoline_Jump:        dd 0            ; linear address of smp_TrampolineProtectedMode
+                        dw 08h          ; 32-bit code segment
+                        dw 0
+trampoline_Entry:       dd 0            ; void cdecl entry(uint32_t index), returns to park
+trampoline_Stacks:      dd 0
+trampoline_StackSize:   dd 0
+trampoline_MaxAps:      dd 0
+trampoline_Started:     dd 0            ; APs that got here, also hands out indices
+
+trampoline_RealMode:
+    mov ax, cs
+    mov ds, ax
+    movzx ebx, ax
+    shl ebx, 4                          ; ebx - linear address of the trampoline
+
+    o32 lgdt [TRAMPOLINE_OFFSET(trampoline_Gdtr)]
+
+    ; set protection enable flag in CR0
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+
+    ; far jump into protected mode
+    o32 jmp far [TRAMPOLINE_OFFSET(trampoline_Jump)]
+
+smp_TrampolineProtectedMode:
+    [bits 32]
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; take an index, APs past the last stack go straight to sleep
+    mov eax, 1
+    lock xadd [ebx + TRAMPOLINE_OFFSET(trampoline_Started)], eax
+    cmp eax, [ebx + TRAMPOLINE_OFFSET(trampoline_MaxAps)]
+    jae trampoline_Park
+
+    ; stacks grow down from Stacks + (index + 1) * StackSize
+    lea esp, [eax + 1]
+    imul esp, [ebx + TRAMPOLINE_OFFSET(trampoline_StackSize)]
+    add esp, [ebx + TRAMPOLINE_OFFSET(trampoline_Stacks)]
+
+    push eax
+    call [ebx + TRAMPOLINE_OFFSET(trampoline_Entry)]
+
+    ; parked: only INIT (or NMI/SMI) gets an AP out of here
+trampoline_Park:
+    cli
+    hlt
+    jmp trampoline_Park
+
+smp_TrampolineEnd:
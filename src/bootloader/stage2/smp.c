@@ -0,0 +1,325 @@
+#include "smp.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "x86.h"
+#include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+
+#define SMP_MAX_WORK                64
+#define SMP_STACK_SIZE              0x1000
+#define SMP_MAX_APS                 min(BOOT_MAX_CPUS - 1, (MEMORY_SMP_SIZE - SMP_STACK_SIZE) / SMP_STACK_SIZE)
+#define SMP_TIMEOUT                 10000000    // ICR polls before giving up
+#define SMP_INIT_DELAY              10000       // us between INIT and the first SIPI, on CPUs that need it
+#define SMP_STARTUP_DELAY           200         // us between the two SIPIs
+#define SMP_ARRIVAL_DELAY           10000       // us after the SIPIs by which every AP has shown up
+
+#define CPUID_VENDOR_INTEL          0x756E6547  // "Genu", EBX of leaf 0
+#define CPUID_VENDOR_AMD            0x68747541  // "Auth"
+#define CPUID_VENDOR_HYGON          0x6F677948  // "Hygo"
+
+#define MSR_APIC_BASE               0x1B
+#define MSR_APIC_BASE_ENABLE        (1 << 11)
+#define MSR_APIC_BASE_ADDRESS       0xFFFFF000
+
+#define APIC_REG_ID                 0x020
+#define APIC_REG_ICR_LOW            0x300
+#define APIC_REG_ICR_HIGH           0x310
+
+#define APIC_ICR_INIT               0x00000500
+#define APIC_ICR_STARTUP            0x00000600
+#define APIC_ICR_PENDING            0x00001000
+#define APIC_ICR_ASSERT             0x00004000
+#define APIC_ICR_DESTINATION_SHIFT  24          // in ICR_HIGH, physical destination mode
+
+// the trampoline's parameter block, see smp.asm
+typedef struct
+{
+    uint16_t GdtLimit;
+    uint32_t GdtBase;
+    uint16_t Reserved0;
+    uint32_t JumpOffset;
+    uint16_t JumpSelector;
+    uint16_t Reserved1;
+    uint32_t Entry;
+    uint32_t Stacks;
+    uint32_t StackSize;
+    uint32_t MaxAps;
+    volatile uint32_t Started;
+} __attribute__((packed)) smp_TrampolineParamBlock;
+
+// Sequence says whose turn the slot is: the producer may fill it at position
+// pos once it equals pos, a consumer may take it once it equals pos + 1, and
+// frees it for the next lap by storing pos + SMP_MAX_WORK.
+typedef struct
+{
+    volatile uint32_t Sequence;
+    smp_WorkFunction Function;
+    void* Argument;
+} smp_Work;
+
+extern uint8_t smp_Trampoline[];
+extern uint8_t smp_TrampolineParams[];
+extern uint8_t smp_TrampolineProtectedMode[];
+extern uint8_t smp_TrampolineEnd[];
+
+#define SMP_TRAMPOLINE              ((uint8_t*)MEMORY_SMP_ADDR)
+#define SMP_TRAMPOLINE_OFFSET(label) ((label) - smp_Trampoline)
+#define SMP_PARAMS                  ((smp_TrampolineParamBlock*)(SMP_TRAMPOLINE + SMP_TRAMPOLINE_OFFSET(smp_TrampolineParams)))
+#define SMP_STACKS                  (SMP_TRAMPOLINE + SMP_STACK_SIZE)
+
+static uint32_t g_ApicBase;
+static bool g_Queueing;         // SIPIs went out, work goes through the queue once an AP arrives
+static uint32_t g_ApCount;      // listed in the MADT and given a stack
+static uint8_t g_ApicIds[BOOT_MAX_CPUS];
+
+// single producer (the BSP), any CPU consumes; positions only grow
+static smp_Work g_Work[SMP_MAX_WORK];
+static volatile uint32_t g_Submitted;
+static volatile uint32_t g_Claimed;
+static volatile uint32_t g_Finished;
+static volatile bool g_Park;
+static volatile uint32_t g_Parked;
+
+// ~1us per access to the POST diagnostic port
+static void smp_Delay(uint32_t microseconds)
+{
+    while (microseconds--)
+        x86_outb(0x80, 0);
+}
+
+static void smp_Pause()
+{
+    __asm__ volatile("pause" ::: "memory");
+}
+
+static uint32_t smp_ApicRead(uint32_t reg)
+{
+    return *(volatile uint32_t*)(g_ApicBase + reg);
+}
+
+static void smp_ApicWrite(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(g_ApicBase + reg) = value;
+}
+
+static bool smp_SendIpi(uint8_t apicId, uint32_t command)
+{
+    smp_ApicWrite(APIC_REG_ICR_HIGH, (uint32_t)apicId << APIC_ICR_DESTINATION_SHIFT);
+    smp_ApicWrite(APIC_REG_ICR_LOW, command);
+
+    for (uint32_t i = 0; i < SMP_TIMEOUT; i++)
+        if (!(smp_ApicRead(APIC_REG_ICR_LOW) & APIC_ICR_PENDING))
+            return true;
+
+    return false;
+}
+
+static bool smp_RunOne()
+{
+    uint32_t claimed = __atomic_load_n(&g_Claimed, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        smp_Work* slot = &g_Work[claimed % SMP_MAX_WORK];
+        int32_t ready = (int32_t)(__atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE) - (claimed + 1));
+
+        // not filled yet: the queue is empty
+        if (ready < 0)
+            return false;
+
+        // another CPU took it first, try the next one
+        if (ready > 0)
+        {
+            claimed = __atomic_load_n(&g_Claimed, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&g_Claimed, &claimed, claimed + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            // hand the slot back as soon as the work is copied out, whatever order the others finish in
+            smp_WorkFunction function = slot->Function;
+            void* argument = slot->Argument;
+            __atomic_store_n(&slot->Sequence, claimed + SMP_MAX_WORK, __ATOMIC_RELEASE);
+
+            function(argument);
+            __atomic_fetch_add(&g_Finished, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+static void __attribute__((cdecl)) smp_ApMain(uint32_t index)
+{
+    // same CPU state the BSP runs stage2 with
+    if (cpu_Has(CPU_FEATURE_SSE))
+        x86_EnableSSE();
+
+    g_ApicIds[index + 1] = smp_ApicRead(APIC_REG_ID) >> 24;
+
+    while (!__atomic_load_n(&g_Park, __ATOMIC_ACQUIRE))
+        if (!smp_RunOne())
+            smp_Pause();
+
+    __atomic_fetch_add(&g_Parked, 1, __ATOMIC_RELEASE);
+}
+
+// Finds the BSP's local APIC, returns false if there is none to send IPIs with
+static bool smp_DetectApic()
+{
+    uint32_t low, high;
+
+    if (g_ApicBase != 0)
+        return true;
+
+    if (!cpu_Has(CPU_FEATURE_APIC))
+        return false;
+
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(MSR_APIC_BASE));
+    if (!(low & MSR_APIC_BASE_ENABLE))
+        return false;
+
+    g_ApicBase = low & MSR_APIC_BASE_ADDRESS;
+    g_ApicIds[0] = smp_ApicRead(APIC_REG_ID) >> 24;
+    return true;
+}
+
+// The MP spec asks for 10 ms between INIT and the startup IPIs. The CPUs Linux
+// skips that wait on don't need it, they are ready for the SIPI right away.
+static uint32_t smp_InitDelay()
+{
+    uint32_t regs[4];
+
+    x86_CPUID(0, 0, regs);
+    uint32_t vendor = regs[1];
+    if (regs[0] < 1)
+        return SMP_INIT_DELAY;
+
+    x86_CPUID(1, 0, regs);
+    uint32_t family = (regs[0] >> 8) & 0xF;
+    if (family == 0xF)
+        family += (regs[0] >> 20) & 0xFF;
+
+    if ((vendor == CPUID_VENDOR_INTEL && family == 6)
+        || (vendor == CPUID_VENDOR_AMD && family >= 0xF)
+        || (vendor == CPUID_VENDOR_HYGON && family >= 0x18))
+        return 0;
+
+    return SMP_INIT_DELAY;
+}
+
+void smp_Start()
+{
+    if (g_Queueing || !smp_DetectApic())
+        return;
+
+    // only the CPUs the firmware lists as enabled are woken, the BSP is among them
+    uint8_t listed[BOOT_MAX_CPUS];
+    uint32_t count = min(acpi_FindProcessors(listed, BOOT_MAX_CPUS), BOOT_MAX_CPUS);
+    uint8_t apicIds[SMP_MAX_APS];
+    g_ApCount = 0;
+    for (uint32_t i = 0; i < count; i++)
+        if (listed[i] != g_ApicIds[0] && g_ApCount < SMP_MAX_APS)
+            apicIds[g_ApCount++] = listed[i];
+
+    if (g_ApCount == 0)
+        return;
+
+    for (uint32_t i = 0; i < SMP_MAX_WORK; i++)
+        g_Work[i].Sequence = i;
+
+    memcpy(SMP_TRAMPOLINE, smp_Trampoline, smp_TrampolineEnd - smp_Trampoline);
+
+    smp_TrampolineParamBlock* params = SMP_PARAMS;
+    __asm__ volatile("sgdt (%0)" : : "r"(params) : "memory");     // GdtLimit and GdtBase
+    params->JumpOffset = (uint32_t)SMP_TRAMPOLINE + SMP_TRAMPOLINE_OFFSET(smp_TrampolineProtectedMode);
+    params->JumpSelector = 0x08;
+    params->Entry = (uint32_t)smp_ApMain;
+    params->Stacks = (uint32_t)SMP_STACKS;
+    params->StackSize = SMP_STACK_SIZE;
+    params->MaxAps = SMP_MAX_APS;
+    params->Started = 0;
+
+    uint32_t vector = (uint32_t)SMP_TRAMPOLINE >> 12;
+    for (uint32_t i = 0; i < g_ApCount; i++)
+        if (!smp_SendIpi(apicIds[i], APIC_ICR_ASSERT | APIC_ICR_INIT))
+            return;
+
+    smp_Delay(smp_InitDelay());
+    for (int round = 0; round < 2; round++)
+    {
+        for (uint32_t i = 0; i < g_ApCount; i++)
+            if (!smp_SendIpi(apicIds[i], APIC_ICR_ASSERT | APIC_ICR_STARTUP | vector))
+                return;
+
+        g_Queueing = true;
+        smp_Delay(SMP_STARTUP_DELAY);
+    }
+}
+
+void smp_Submit(smp_WorkFunction function, void* argument)
+{
+    // until an AP is polling the queue the BSP is faster on its own
+    if (!g_Queueing || __atomic_load_n(&SMP_PARAMS->Started, __ATOMIC_ACQUIRE) == 0)
+    {
+        function(argument);
+        return;
+    }
+
+    // wait for the slot itself: the consumer of the previous lap may still hold it
+    // even though work submitted after it has finished
+    uint32_t submitted = g_Submitted;
+    smp_Work* slot = &g_Work[submitted % SMP_MAX_WORK];
+    while (__atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE) != submitted)
+        if (!smp_RunOne())
+            smp_Pause();
+
+    slot->Function = function;
+    slot->Argument = argument;
+    __atomic_store_n(&slot->Sequence, submitted + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_Submitted, submitted + 1, __ATOMIC_RELEASE);
+}
+
+void smp_Wait()
+{
+    while (__atomic_load_n(&g_Finished, __ATOMIC_ACQUIRE) != g_Submitted)
+        if (!smp_RunOne())
+            smp_Pause();
+}
+
+void smp_Park(BootSmp* smp)
+{
+    smp_Wait();
+
+    smp_DetectApic();
+    smp->CpuCount = 1;
+    smp->LocalApicBase = g_ApicBase;
+    smp->ParkStart = 0;
+    smp->ParkSize = 0;
+    smp->ApicIds[0] = g_ApicIds[0];
+    if (!g_Queueing)
+        return;
+
+    // nobody waited for the APs to arrive, the ones still on their way get the
+    // rest of the arrival window
+    for (uint32_t i = 0; i < SMP_ARRIVAL_DELAY && __atomic_load_n(&SMP_PARAMS->Started, __ATOMIC_ACQUIRE) < g_ApCount; i++)
+        smp_Delay(1);
+
+    __atomic_store_n(&g_Park, true, __ATOMIC_RELEASE);
+
+    uint32_t started = min(__atomic_load_n(&SMP_PARAMS->Started, __ATOMIC_ACQUIRE), SMP_MAX_APS);
+    while (__atomic_load_n(&g_Parked, __ATOMIC_ACQUIRE) < started)
+        smp_Pause();
+
+    smp->CpuCount = started + 1;
+    if (started == 0)
+        return;
+
+    printf("SMP: %lu application processors parked\r\n", started);
+
+    smp->ParkStart = (uint32_t)MEMORY_SMP_ADDR;
+    smp->ParkSize = MEMORY_SMP_SIZE;
+    for (uint32_t i = 1; i <= started; i++)
+        smp->ApicIds[i] = g_ApicIds[i];
+}
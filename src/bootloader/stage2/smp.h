@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <boot/bootparams.h>
+
+typedef void (*smp_WorkFunction)(void* argument);
+
+// Wakes the application processors the ACPI MADT lists with INIT-SIPI-SIPI.
+// It doesn't wait for them to arrive, so call it early and let their startup
+// overlap the disk reads. Without a local APIC or a MADT nothing is woken.
+void smp_Start();
+
+// Queues function(argument) for the next idle CPU. Until an AP has arrived, or
+// without APs, the BSP runs the work itself. Only the BSP may submit, and the
+// work must not call into the BIOS or print.
+void smp_Submit(smp_WorkFunction function, void* argument);
+
+// Helps with queued work until all of it is done
+void smp_Wait();
+
+// Finishes queued work, parks the APs, if they were started, and describes them in smp
+void smp_Park(BootSmp* smp);
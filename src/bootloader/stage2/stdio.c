@@ -1,8 +1,10 @@
 #include "stdio.h"
 #include "x86.h"
+#include "log.h"
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 const unsigned SCREEN_WIDTH = 80;
 const unsigned SCREEN_HEIGHT = 25;
@@ -155,18 +157,63 @@ void putcol(uint8_t c)
     setcursor(g_ScreenX, g_ScreenY);
 }
 
-void puts(const char *str)
+// printf formats straight into log records, long messages continue in the next one
+typedef struct
+{
+    LogRecord* Record;      // NULL once the ring was full, the rest is dropped
+    uint32_t Length;
+} printf_Output;
+
+static void printf_Begin(printf_Output* out)
+{
+    out->Record = log_Reserve();
+    out->Length = 0;
+}
+
+static void printf_End(printf_Output* out)
+{
+    if (out->Record != NULL)
+        log_Commit(out->Record, out->Length);
+
+    log_Drain();
+}
+
+static void printf_putc(printf_Output* out, char c)
+{
+    if (out->Record == NULL)
+        return;
+
+    if (out->Length == LOG_RECORD_TEXT_SIZE)
+    {
+        log_Commit(out->Record, out->Length);
+        printf_Begin(out);
+        if (out->Record == NULL)
+            return;
+    }
+
+    out->Record->Text[out->Length++] = c;
+}
+
+static void printf_puts(printf_Output* out, const char *str)
 {
     while (*str)
     {
-        putc(*str);
+        printf_putc(out, *str);
         str++;
     }
 }
 
+void puts(const char *str)
+{
+    printf_Output out;
+    printf_Begin(&out);
+    printf_puts(&out, str);
+    printf_End(&out);
+}
+
 const char g_HexChars[] = "0123456789abcdef";
 
-void printf_unsigned(unsigned long long number, int radix)
+void printf_unsigned(printf_Output* out, unsigned long long number, int radix)
 {
     char buffer[32];
     int pos = 0;
@@ -181,18 +228,18 @@ void printf_unsigned(unsigned long long number, int radix)
 
     // print number in reverse order
     while (--pos >= 0)
-        putc(buffer[pos]);
+        printf_putc(out, buffer[pos]);
 }
 
-void printf_signed(long long number, int radix)
+void printf_signed(printf_Output* out, long long number, int radix)
 {
     if (number < 0)
     {
-        putc('-');
-        printf_unsigned(-number, radix);
+        printf_putc(out, '-');
+        printf_unsigned(out, -number, radix);
     }
     else
-        printf_unsigned(number, radix);
+        printf_unsigned(out, number, radix);
 }
 
 #define PRINTF_STATE_NORMAL 0
@@ -211,7 +258,10 @@ void printf(const char *fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    
+
+    printf_Output out;
+    printf_Begin(&out);
+
     int state = PRINTF_STATE_NORMAL;
     int length = PRINTF_LENGTH_DEFAULT;
     int radix = 10;
@@ -229,7 +279,7 @@ void printf(const char *fmt, ...)
                 state = PRINTF_STATE_LENGTH;
                 break;
             default:
-                putc(*fmt);
+                printf_putc(&out, *fmt);
                 break;
             }
             break;
@@ -275,15 +325,15 @@ void printf(const char *fmt, ...)
             switch (*fmt)
             {
             case 'c':
-                putc((char)va_arg(args, int));
+                printf_putc(&out, (char)va_arg(args, int));
                 break;
 
             case 's':
-                puts(va_arg(args, const char *));
+                printf_puts(&out, va_arg(args, const char *));
                 break;
 
             case '%':
-                putc('%');
+                printf_putc(&out, '%');
                 break;
 
             case 'd':
@@ -326,15 +376,15 @@ void printf(const char *fmt, ...)
                     case PRINTF_LENGTH_SHORT_SHORT:
                     case PRINTF_LENGTH_SHORT:
                     case PRINTF_LENGTH_DEFAULT:
-                        printf_signed(va_arg(args, int), radix);
+                        printf_signed(&out, va_arg(args, int), radix);
                         break;
 
                     case PRINTF_LENGTH_LONG:
-                        printf_signed(va_arg(args, long), radix);
+                        printf_signed(&out, va_arg(args, long), radix);
                         break;
 
                     case PRINTF_LENGTH_LONG_LONG:
-                        printf_signed(va_arg(args, long long), radix);
+                        printf_signed(&out, va_arg(args, long long), radix);
                         break;
                     }
                 }
@@ -345,15 +395,15 @@ void printf(const char *fmt, ...)
                     case PRINTF_LENGTH_SHORT_SHORT:
                     case PRINTF_LENGTH_SHORT:
                     case PRINTF_LENGTH_DEFAULT:
-                        printf_unsigned(va_arg(args, unsigned int), radix);
+                        printf_unsigned(&out, va_arg(args, unsigned int), radix);
                         break;
 
                     case PRINTF_LENGTH_LONG:
-                        printf_unsigned(va_arg(args, unsigned long), radix);
+                        printf_unsigned(&out, va_arg(args, unsigned long), radix);
                         break;
 
                     case PRINTF_LENGTH_LONG_LONG:
-                        printf_unsigned(va_arg(args, unsigned long long), radix);
+                        printf_unsigned(&out, va_arg(args, unsigned long long), radix);
                         break;
                     }
                 }
@@ -370,6 +420,7 @@ void printf(const char *fmt, ...)
         fmt++;
     }
 
+    printf_End(&out);
     va_end(args);
 }
 
@@ -377,11 +428,14 @@ void print_buffer(const char *msg, const void *buffer, uint32_t count)
 {
     const uint8_t *u8Buffer = (const uint8_t *)buffer;
 
-    puts(msg);
+    printf_Output out;
+    printf_Begin(&out);
+    printf_puts(&out, msg);
     for (uint16_t i = 0; i < count; i++)
     {
-        putc(g_HexChars[u8Buffer[i] >> 4]);
-        putc(g_HexChars[u8Buffer[i] & 0xF]);
+        printf_putc(&out, g_HexChars[u8Buffer[i] >> 4]);
+        printf_putc(&out, g_HexChars[u8Buffer[i] & 0xF]);
     }
-    puts("\n");
+    printf_puts(&out, "\n");
+    printf_End(&out);
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
 
+// putc writes to the screen directly; puts, printf and print_buffer format into
+// the boot log (log.h) and drain it.
 void clrscr();
 void putc(char c);
 void puts(const char* str);
@@ -0,0 +1,442 @@
+#include "virtio.h"
+#include "pci.h"
+#include "x86.h"
+#include "stdio.h"
+#include "memory.h"
+#include "memdefs.h"
+#include "minmax.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE                 512
+
+#define VIRTIO_VENDOR_ID            0x1AF4
+#define VIRTIO_DEVICE_BLOCK         0x1001      // transitional device, has the legacy I/O interface
+#define VIRTIO_MAX_DEVICES          8
+
+#define VIRTIO_MAX_REQUESTS         32
+#define VIRTIO_MAX_INDIRECT         48          // descriptors per request: header, data..., status
+#define VIRTIO_MAX_REQUEST_SECTORS  4096        // 2 MiB
+#define VIRTIO_MAX_DESCRIPTOR_SIZE  0x400000
+#define VIRTIO_MAX_QUEUE_SIZE       1024
+#define VIRTIO_TIMEOUT              10000000    // polls without progress before giving up
+#define VIRTIO_BIOS_MAX_CYLINDERS   1024        // the BIOS geometry of larger disks is cut off here
+#define VIRTIO_GEOMETRY_SLACK       2           // cylinders a BIOS may leave out of its geometry
+
+// legacy I/O registers
+#define VIRTIO_REG_DEVICE_FEATURES  0x00
+#define VIRTIO_REG_GUEST_FEATURES   0x04
+#define VIRTIO_REG_QUEUE_ADDRESS    0x08
+#define VIRTIO_REG_QUEUE_SIZE       0x0C
+#define VIRTIO_REG_QUEUE_SELECT     0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY     0x10
+#define VIRTIO_REG_STATUS           0x12
+#define VIRTIO_REG_CONFIG           0x14        // without MSI-X
+#define VIRTIO_BLK_CONFIG_CAPACITY  (VIRTIO_REG_CONFIG + 0)
+#define VIRTIO_BLK_CONFIG_SIZE_MAX  (VIRTIO_REG_CONFIG + 8)
+#define VIRTIO_BLK_CONFIG_SEG_MAX   (VIRTIO_REG_CONFIG + 12)
+
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+#define VIRTIO_BLK_F_SIZE_MAX       (1 << 1)
+#define VIRTIO_BLK_F_SEG_MAX        (1 << 2)
+#define VIRTIO_RING_F_INDIRECT_DESC (1 << 28)
+
+#define VIRTQ_DESC_F_NEXT           1
+#define VIRTQ_DESC_F_WRITE          2
+#define VIRTQ_DESC_F_INDIRECT       4
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+#define VIRTQ_ALIGN                 4096
+
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_S_OK             0
+
+typedef struct
+{
+    uint64_t Address;
+    uint32_t Length;
+    uint16_t Flags;
+    uint16_t Next;
+} __attribute__((packed)) virtq_Descriptor;
+
+typedef volatile struct
+{
+    uint16_t Flags;
+    uint16_t Index;
+    uint16_t Ring[];
+} __attribute__((packed)) virtq_Available;
+
+typedef volatile struct
+{
+    uint16_t Flags;
+    uint16_t Index;
+    struct
+    {
+        uint32_t Id;
+        uint32_t Length;
+    } __attribute__((packed)) Ring[];
+} __attribute__((packed)) virtq_Used;
+
+typedef struct
+{
+    uint32_t Type;
+    uint32_t _Reserved;
+    uint64_t Sector;
+} __attribute__((packed)) virtio_BlockRequest;
+
+typedef struct
+{
+    virtq_Descriptor Descriptors[VIRTIO_MAX_INDIRECT];
+} virtio_IndirectTable;
+
+// the sectors a request covers, starting at Done sectors into Segment
+typedef struct
+{
+    int Segment;
+    uint32_t Done;
+    uint32_t Sectors;
+} virtio_Request;
+
+typedef struct
+{
+    uint16_t IoBase;
+    uint16_t QueueSize;
+    uint16_t LastUsed;
+    int MaxData;                    // data descriptors per request
+    uint32_t MaxDescriptorSize;
+    virtq_Descriptor* Descriptors;
+    virtq_Available* Available;
+    virtq_Used* Used;
+} virtio_Device;
+
+// 0x0000 - virtqueue, 0x8000 - indirect tables, 0xE000 - request headers, 0xE200 - status bytes, 0xE400 - scratch sector
+#define VIRTIO_QUEUE                ((uint8_t*)MEMORY_VIRTIO_ADDR)
+#define VIRTIO_INDIRECT_TABLES      ((virtio_IndirectTable*)((uint8_t*)MEMORY_VIRTIO_ADDR + 0x8000))
+#define VIRTIO_REQUEST_HEADERS      ((virtio_BlockRequest*)((uint8_t*)MEMORY_VIRTIO_ADDR + 0xE000))
+#define VIRTIO_STATUS               ((volatile uint8_t*)MEMORY_VIRTIO_ADDR + 0xE200)
+#define VIRTIO_SCRATCH              ((uint8_t*)MEMORY_VIRTIO_ADDR + 0xE400)
+
+// keeps the compiler from moving ring writes past the notify, or buffer reads before completion
+#define virtio_Barrier()            __asm__ volatile("" ::: "memory")
+
+static virtio_Device g_Device;
+static int g_DeviceIndex = -1;
+
+static uint32_t virtio_Align(uint32_t value)
+{
+    return (value + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+}
+
+static bool virtio_Setup(pci_Address address, int index)
+{
+    uint32_t command = pci_ConfigRead(address, PCI_REG_COMMAND) & 0xFFFF;
+    pci_ConfigWrite(address, PCI_REG_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    virtio_Device* device = &g_Device;
+    device->IoBase = pci_ConfigRead(address, PCI_REG_BAR0) & 0xFFFC;
+
+    // reset, then take the device over from the BIOS
+    x86_outb(device->IoBase + VIRTIO_REG_STATUS, 0);
+    x86_outb(device->IoBase + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    x86_outb(device->IoBase + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = x86_inl(device->IoBase + VIRTIO_REG_DEVICE_FEATURES);
+    if (!(features & VIRTIO_RING_F_INDIRECT_DESC))
+    {
+        printf("VIRTIO: device %d has no indirect descriptors\r\n", index);
+        x86_outb(device->IoBase + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    x86_outl(device->IoBase + VIRTIO_REG_GUEST_FEATURES, features & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX));
+
+    device->MaxData = VIRTIO_MAX_INDIRECT - 2;
+    if (features & VIRTIO_BLK_F_SEG_MAX)
+        device->MaxData = max(1, min(device->MaxData, (int)x86_inl(device->IoBase + VIRTIO_BLK_CONFIG_SEG_MAX)));
+
+    device->MaxDescriptorSize = VIRTIO_MAX_DESCRIPTOR_SIZE;
+    if (features & VIRTIO_BLK_F_SIZE_MAX)
+        device->MaxDescriptorSize = max(SECTOR_SIZE, min(device->MaxDescriptorSize, x86_inl(device->IoBase + VIRTIO_BLK_CONFIG_SIZE_MAX) & ~(SECTOR_SIZE - 1)));
+
+    x86_outw(device->IoBase + VIRTIO_REG_QUEUE_SELECT, 0);
+    device->QueueSize = x86_inw(device->IoBase + VIRTIO_REG_QUEUE_SIZE);
+    if (device->QueueSize == 0 || device->QueueSize > VIRTIO_MAX_QUEUE_SIZE)
+    {
+        printf("VIRTIO: unsupported queue size %u\r\n", device->QueueSize);
+        x86_outb(device->IoBase + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    // legacy layout: descriptors, available ring, then the used ring on the next page
+    uint32_t usedOffset = virtio_Align(sizeof(virtq_Descriptor) * device->QueueSize + sizeof(uint16_t) * (3 + device->QueueSize));
+    memset(VIRTIO_QUEUE, 0, usedOffset + virtio_Align(sizeof(uint16_t) * 3 + 8 * device->QueueSize));
+    device->Descriptors = (virtq_Descriptor*)VIRTIO_QUEUE;
+    device->Available = (virtq_Available*)(VIRTIO_QUEUE + sizeof(virtq_Descriptor) * device->QueueSize);
+    device->Used = (virtq_Used*)(VIRTIO_QUEUE + usedOffset);
+    device->LastUsed = 0;
+
+    // no interrupts, completion is polled
+    device->Available->Flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+    x86_outl(device->IoBase + VIRTIO_REG_QUEUE_ADDRESS, (uint32_t)VIRTIO_QUEUE / VIRTQ_ALIGN);
+    x86_outb(device->IoBase + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    return true;
+}
+
+// Fills ring descriptor (and indirect table) number slot with the next request from segments[*i], *done sectors in
+static void virtio_BuildRead(int slot, disk_Segment* segments, int count, int* i, uint32_t* done, virtio_Request* request)
+{
+    virtio_Device* device = &g_Device;
+    virtq_Descriptor* table = VIRTIO_INDIRECT_TABLES[slot].Descriptors;
+    virtio_BlockRequest* header = &VIRTIO_REQUEST_HEADERS[slot];
+    uint32_t lba = segments[*i].Lba + *done;
+    uint32_t sectors = 0;
+    int entries = 1;
+    uint8_t* dataEnd = NULL;
+
+    request->Segment = *i;
+    request->Done = *done;
+
+    header->Type = VIRTIO_BLK_T_IN;
+    header->_Reserved = 0;
+    header->Sector = lba;
+    table[0].Address = (uint32_t)header;
+    table[0].Length = sizeof(virtio_BlockRequest);
+    table[0].Flags = VIRTQ_DESC_F_NEXT;
+    table[0].Next = 1;
+
+    while (*i < count && sectors < VIRTIO_MAX_REQUEST_SECTORS)
+    {
+        if (*done >= segments[*i].Count)
+        {
+            (*i)++;
+            *done = 0;
+            continue;
+        }
+
+        if (segments[*i].Lba + *done != lba + sectors)
+            break;
+
+        uint8_t* destination = (uint8_t*)segments[*i].Destination + *done * SECTOR_SIZE;
+        virtq_Descriptor* last = &table[entries - 1];
+
+        // grow the previous data descriptor while memory continues, otherwise start a new one
+        uint32_t take;
+        if (destination == dataEnd && last->Length < device->MaxDescriptorSize)
+        {
+            take = min(segments[*i].Count - *done, VIRTIO_MAX_REQUEST_SECTORS - sectors);
+            take = min(take, (device->MaxDescriptorSize - last->Length) / SECTOR_SIZE);
+            last->Length += take * SECTOR_SIZE;
+        }
+        else if (entries - 1 < device->MaxData)
+        {
+            take = min(segments[*i].Count - *done, VIRTIO_MAX_REQUEST_SECTORS - sectors);
+            take = min(take, device->MaxDescriptorSize / SECTOR_SIZE);
+
+            last = &table[entries];
+            last->Address = (uint32_t)destination;
+            last->Length = take * SECTOR_SIZE;
+            last->Flags = VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_NEXT;
+            last->Next = entries + 1;
+            entries++;
+        }
+        else
+        {
+            break;
+        }
+
+        dataEnd = destination + take * SECTOR_SIZE;
+        sectors += take;
+        *done += take;
+    }
+
+    VIRTIO_STATUS[slot] = 0xFF;
+    table[entries].Address = (uint32_t)&VIRTIO_STATUS[slot];
+    table[entries].Length = 1;
+    table[entries].Flags = VIRTQ_DESC_F_WRITE;
+    table[entries].Next = 0;
+    entries++;
+
+    request->Sectors = sectors;
+
+    virtq_Descriptor* descriptor = &device->Descriptors[slot];
+    descriptor->Address = (uint32_t)table;
+    descriptor->Length = entries * sizeof(virtq_Descriptor);
+    descriptor->Flags = VIRTQ_DESC_F_INDIRECT;
+    descriptor->Next = 0;
+}
+
+static void virtio_Complete(disk_Segment* segments, const virtio_Request* request)
+{
+    int i = request->Segment;
+    uint32_t done = request->Done;
+    uint32_t left = request->Sectors;
+
+    while (left > 0)
+    {
+        if (done >= segments[i].Count)
+        {
+            i++;
+            done = 0;
+            continue;
+        }
+
+        uint32_t take = min(segments[i].Count - done, left);
+        segments[i].Completed += take;
+        done += take;
+        left -= take;
+    }
+}
+
+bool virtio_ReadVectored(int deviceIndex, disk_Segment* segments, int count)
+{
+    virtio_Device* device = &g_Device;
+    virtio_Request requests[VIRTIO_MAX_REQUESTS];
+    int slots = min(VIRTIO_MAX_REQUESTS, device->QueueSize);
+
+    if (deviceIndex != g_DeviceIndex)
+        return false;
+
+    for (int k = 0; k < count; k++)
+        segments[k].Completed = 0;
+
+    bool ok = true;
+    int i = 0;
+    uint32_t done = 0;
+    uint32_t busy = 0;
+    int inFlight = 0;
+    uint32_t spins = 0;
+
+    while (i < count || busy != 0)
+    {
+        // queue as many requests as there are free slots, then notify once for all of them
+        int queued = 0;
+        while (inFlight < slots)
+        {
+            while (i < count && done >= segments[i].Count)
+            {
+                i++;
+                done = 0;
+            }
+
+            if (i >= count)
+                break;
+
+            int slot = 0;
+            while (busy & (1u << slot))
+                slot++;
+
+            virtio_BuildRead(slot, segments, count, &i, &done, &requests[slot]);
+            device->Available->Ring[(device->Available->Index + queued) % device->QueueSize] = slot;
+
+            busy |= 1u << slot;
+            inFlight++;
+            queued++;
+        }
+
+        if (queued > 0)
+        {
+            virtio_Barrier();
+            device->Available->Index += queued;
+            virtio_Barrier();
+            x86_outw(device->IoBase + VIRTIO_REG_QUEUE_NOTIFY, 0);
+        }
+
+        if (device->Used->Index == device->LastUsed)
+        {
+            if (++spins > VIRTIO_TIMEOUT)
+            {
+                printf("VIRTIO: read timed out\r\n");
+                ok = false;
+                break;
+            }
+            continue;
+        }
+
+        virtio_Barrier();
+        spins = 0;
+        while (device->Used->Index != device->LastUsed)
+        {
+            int slot = device->Used->Ring[device->LastUsed % device->QueueSize].Id;
+            device->LastUsed++;
+
+            if (VIRTIO_STATUS[slot] == VIRTIO_BLK_S_OK)
+                virtio_Complete(segments, &requests[slot]);
+            else
+                ok = false;
+
+            busy &= ~(1u << slot);
+            inFlight--;
+        }
+
+        if (!ok)
+        {
+            printf("VIRTIO: read error\r\n");
+            break;
+        }
+    }
+
+    // requests still out after an error would complete into memory that gets reused, so drain them
+    for (spins = 0; busy != 0 && spins < VIRTIO_TIMEOUT; spins++)
+    {
+        while (device->Used->Index != device->LastUsed)
+        {
+            busy &= ~(1u << device->Used->Ring[device->LastUsed % device->QueueSize].Id);
+            device->LastUsed++;
+        }
+    }
+
+    return ok;
+}
+
+// Whether the device could be the disk the BIOS describes, from registers that can
+// be read without disturbing the BIOS's own use of it
+static bool virtio_MatchesGeometry(pci_Address address, const DISK* disk)
+{
+    // the BIOS enables I/O decoding on every device it drives
+    if (!(pci_ConfigRead(address, PCI_REG_COMMAND) & PCI_COMMAND_IO))
+        return false;
+
+    uint16_t ioBase = pci_ConfigRead(address, PCI_REG_BAR0) & 0xFFFC;
+    uint64_t capacity = x86_inl(ioBase + VIRTIO_BLK_CONFIG_CAPACITY)
+                      | (uint64_t)x86_inl(ioBase + VIRTIO_BLK_CONFIG_CAPACITY + 4) << 32;
+
+    uint32_t cylinderSectors = (uint32_t)disk->heads * disk->sectors;
+    uint64_t geometrySectors = (uint64_t)disk->cylinders * cylinderSectors;
+    if (capacity < geometrySectors)
+        return false;
+
+    return disk->cylinders >= VIRTIO_BIOS_MAX_CYLINDERS
+        || capacity < geometrySectors + VIRTIO_GEOMETRY_SLACK * cylinderSectors;
+}
+
+int virtio_FindDisk(const DISK* disk, const void* firstSector)
+{
+    pci_Address address;
+    for (int index = 0; index < VIRTIO_MAX_DEVICES && pci_FindDevice(VIRTIO_VENDOR_ID, VIRTIO_DEVICE_BLOCK, index, &address); index++)
+    {
+        // setting a device up resets it under the BIOS, only do that to likely candidates
+        if (!virtio_MatchesGeometry(address, disk))
+            continue;
+
+        if (!virtio_Setup(address, index))
+            continue;
+
+        g_DeviceIndex = index;
+
+        disk_Segment segment = { 0, 1, VIRTIO_SCRATCH, 0 };
+        if (virtio_ReadVectored(index, &segment, 1) && memcmp(VIRTIO_SCRATCH, firstSector, SECTOR_SIZE) == 0)
+        {
+            printf("VIRTIO: boot disk is device %d, queue size %u\r\n", index, g_Device.QueueSize);
+            return index;
+        }
+
+        // same size but not ours, it can't be handed back to the BIOS; leave it stopped
+        x86_outb(g_Device.IoBase + VIRTIO_REG_STATUS, 0);
+        g_DeviceIndex = -1;
+    }
+
+    return -1;
+}
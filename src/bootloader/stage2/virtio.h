@@ -0,0 +1,16 @@
+#pragma once
+#include "disk.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Returns the virtio-blk device holding the BIOS disk, or -1. Devices whose capacity
+// doesn't fit the disk's BIOS geometry are left alone; the others are set up in turn
+// and checked for the given first sector. The chosen device stays owned by stage2,
+// the BIOS can't use it anymore (the kernel has to reset it before setting up its
+// own queues).
+int virtio_FindDisk(const DISK* disk, const void* firstSector);
+
+// Reads the segments straight into their destinations. Each request is one indirect
+// descriptor chain covering a run of disk-adjacent segments; requests are queued in
+// batches with a single notification and completion is polled on the used ring.
+bool virtio_ReadVectored(int device, disk_Segment* segments, int count);
@@ -81,6 +81,37 @@ x86_inb:
     in al, dx
     ret
 
+global x86_outw
+x86_outw:
+    [bits 32]
+    mov dx, [esp + 4]
+    mov ax, [esp + 8]
+    out dx, ax
+    ret
+
+global x86_inw
+x86_inw:
+    [bits 32]
+    mov dx, [esp + 4]
+    xor eax, eax
+    in ax, dx
+    ret
+
+global x86_outl
+x86_outl:
+    [bits 32]
+    mov dx, [esp + 4]
+    mov eax, [esp + 8]
+    out dx, eax
+    ret
+
+global x86_inl
+x86_inl:
+    [bits 32]
+    mov dx, [esp + 4]
+    in eax, dx
+    ret
+
 
 global x86_Disk_GetDriveParams
 x86_Disk_GetDriveParams:
@@ -245,3 +276,327 @@ x86_Disk_Read:
     mov esp, ebp
     pop ebp
     ret
+
+
+;
+; INT 13h extensions (LBA)
+;
+
+global x86_Disk_ExtensionsPresent
+x86_Disk_ExtensionsPresent:
+    [bits 32]
+
+    ; make new call frame
+    push ebp             ; save old call frame
+    mov ebp, esp         ; initialize new call frame
+
+    x86_EnterRealMode
+
+    [bits 16]
+
+    ; save modified regs
+    push ebx
+
+    mov ah, 41h
+    mov bx, 55AAh
+    mov dl, [bp + 8]    ; dl - drive
+    stc
+    int 13h
+
+    ; present if there's no carry, the signature is swapped and packet access (bit 0) is supported
+    mov eax, 0
+    jc .done
+    cmp bx, 0AA55h
+    jne .done
+    and cx, 1
+    mov ax, cx
+
+.done:
+    ; restore regs
+    pop ebx
+
+    push eax
+
+    x86_EnterProtectedMode
+
+    [bits 32]
+
+    pop eax
+
+    ; restore old call frame
+    mov esp, ebp
+    pop ebp
+    ret
+
+
+global x86_Disk_ExtendedRead
+x86_Disk_ExtendedRead:
+    [bits 32]
+
+    ; make new call frame
+    push ebp             ; save old call frame
+    mov ebp, esp         ; initialize new call frame
+
+    x86_EnterRealMode
+
+    [bits 16]
+
+    ; save modified regs
+    push esi
+    push es
+
+    ; disk address packet on the stack (ds = ss = 0)
+    push dword 0                ; lba, upper half
+    push dword [bp + 12]        ; lba, lower half
+    LinearToSegOffset [bp + 20], es, eax, ax
+    push es                     ; buffer segment
+    push ax                     ; buffer offset
+    push word [bp + 16]         ; count
+    push word 10h               ; packet size
+    mov si, sp
+
+    mov ah, 42h
+    mov dl, [bp + 8]    ; dl - drive
+    stc
+    int 13h
+
+    ; set return value
+    mov eax, 1
+    sbb eax, 0           ; 1 on success, 0 on fail
+
+    add sp, 16
+
+    ; restore regs
+    pop es
+    pop esi
+
+    push eax
+
+    x86_EnterProtectedMode
+
+    [bits 32]
+
+    pop eax
+
+    ; restore old call frame
+    mov esp, ebp
+    pop ebp
+    ret
+
+
+;
+; Keyboard
+;
+
+global x86_Keyboard_Poll
+x86_Keyboard_Poll:
+    [bits 32]
+
+    ; make new call frame
+    push ebp             ; save old call frame
+    mov ebp, esp         ; initialize new call frame
+
+    x86_EnterRealMode
+
+    [bits 16]
+
+    ; zero flag set - no key waiting
+    mov ah, 01h
+    int 16h
+    mov eax, 0
+    jz .done
+
+    ; take it out of the buffer
+    mov ah, 00h
+    int 16h
+    and eax, 0FFFFh     ; scan code, ASCII
+
+.done:
+    push eax
+
+    x86_EnterProtectedMode
+
+    [bits 32]
+
+    pop eax
+
+    ; restore old call frame
+    mov esp, ebp
+    pop ebp
+    ret
+
+
+;
+; BIOS memory map
+;
+
+E820Signature   equ 0x534D4150
+
+global x86_E820GetNextBlock
+x86_E820GetNextBlock:
+    [bits 32]
+
+    ; make new call frame
+    push ebp             ; save old call frame
+    mov ebp, esp         ; initialize new call frame
+
+    x86_EnterRealMode
+
+    [bits 16]
+
+    ; save modified regs
+    push ebx
+    push esi
+    push edi
+    push ds
+    push es
+
+    ; es:di - block
+    LinearToSegOffset [bp + 8], es, edi, di
+
+    ; ebx - continuation id, from ds:si
+    LinearToSegOffset [bp + 12], ds, esi, si
+    mov ebx, [si]
+
+    mov eax, 0E820h
+    mov edx, E820Signature
+    mov ecx, 24         ; size of the block, BIOSes without ACPI 3.0 fill only 20 bytes
+    stc
+    int 15h
+
+    ; carry or a missing signature means there are no (more) entries
+    jc .error
+    cmp eax, E820Signature
+    jne .error
+
+    mov [si], ebx       ; continuation id, 0 after the last entry
+    mov eax, ecx        ; bytes filled in
+    jmp .done
+
+.error:
+    mov eax, -1
+
+.done:
+    ; restore regs
+    pop es
+    pop ds
+    pop edi
+    pop esi
+    pop ebx
+
+    push eax
+
+    x86_EnterProtectedMode
+
+    [bits 32]
+
+    pop eax
+
+    ; restore old call frame
+    mov esp, ebp
+    pop ebp
+    ret
+
+
+;
+; CPU feature detection
+;
+
+global x86_CPUID_Supported
+x86_CPUID_Supported:
+    [bits 32]
+
+    ; CPUID exists if the ID flag (bit 21) in EFLAGS can be toggled
+    pushfd
+    pop eax
+    mov ecx, eax
+    xor eax, 1 << 21
+    push eax
+    popfd
+    pushfd
+    pop eax
+
+    push ecx            ; restore original flags
+    popfd
+
+    xor eax, ecx
+    shr eax, 21
+    and eax, 1          ; 1 if supported, 0 otherwise
+    ret
+
+
+global x86_CPUID
+x86_CPUID:
+    [bits 32]
+
+    ; make new call frame
+    push ebp             ; save old call frame
+    mov ebp, esp         ; initialize new call frame
+
+    ; save modified regs
+    push ebx
+    push edi
+
+    mov eax, [ebp + 8]   ; eax - leaf
+    mov ecx, [ebp + 12]  ; ecx - subleaf
+    cpuid
+
+    mov edi, [ebp + 16]  ; regsOut - eax, ebx, ecx, edx
+    mov [edi], eax
+    mov [edi + 4], ebx
+    mov [edi + 8], ecx
+    mov [edi + 12], edx
+
+    ; restore regs
+    pop edi
+    pop ebx
+
+    ; restore old call frame
+    mov esp, ebp
+    pop ebp
+    ret
+
+
+global x86_EnableSSE
+x86_EnableSSE:
+    [bits 32]
+
+    mov eax, cr0
+    and eax, ~(1 << 2)   ; clear EM - no x87 emulation
+    or eax, 1 << 1       ; set MP - monitor coprocessor
+    mov cr0, eax
+
+    mov eax, cr4
+    or eax, 3 << 9       ; set OSFXSR and OSXMMEXCPT
+    mov cr4, eax
+
+    fninit
+    ret
+
+
+global x86_EnablePaging
+x86_EnablePaging:
+    [bits 32]
+
+    ; make new call frame
+    push ebp             ; save old call frame
+    mov ebp, esp         ; initialize new call frame
+
+    mov eax, [ebp + 8]   ; page directory or PDPT
+    mov cr3, eax
+
+    ; large page / PAE support has to be on before paging is
+    mov eax, cr4
+    or eax, [ebp + 12]
+    mov cr4, eax
+
+    mov eax, cr0
+    or eax, 0x80000000   ; PG
+    mov cr0, eax
+    jmp .paged
+
+.paged:
+    ; restore old call frame
+    mov esp, ebp
+    pop ebp
+    ret
@@ -4,6 +4,10 @@
 
 void __attribute__((cdecl)) x86_outb(uint16_t port, uint8_t value);
 uint8_t __attribute__((cdecl)) x86_inb(uint16_t port);
+void __attribute__((cdecl)) x86_outw(uint16_t port, uint16_t value);
+uint16_t __attribute__((cdecl)) x86_inw(uint16_t port);
+void __attribute__((cdecl)) x86_outl(uint16_t port, uint32_t value);
+uint32_t __attribute__((cdecl)) x86_inl(uint16_t port);
 
 bool __attribute__((cdecl)) x86_Disk_GetDriveParams(uint8_t drive,
                                                     uint8_t* driveTypeOut,
@@ -20,4 +24,29 @@ bool __attribute__((cdecl)) x86_Disk_Read(uint8_t drive,
                                           uint8_t count,
                                           void* lowerDataOut);
 
-bool __attribute__((cdecl)) x86_Video_GetVbeInfo(void* infoOut);
\ No newline at end of file
+// INT 13h extensions: packet reads by LBA, up to 127 sectors at a time
+bool __attribute__((cdecl)) x86_Disk_ExtensionsPresent(uint8_t drive);
+bool __attribute__((cdecl)) x86_Disk_ExtendedRead(uint8_t drive, uint32_t lba, uint16_t count, void* lowerDataOut);
+
+typedef struct
+{
+    uint64_t Base;
+    uint64_t Length;
+    uint32_t Type;
+    uint32_t Acpi;      // ACPI 3.0 extended attributes, bit 0 clear means ignore the entry
+} __attribute__((packed)) x86_E820Block;
+
+// Returns the number of bytes the BIOS filled in, or -1 once there are no more
+// entries. continuationId starts at 0 and is 0 again after the last entry.
+int __attribute__((cdecl)) x86_E820GetNextBlock(x86_E820Block* blockOut, uint32_t* continuationId);
+
+// Returns the next key from the BIOS keyboard buffer (scan code << 8 | ASCII),
+// or 0 if none is waiting
+uint16_t __attribute__((cdecl)) x86_Keyboard_Poll();
+
+bool __attribute__((cdecl)) x86_Video_GetVbeInfo(void* infoOut);
+
+bool __attribute__((cdecl)) x86_CPUID_Supported();
+void __attribute__((cdecl)) x86_CPUID(uint32_t leaf, uint32_t subleaf, uint32_t* regsOut);
+void __attribute__((cdecl)) x86_EnableSSE();
+void __attribute__((cdecl)) x86_EnablePaging(uint32_t cr3, uint32_t cr4Flags);
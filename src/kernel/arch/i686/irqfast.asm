@@ -0,0 +1,48 @@
+[bits 32]
+
+%define IRQFAST_COUNT 16
+
+extern g_IrqFastHandlers
+extern irqfast_Complete
+
+section .text
+
+; One stub per PIC IRQ:
+;   save the caller-saved registers and the entry time stamp
+;   call g_IrqFastHandlers[irq](irq)
+;   irqfast_Complete(irq, entry) sends the EOI and records the latency
+; The handler owns its argument slot, so irq is stored again before the second call.
+%assign i 0
+%rep IRQFAST_COUNT
+irqfast_Stub %+ i:
+    push eax
+    push ecx
+    push edx
+    cld
+
+    rdtsc
+    push edx
+    push eax
+
+    push i
+    call [g_IrqFastHandlers + 4 * i]
+    mov dword [esp], i
+    call irqfast_Complete
+
+    add esp, 12
+    pop edx
+    pop ecx
+    pop eax
+    iret
+%assign i i + 1
+%endrep
+
+section .rodata
+
+global g_IrqFastStubs
+g_IrqFastStubs:
+%assign i 0
+%rep IRQFAST_COUNT
+    dd irqfast_Stub %+ i
+%assign i i + 1
+%endrep
@@ -0,0 +1,130 @@
+#include "irqfast.h"
+#include <stddef.h>
+
+#define PIC1_COMMAND            0x20
+#define PIC2_COMMAND            0xA0
+#define PIC_EOI                 0x20
+#define PIC_READ_ISR            0x0B        // OCW3, the next read of the command port returns the ISR
+#define PIC_CASCADE_IRQ         2
+
+// IRQ 7 and 15 are also what the PICs report when a request went away before
+// the CPU acknowledged it; the in-service bit tells them apart
+#define IRQFAST_SPURIOUS_MASTER 7
+#define IRQFAST_SPURIOUS_SLAVE  15
+
+extern void* const g_IrqFastStubs[IRQFAST_COUNT];
+
+static void irqfast_Ignore(uint32_t irq) { }
+static void irqfast_Filter(uint32_t irq);
+
+// called by the stubs, so not static
+irqfast_Handler g_IrqFastHandlers[IRQFAST_COUNT] = {
+    [0 ... IRQFAST_SPURIOUS_MASTER - 1] = irqfast_Ignore,
+    [IRQFAST_SPURIOUS_MASTER] = irqfast_Filter,
+    [IRQFAST_SPURIOUS_MASTER + 1 ... IRQFAST_SPURIOUS_SLAVE - 1] = irqfast_Ignore,
+    [IRQFAST_SPURIOUS_SLAVE] = irqfast_Filter,
+};
+static irqfast_Handler g_SpuriousHandlers[IRQFAST_COUNT];
+
+static irqfast_Stats g_Stats[IRQFAST_COUNT];
+
+static inline void irqfast_Outb(uint16_t port, uint8_t value)
+{
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t irqfast_Inb(uint16_t port)
+{
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline uint64_t irqfast_Rdtsc()
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static bool irqfast_InService(uint32_t irq)
+{
+    uint16_t port = irq < 8 ? PIC1_COMMAND : PIC2_COMMAND;
+    irqfast_Outb(port, PIC_READ_ISR);
+    return (irqfast_Inb(port) >> (irq % 8)) & 1;
+}
+
+static void irqfast_Filter(uint32_t irq)
+{
+    if (irqfast_InService(irq) && g_SpuriousHandlers[irq] != NULL)
+        g_SpuriousHandlers[irq](irq);
+}
+
+void irqfast_Complete(uint32_t irq, uint64_t entry)
+{
+    irqfast_Stats* stats = &g_Stats[irq];
+
+    // a spurious IRQ 15 still went through the master's cascade input
+    if ((irq == IRQFAST_SPURIOUS_MASTER || irq == IRQFAST_SPURIOUS_SLAVE) && !irqfast_InService(irq))
+    {
+        if (irq == IRQFAST_SPURIOUS_SLAVE)
+            irqfast_Outb(PIC1_COMMAND, PIC_EOI);
+        __atomic_fetch_add(&stats->Spurious, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (irq >= 8)
+        irqfast_Outb(PIC2_COMMAND, PIC_EOI);
+    irqfast_Outb(PIC1_COMMAND, PIC_EOI);
+
+    uint64_t elapsed = irqfast_Rdtsc() - entry;
+    uint32_t cycles = elapsed > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)elapsed;
+    uint32_t bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+
+    __atomic_fetch_add(&stats->Count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->Buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    uint32_t max = __atomic_load_n(&stats->MaxCycles, __ATOMIC_RELAXED);
+    while (cycles > max && !__atomic_compare_exchange_n(&stats->MaxCycles, &max, cycles, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void* irqfast_GetStub(uint32_t irq)
+{
+    return irq < IRQFAST_COUNT ? g_IrqFastStubs[irq] : NULL;
+}
+
+void irqfast_Register(uint32_t irq, irqfast_Handler handler)
+{
+    if (irq >= IRQFAST_COUNT || irq == PIC_CASCADE_IRQ)
+        return;
+
+    if (irq == IRQFAST_SPURIOUS_MASTER || irq == IRQFAST_SPURIOUS_SLAVE)
+        __atomic_store_n(&g_SpuriousHandlers[irq], handler, __ATOMIC_RELEASE);
+    else
+        __atomic_store_n(&g_IrqFastHandlers[irq], handler != NULL ? handler : irqfast_Ignore, __ATOMIC_RELEASE);
+}
+
+void irqfast_GetStats(uint32_t irq, irqfast_Stats* stats)
+{
+    if (irq >= IRQFAST_COUNT)
+        return;
+
+    stats->Count = __atomic_load_n(&g_Stats[irq].Count, __ATOMIC_RELAXED);
+    stats->Spurious = __atomic_load_n(&g_Stats[irq].Spurious, __ATOMIC_RELAXED);
+    stats->MaxCycles = __atomic_load_n(&g_Stats[irq].MaxCycles, __ATOMIC_RELAXED);
+    for (int i = 0; i < IRQFAST_BUCKETS; i++)
+        stats->Buckets[i] = __atomic_load_n(&g_Stats[irq].Buckets[i], __ATOMIC_RELAXED);
+}
+
+void irqfast_ResetStats(uint32_t irq)
+{
+    if (irq >= IRQFAST_COUNT)
+        return;
+
+    __atomic_store_n(&g_Stats[irq].Count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_Stats[irq].Spurious, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_Stats[irq].MaxCycles, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < IRQFAST_BUCKETS; i++)
+        __atomic_store_n(&g_Stats[irq].Buckets[i], 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Fast path for hot 8259 PIC interrupts, next to the generated ISR stubs. The
+// stub for an IRQ saves only the registers a C function may clobber (EAX, ECX,
+// EDX), calls the handler straight out of a per-IRQ table and sends the EOI
+// itself. It leaves segment registers alone, the kernel has no user mode to come
+// back from, and it doesn't save FPU/SSE state, so handlers must not use it.
+//
+// Every IRQ counts how long it took from the stub's entry to the EOI in TSC
+// cycles, as a histogram of powers of two.
+
+#define IRQFAST_COUNT           16
+#define IRQFAST_BUCKETS         32          // bucket i: 2^i to 2^(i+1) - 1 cycles
+
+typedef void (*irqfast_Handler)(uint32_t irq);
+
+typedef struct
+{
+    uint32_t Count;             // handled, spurious interrupts aren't
+    uint32_t Spurious;
+    uint32_t MaxCycles;
+    uint32_t Buckets[IRQFAST_BUCKETS];
+} irqfast_Stats;
+
+// Address of the stub to put into the IDT for irq, with the PIC's base vector
+// wherever the kernel remapped it
+void* irqfast_GetStub(uint32_t irq);
+
+// Runs with interrupts off; the stub sends the EOI after it returns. Pass NULL to
+// go back to only acknowledging the IRQ.
+void irqfast_Register(uint32_t irq, irqfast_Handler handler);
+
+// Counters since boot, or since the last reset; any CPU may read them while
+// interrupts keep coming
+void irqfast_GetStats(uint32_t irq, irqfast_Stats* stats);
+void irqfast_ResetStats(uint32_t irq);
@@ -0,0 +1,177 @@
+#include "profiler.h"
+
+#define PIT_FREQUENCY           1193182
+#define PIT_PORT_CHANNEL0       0x40
+#define PIT_PORT_COMMAND        0x43
+#define PIT_COMMAND_RATE0       0x34        // channel 0, low then high byte, mode 2
+
+// COM1, as stage2 set it up
+#define SERIAL_PORT             0x3F8
+#define SERIAL_REG_LSR          5
+#define SERIAL_LSR_THR_EMPTY    0x20
+#define SERIAL_TIMEOUT          100000      // LSR polls before a character is given up on
+
+#define PROFILER_FRAME_SIZE     8           // saved EBP and return address
+
+typedef struct
+{
+    uint32_t Eip;
+    uint32_t Depth;
+    uint32_t Returns[PROFILER_MAX_DEPTH];
+} profiler_Record;
+
+// Head is only written by the CPU the ring belongs to, Tail only by the dumper
+typedef struct
+{
+    volatile uint32_t Head;
+    volatile uint32_t Tail;
+    uint32_t Samples;
+    volatile uint32_t Dropped;
+    uint32_t StackBottom;
+    uint32_t StackTop;
+    profiler_Record Ring[PROFILER_RING_SIZE];
+} __attribute__((aligned(64))) profiler_Cpu;
+
+static profiler_Cpu g_Cpus[PROFILER_MAX_CPUS];
+static volatile bool g_Enabled;
+static volatile uint32_t g_Dumping;
+
+static inline void profiler_Outb(uint16_t port, uint8_t value)
+{
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t profiler_Inb(uint16_t port)
+{
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+void profiler_SetStack(uint32_t cpu, uint32_t bottom, uint32_t top)
+{
+    if (cpu >= PROFILER_MAX_CPUS)
+        return;
+
+    g_Cpus[cpu].StackBottom = bottom;
+    g_Cpus[cpu].StackTop = top;
+}
+
+bool profiler_Start(uint32_t hz)
+{
+    if (hz == 0 || PIT_FREQUENCY / hz == 0 || PIT_FREQUENCY / hz > 0xFFFF)
+        return false;
+
+    uint32_t divisor = PIT_FREQUENCY / hz;
+    profiler_Outb(PIT_PORT_COMMAND, PIT_COMMAND_RATE0);
+    profiler_Outb(PIT_PORT_CHANNEL0, divisor & 0xFF);
+    profiler_Outb(PIT_PORT_CHANNEL0, divisor >> 8);
+
+    __atomic_store_n(&g_Enabled, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+void profiler_Stop()
+{
+    __atomic_store_n(&g_Enabled, false, __ATOMIC_RELEASE);
+}
+
+void profiler_Sample(uint32_t cpu, uint32_t eip, uint32_t ebp)
+{
+    if (!__atomic_load_n(&g_Enabled, __ATOMIC_ACQUIRE) || cpu >= PROFILER_MAX_CPUS)
+        return;
+
+    profiler_Cpu* state = &g_Cpus[cpu];
+    uint32_t head = state->Head;
+    state->Samples++;
+    if (head - __atomic_load_n(&state->Tail, __ATOMIC_ACQUIRE) >= PROFILER_RING_SIZE)
+    {
+        state->Dropped++;
+        return;
+    }
+
+    profiler_Record* sample = &state->Ring[head % PROFILER_RING_SIZE];
+    sample->Eip = eip;
+    sample->Depth = 0;
+
+    // each frame holds the caller's EBP, then the return address into the caller.
+    // Frames only ever lie further up the stack, and nothing outside this CPU's
+    // stack is read.
+    uint32_t frame = ebp;
+    while (sample->Depth < PROFILER_MAX_DEPTH && (frame & 3) == 0
+           && frame >= state->StackBottom && frame < state->StackTop
+           && state->StackTop - frame >= PROFILER_FRAME_SIZE)
+    {
+        const uint32_t* words = (const uint32_t*)frame;
+        if (words[1] == 0)
+            break;
+
+        sample->Returns[sample->Depth++] = words[1];
+        if (words[0] <= frame)
+            break;
+        frame = words[0];
+    }
+
+    __atomic_store_n(&state->Head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void profiler_Putc(char c)
+{
+    for (int i = 0; i < SERIAL_TIMEOUT; i++)
+    {
+        if (profiler_Inb(SERIAL_PORT + SERIAL_REG_LSR) & SERIAL_LSR_THR_EMPTY)
+        {
+            profiler_Outb(SERIAL_PORT, c);
+            return;
+        }
+    }
+}
+
+static void profiler_PutHex(uint32_t value)
+{
+    profiler_Putc(' ');
+    for (int shift = 28; shift >= 0; shift -= 4)
+        profiler_Putc("0123456789abcdef"[(value >> shift) & 0xF]);
+}
+
+void profiler_Dump()
+{
+    if (__atomic_exchange_n(&g_Dumping, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    for (uint32_t cpu = 0; cpu < PROFILER_MAX_CPUS; cpu++)
+    {
+        profiler_Cpu* state = &g_Cpus[cpu];
+        uint32_t head = __atomic_load_n(&state->Head, __ATOMIC_ACQUIRE);
+        for (uint32_t tail = state->Tail; tail != head; tail++)
+        {
+            const profiler_Record* sample = &state->Ring[tail % PROFILER_RING_SIZE];
+            profiler_Putc('P');
+            profiler_Putc('R');
+            profiler_Putc('O');
+            profiler_Putc('F');
+            profiler_PutHex(cpu);
+            profiler_PutHex(sample->Eip);
+            for (uint32_t i = 0; i < sample->Depth; i++)
+                profiler_PutHex(sample->Returns[i]);
+            profiler_Putc('\r');
+            profiler_Putc('\n');
+
+            // the slot is only free for the sampler once it has been printed
+            __atomic_store_n(&state->Tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    __atomic_store_n(&g_Dumping, 0, __ATOMIC_RELEASE);
+}
+
+void profiler_GetStats(profiler_Stats* stats)
+{
+    stats->Samples = 0;
+    stats->Dropped = 0;
+    for (uint32_t cpu = 0; cpu < PROFILER_MAX_CPUS; cpu++)
+    {
+        stats->Samples += __atomic_load_n(&g_Cpus[cpu].Samples, __ATOMIC_RELAXED);
+        stats->Dropped += __atomic_load_n(&g_Cpus[cpu].Dropped, __ATOMIC_RELAXED);
+    }
+}
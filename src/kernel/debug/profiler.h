@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sampling profiler. profiler_Start programs PIT channel 0 to interrupt hz times
+// a second; the IRQ 0 handler, and the local APIC timer handler on the other
+// CPUs, pass the interrupted EIP and EBP to profiler_Sample. Every CPU has its
+// own sample ring that only it writes, so sampling takes no lock. profiler_Dump
+// drains the rings to COM1, one line per sample:
+//
+//   PROF <cpu> <eip> <return address>...
+//
+// all in hex, innermost first, which tools/profile/flamegraph.py folds into flame
+// graph input. The return addresses come from the saved frame pointers, so the
+// kernel is built with -fno-omit-frame-pointer. Only frames inside the stack
+// given to profiler_SetStack are followed: interrupted code may be using EBP for
+// anything (assembly, libgcc), and the ISR must not fault on it.
+
+#define PROFILER_MAX_CPUS       16
+#define PROFILER_MAX_DEPTH      8           // return addresses kept per sample
+#define PROFILER_RING_SIZE      512         // samples per CPU, power of two
+
+typedef struct
+{
+    uint32_t Samples;           // taken on all CPUs since profiler_Start
+    uint32_t Dropped;           // lost to a full ring, dump more often
+} profiler_Stats;
+
+// The kernel stack cpu runs on, bottom up to (not including) top. Until it is set
+// samples on cpu only have the EIP.
+void profiler_SetStack(uint32_t cpu, uint32_t bottom, uint32_t top);
+
+// Returns false if hz can't be made with the PIT (19 Hz to 1.19 MHz)
+bool profiler_Start(uint32_t hz);
+
+// Stops recording. The PIT keeps running at the profiling rate.
+void profiler_Stop();
+
+// From the timer interrupt, with interrupts off, on cpu
+void profiler_Sample(uint32_t cpu, uint32_t eip, uint32_t ebp);
+
+// Prints and frees the samples recorded so far. Any CPU may call it; while one
+// CPU dumps, calls from the others return at once.
+void profiler_Dump();
+
+void profiler_GetStats(profiler_Stats* stats);
@@ -0,0 +1,52 @@
+#include "symtab.h"
+#include <stddef.h>
+
+extern const uint8_t g_SymbolTable[];
+
+bool symtab_Lookup(uint32_t address, char* nameOut, uint32_t nameSize, uint32_t* offsetOut)
+{
+    const SymtabHeader* header = (const SymtabHeader*)g_SymbolTable;
+    if (header->Magic != SYMTAB_MAGIC || header->Count == 0 || nameSize == 0)
+        return false;
+
+    const uint32_t* addresses = (const uint32_t*)(header + 1);
+    const uint32_t* blocks = addresses + header->Count;
+    if (address < addresses[0] || address >= header->TextEnd)
+        return false;
+
+    // last symbol at or below address
+    uint32_t low = 0, high = header->Count;
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (addresses[middle] <= address)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    // rebuild the name from the start of its block
+    char name[SYMTAB_MAX_NAME + 1];
+    const uint8_t* entry = g_SymbolTable + header->NamesOffset + blocks[low / SYMTAB_BLOCK_SIZE];
+    uint32_t length = 0;
+    for (uint32_t i = low - low % SYMTAB_BLOCK_SIZE; i <= low; i++)
+    {
+        uint32_t shared = entry[0];
+        uint32_t suffix = entry[1];
+        for (uint32_t j = 0; j < suffix; j++)
+            name[shared + j] = entry[2 + j];
+
+        length = shared + suffix;
+        entry += 2 + suffix;
+    }
+
+    if (length > nameSize - 1)
+        length = nameSize - 1;
+    for (uint32_t i = 0; i < length; i++)
+        nameOut[i] = name[i];
+    nameOut[length] = '\0';
+
+    if (offsetOut != NULL)
+        *offsetOut = address - addresses[low];
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Function symbols of the kernel, generated from kernel.map by
+// tools/symbols/symtab.py and linked in as g_SymbolTable:
+//
+//   SymtabHeader
+//   uint32_t Addresses[Count]                  sorted, searched with a binary search
+//   uint32_t Blocks[(Count + 15) / 16]         offset from NamesOffset of every 16th name
+//   names, in address order: uint8_t Shared, uint8_t Length, char Suffix[Length]
+//
+// Each name keeps the first Shared characters of the previous one and appends
+// Suffix. The first name of a block always has Shared = 0, so a lookup decodes
+// at most SYMTAB_BLOCK_SIZE names.
+
+#define SYMTAB_MAGIC            0x544D5953      // "SYMT"
+#define SYMTAB_BLOCK_SIZE       16
+#define SYMTAB_MAX_NAME         255
+
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t Count;
+    uint32_t TextEnd;           // addresses past the last function don't resolve
+    uint32_t NamesOffset;       // from the start of the table
+} SymtabHeader;
+
+// Finds the function containing address. nameOut gets its name, truncated to
+// nameSize - 1 characters, and offsetOut how far into it the address is.
+bool symtab_Lookup(uint32_t address, char* nameOut, uint32_t nameSize, uint32_t* offsetOut);
@@ -0,0 +1,514 @@
+#include "pmm.h"
+#include <stddef.h>
+
+#define PMM_LOW_MEMORY          0x100000    // BIOS, stage2 and its buffers, BootParams
+#define PMM_NONE                0xFFFFFFFF
+#define PMM_NOT_HEAD            0xFF        // g_Order of frames that don't start a free block
+#define PMM_CACHE_SIZE          64
+#define PMM_CACHE_BATCH         32          // frames moved between a cache and the buddy allocator at once
+#define PMM_MAX_RESERVED        (BOOT_MAX_MODULES + 8)
+
+typedef struct
+{
+    uint32_t Start;
+    uint32_t End;
+} pmm_Range;
+
+// one cache line each, so CPUs don't share them
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Frames[PMM_CACHE_SIZE];
+} __attribute__((aligned(64))) pmm_CpuCache;
+
+// bit set: the frame is free in the buddy allocator
+static uint32_t* g_Bitmap;
+
+// per frame: order of the free block it starts, and its free list links
+static uint8_t* g_Order;
+static uint32_t* g_Next;
+static uint32_t* g_Prev;
+
+static uint32_t g_FrameCount;
+static uint32_t g_FreeList[PMM_MAX_ORDER + 1];
+static uint32_t g_FreeBlocks[PMM_MAX_ORDER + 1];
+static uint32_t g_FreeFrames;
+static uint32_t g_TotalFrames;
+static volatile uint32_t g_Lock;
+
+static pmm_CpuCache g_Caches[PMM_MAX_CPUS];
+
+static pmm_Range g_Reserved[PMM_MAX_RESERVED];
+static int g_ReservedCount;
+
+static void pmm_Lock()
+{
+    while (__atomic_exchange_n(&g_Lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&g_Lock, __ATOMIC_RELAXED))
+            __asm__ volatile("pause");
+}
+
+static void pmm_Unlock()
+{
+    __atomic_store_n(&g_Lock, 0, __ATOMIC_RELEASE);
+}
+
+static bool pmm_TestBit(uint32_t frame)
+{
+    return (g_Bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+// Sets or clears count bits from first, a word at a time where it can
+static void pmm_SetBits(uint32_t first, uint32_t count, bool value)
+{
+    while (count > 0 && (first % 32 != 0 || count < 32))
+    {
+        if (value)
+            g_Bitmap[first / 32] |= 1u << (first % 32);
+        else
+            g_Bitmap[first / 32] &= ~(1u << (first % 32));
+
+        first++;
+        count--;
+    }
+
+    for (; count >= 32; first += 32, count -= 32)
+        g_Bitmap[first / 32] = value ? 0xFFFFFFFF : 0;
+
+    while (count > 0)
+    {
+        if (value)
+            g_Bitmap[first / 32] |= 1u << (first % 32);
+        else
+            g_Bitmap[first / 32] &= ~(1u << (first % 32));
+
+        first++;
+        count--;
+    }
+}
+
+static void pmm_ListPush(uint32_t frame, uint32_t order)
+{
+    g_Order[frame] = order;
+    g_Prev[frame] = PMM_NONE;
+    g_Next[frame] = g_FreeList[order];
+    if (g_FreeList[order] != PMM_NONE)
+        g_Prev[g_FreeList[order]] = frame;
+
+    g_FreeList[order] = frame;
+    g_FreeBlocks[order]++;
+}
+
+static void pmm_ListRemove(uint32_t frame, uint32_t order)
+{
+    if (g_Prev[frame] != PMM_NONE)
+        g_Next[g_Prev[frame]] = g_Next[frame];
+    else
+        g_FreeList[order] = g_Next[frame];
+
+    if (g_Next[frame] != PMM_NONE)
+        g_Prev[g_Next[frame]] = g_Prev[frame];
+
+    g_Order[frame] = PMM_NOT_HEAD;
+    g_FreeBlocks[order]--;
+}
+
+// Returns the block to the free lists, merging it with its buddy as long as that is free too
+static void pmm_FreeBlock(uint32_t frame, uint32_t order)
+{
+    pmm_SetBits(frame, 1u << order, true);
+    g_FreeFrames += 1u << order;
+
+    // a free buddy is always the head of a free block, but maybe of a smaller one
+    while (order < PMM_MAX_ORDER)
+    {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= g_FrameCount || !pmm_TestBit(buddy) || g_Order[buddy] != order)
+            break;
+
+        pmm_ListRemove(buddy, order);
+        frame &= ~(1u << order);
+        order++;
+    }
+
+    pmm_ListPush(frame, order);
+}
+
+// Takes a block of exactly order, splitting a larger one if needed
+static uint32_t pmm_AllocBlock(uint32_t order)
+{
+    uint32_t found = order;
+    while (found <= PMM_MAX_ORDER && g_FreeList[found] == PMM_NONE)
+        found++;
+
+    if (found > PMM_MAX_ORDER)
+        return PMM_NONE;
+
+    uint32_t frame = g_FreeList[found];
+    pmm_ListRemove(frame, found);
+
+    // the upper halves go back, lowest addresses are handed out first
+    while (found > order)
+    {
+        found--;
+        pmm_ListPush(frame + (1u << found), found);
+    }
+
+    pmm_SetBits(frame, 1u << order, false);
+    g_FreeFrames -= 1u << order;
+    return frame;
+}
+
+// Frees the frames in [first, end) in the largest aligned blocks that fit
+static void pmm_FreeRange(uint32_t first, uint32_t end)
+{
+    while (first < end)
+    {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER
+               && (first & ((2u << order) - 1)) == 0
+               && first + (2u << order) <= end)
+            order++;
+
+        pmm_FreeBlock(first, order);
+        first += 1u << order;
+    }
+}
+
+static void pmm_Reserve(uint64_t start, uint64_t size)
+{
+    if (size == 0 || start >= 0x100000000ull || g_ReservedCount == PMM_MAX_RESERVED)
+        return;
+
+    uint64_t end = start + size;
+    g_Reserved[g_ReservedCount].Start = start & ~(uint64_t)(PMM_FRAME_SIZE - 1);
+    g_Reserved[g_ReservedCount].End = end >= 0x100000000ull ? 0xFFFFFFFF : (uint32_t)end;
+    g_ReservedCount++;
+}
+
+// Everything stage2 handed over that lives in usable memory
+static void pmm_ReserveBoot(const BootParams* params)
+{
+    pmm_Reserve(0, PMM_LOW_MEMORY);
+
+    for (uint32_t i = 0; i < params->ModuleCount && i < BOOT_MAX_MODULES; i++)
+    {
+        uint32_t size = params->Modules[i].Size;
+
+        // the kernel's lazy sections aren't loaded yet, but their memory is spoken for
+        if (params->Modules[i].Type == BOOT_MODULE_KERNEL)
+            for (uint32_t j = 0; j < params->KernelImage.SectionCount && j < KERNEL_IMAGE_MAX_SECTIONS; j++)
+                if (params->KernelImage.Sections[j].MemoryOffset + params->KernelImage.Sections[j].Size > size)
+                    size = params->KernelImage.Sections[j].MemoryOffset + params->KernelImage.Sections[j].Size;
+
+        pmm_Reserve(params->Modules[i].Start, size);
+    }
+
+    if (params->Paging.Mode != BOOT_PAGING_OFF)
+        pmm_Reserve(params->Paging.TablesStart, params->Paging.TablesSize);
+
+    pmm_Reserve(params->Smp.ParkStart, params->Smp.ParkSize);
+    if (params->Filesystem.FatType != 0)
+        pmm_Reserve(params->Filesystem.RegionStart, params->Filesystem.RegionSize);
+}
+
+// Moves start past every reserved range it lands in
+static uint32_t pmm_SkipReserved(uint32_t start, uint32_t size)
+{
+    bool moved = true;
+    while (moved)
+    {
+        moved = false;
+        for (int i = 0; i < g_ReservedCount; i++)
+        {
+            if (start < g_Reserved[i].End && start + size > g_Reserved[i].Start)
+            {
+                start = (g_Reserved[i].End + PMM_FRAME_SIZE - 1) & ~(PMM_FRAME_SIZE - 1);
+                moved = true;
+            }
+        }
+    }
+
+    return start;
+}
+
+// Finds room for the metadata in usable memory the kernel can address
+static uint32_t pmm_PlaceMetadata(const BootMemoryMap* map, uint32_t size, uint64_t limit)
+{
+    for (uint32_t i = 0; i < map->RegionCount; i++)
+    {
+        const BootMemoryRegion* region = &map->Regions[i];
+        if (region->Type != BOOT_MEMORY_USABLE)
+            continue;
+
+        uint64_t end = region->Base + region->Length;
+        if (end > limit)
+            end = limit;
+
+        uint64_t start = (region->Base + PMM_FRAME_SIZE - 1) & ~(uint64_t)(PMM_FRAME_SIZE - 1);
+        if (start >= end || end - start < size)
+            continue;
+
+        start = pmm_SkipReserved((uint32_t)start, size);
+        if (start + size <= end)
+            return (uint32_t)start;
+    }
+
+    return 0;
+}
+
+bool pmm_Initialize(const BootParams* params)
+{
+    const BootMemoryMap* map = &params->MemoryMap;
+
+    // frames up to the end of the highest usable memory below 4 GiB
+    uint64_t top = 0;
+    for (uint32_t i = 0; i < map->RegionCount; i++)
+    {
+        uint64_t end = map->Regions[i].Base + map->Regions[i].Length;
+        if (map->Regions[i].Type == BOOT_MEMORY_USABLE && end > top)
+            top = end;
+    }
+
+    if (top > 0x100000000ull)
+        top = 0x100000000ull;
+
+    g_FrameCount = top / PMM_FRAME_SIZE;
+    if (g_FrameCount == 0)
+        return false;
+
+    g_ReservedCount = 0;
+    pmm_ReserveBoot(params);
+
+    uint32_t bitmapSize = (g_FrameCount + 31) / 32 * sizeof(uint32_t);
+    uint32_t linksSize = g_FrameCount * sizeof(uint32_t);
+    uint32_t metadataSize = (bitmapSize + 2 * linksSize + g_FrameCount + PMM_FRAME_SIZE - 1) & ~(PMM_FRAME_SIZE - 1);
+
+    uint64_t limit = params->Paging.Mode != BOOT_PAGING_OFF ? params->Paging.MappedSize : 0x100000000ull;
+    uint32_t metadata = pmm_PlaceMetadata(map, metadataSize, limit);
+    if (metadata == 0)
+        return false;
+
+    pmm_Reserve(metadata, metadataSize);
+    g_Bitmap = (uint32_t*)metadata;
+    g_Next = (uint32_t*)(metadata + bitmapSize);
+    g_Prev = (uint32_t*)(metadata + bitmapSize + linksSize);
+    g_Order = (uint8_t*)(metadata + bitmapSize + 2 * linksSize);
+
+    for (uint32_t i = 0; i <= PMM_MAX_ORDER; i++)
+    {
+        g_FreeList[i] = PMM_NONE;
+        g_FreeBlocks[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < g_FrameCount; i++)
+        g_Order[i] = PMM_NOT_HEAD;
+
+    for (uint32_t i = 0; i < PMM_MAX_CPUS; i++)
+        g_Caches[i].Count = 0;
+
+    // work out which frames are free in the bitmap first: whole frames of usable
+    // memory, minus any frame touched by other memory types or reservations
+    pmm_SetBits(0, g_FrameCount, false);
+    for (uint32_t i = 0; i < map->RegionCount; i++)
+    {
+        const BootMemoryRegion* region = &map->Regions[i];
+        if (region->Type != BOOT_MEMORY_USABLE)
+            continue;
+
+        uint64_t first = (region->Base + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
+        uint64_t end = (region->Base + region->Length) / PMM_FRAME_SIZE;
+        if (end > g_FrameCount)
+            end = g_FrameCount;
+        if (first < end)
+            pmm_SetBits(first, end - first, true);
+    }
+
+    for (uint32_t i = 0; i < map->RegionCount; i++)
+    {
+        const BootMemoryRegion* region = &map->Regions[i];
+        if (region->Type == BOOT_MEMORY_USABLE)
+            continue;
+
+        uint64_t first = region->Base / PMM_FRAME_SIZE;
+        uint64_t end = (region->Base + region->Length + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
+        if (end > g_FrameCount)
+            end = g_FrameCount;
+        if (first < end)
+            pmm_SetBits(first, end - first, false);
+    }
+
+    for (int i = 0; i < g_ReservedCount; i++)
+    {
+        uint32_t first = g_Reserved[i].Start / PMM_FRAME_SIZE;
+        uint32_t end = (g_Reserved[i].End / PMM_FRAME_SIZE) + (g_Reserved[i].End % PMM_FRAME_SIZE != 0);
+        if (end > g_FrameCount)
+            end = g_FrameCount;
+        if (first < end)
+            pmm_SetBits(first, end - first, false);
+    }
+
+    // then hand every run of free frames to the buddy allocator, which sets the bits again
+    g_FreeFrames = 0;
+    uint32_t frame = 0;
+    while (frame < g_FrameCount)
+    {
+        if (g_Bitmap[frame / 32] == 0 && frame % 32 == 0)
+        {
+            frame += 32;
+            continue;
+        }
+
+        if (!pmm_TestBit(frame))
+        {
+            frame++;
+            continue;
+        }
+
+        uint32_t end = frame;
+        while (end < g_FrameCount && pmm_TestBit(end))
+            end++;
+
+        pmm_SetBits(frame, end - frame, false);
+        pmm_FreeRange(frame, end);
+        frame = end;
+    }
+
+    g_TotalFrames = g_FreeFrames;
+    return true;
+}
+
+uint32_t pmm_AllocFrame(uint32_t cpu)
+{
+    pmm_CpuCache* cache = &g_Caches[cpu];
+
+    if (cache->Count == 0)
+    {
+        pmm_Lock();
+        while (cache->Count < PMM_CACHE_BATCH)
+        {
+            uint32_t frame = pmm_AllocBlock(0);
+            if (frame == PMM_NONE)
+                break;
+
+            cache->Frames[cache->Count++] = frame;
+        }
+        pmm_Unlock();
+
+        if (cache->Count == 0)
+            return 0;
+    }
+
+    return cache->Frames[--cache->Count] * PMM_FRAME_SIZE;
+}
+
+void pmm_FreeFrame(uint32_t cpu, uint32_t address)
+{
+    pmm_CpuCache* cache = &g_Caches[cpu];
+
+    if (cache->Count == PMM_CACHE_SIZE)
+    {
+        // the oldest frames go back, the recently freed (cache hot) ones stay
+        pmm_Lock();
+        for (uint32_t i = 0; i < PMM_CACHE_BATCH; i++)
+            pmm_FreeBlock(cache->Frames[i], 0);
+        pmm_Unlock();
+
+        cache->Count -= PMM_CACHE_BATCH;
+        for (uint32_t i = 0; i < cache->Count; i++)
+            cache->Frames[i] = cache->Frames[i + PMM_CACHE_BATCH];
+    }
+
+    cache->Frames[cache->Count++] = address / PMM_FRAME_SIZE;
+}
+
+uint32_t pmm_AllocPages(uint32_t order)
+{
+    if (order > PMM_MAX_ORDER)
+        return 0;
+
+    pmm_Lock();
+    uint32_t frame = pmm_AllocBlock(order);
+    pmm_Unlock();
+
+    return frame == PMM_NONE ? 0 : frame * PMM_FRAME_SIZE;
+}
+
+void pmm_FreePages(uint32_t address, uint32_t order)
+{
+    pmm_Lock();
+    pmm_FreeBlock(address / PMM_FRAME_SIZE, order);
+    pmm_Unlock();
+}
+
+uint32_t pmm_AllocFrameBelow(uint32_t limit)
+{
+    uint32_t end = limit / PMM_FRAME_SIZE;
+    if (end > g_FrameCount)
+        end = g_FrameCount;
+
+    pmm_Lock();
+
+    uint32_t frame = PMM_NONE;
+    for (uint32_t word = 0; word * 32 < end && frame == PMM_NONE; word++)
+        if (g_Bitmap[word] != 0)
+            frame = word * 32 + __builtin_ctz(g_Bitmap[word]);
+
+    if (frame == PMM_NONE || frame >= end)
+    {
+        pmm_Unlock();
+        return 0;
+    }
+
+    // find the free block holding the frame and split it until the frame is a block of its own
+    uint32_t order = 0;
+    uint32_t head = frame;
+    while (!(pmm_TestBit(head) && g_Order[head] == order))
+    {
+        order++;
+        head = frame & ~((1u << order) - 1);
+    }
+
+    pmm_ListRemove(head, order);
+    while (order > 0)
+    {
+        order--;
+        uint32_t half = head + (1u << order);
+        if (frame >= half)
+        {
+            pmm_ListPush(head, order);
+            head = half;
+        }
+        else
+        {
+            pmm_ListPush(half, order);
+        }
+    }
+
+    pmm_SetBits(frame, 1, false);
+    g_FreeFrames--;
+    pmm_Unlock();
+
+    return frame * PMM_FRAME_SIZE;
+}
+
+bool pmm_IsFree(uint32_t address)
+{
+    uint32_t frame = address / PMM_FRAME_SIZE;
+    return frame < g_FrameCount && pmm_TestBit(frame);
+}
+
+void pmm_GetStats(pmm_Stats* stats)
+{
+    pmm_Lock();
+
+    stats->TotalFrames = g_TotalFrames;
+    stats->FreeFrames = g_FreeFrames;
+    stats->CachedFrames = 0;
+    for (uint32_t i = 0; i < PMM_MAX_CPUS; i++)
+        stats->CachedFrames += g_Caches[i].Count;
+    for (uint32_t i = 0; i <= PMM_MAX_ORDER; i++)
+        stats->FreeBlocks[i] = g_FreeBlocks[i];
+
+    pmm_Unlock();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <boot/bootparams.h>
+
+#define PMM_FRAME_SIZE      4096
+#define PMM_MAX_ORDER       10          // largest buddy block, 4 MiB
+#define PMM_MAX_CPUS        BOOT_MAX_CPUS
+
+typedef struct
+{
+    uint32_t TotalFrames;       // frames the allocator manages
+    uint32_t FreeFrames;        // in the buddy allocator
+    uint32_t CachedFrames;      // free, but sitting in a CPU's cache
+    uint32_t FreeBlocks[PMM_MAX_ORDER + 1];
+} pmm_Stats;
+
+// Takes over the usable memory in params->MemoryMap below 4 GiB, except for
+// the first MiB, the kernel and modules and everything else BootParams points
+// at. The allocator's own metadata (about 9 bytes per frame) goes into the
+// first usable memory it fits in, which has to be addressable at its physical
+// address: paging off, or inside stage2's identity mapping.
+bool pmm_Initialize(const BootParams* params);
+
+// Single frames come from the calling CPU's cache, which is refilled from and
+// drained to the buddy allocator in batches, so most calls take no lock. The
+// caller must stay on cpu, with interrupts off, for the duration of the call.
+// Returns the frame's physical address, 0 when out of memory.
+uint32_t pmm_AllocFrame(uint32_t cpu);
+void pmm_FreeFrame(uint32_t cpu, uint32_t address);
+
+// 2^order contiguous frames, aligned to their size. Returns 0 when no block that
+// large is left.
+uint32_t pmm_AllocPages(uint32_t order);
+void pmm_FreePages(uint32_t address, uint32_t order);
+
+// Any free frame below limit (for ISA DMA, real mode code...), found with the bitmap
+uint32_t pmm_AllocFrameBelow(uint32_t limit);
+
+bool pmm_IsFree(uint32_t address);
+void pmm_GetStats(pmm_Stats* stats);
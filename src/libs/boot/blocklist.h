@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+
+// Precomputed kernel location written by tools/fat into the last reserved sector,
+// so stage2 can load the kernel without parsing the FAT. Generation has to match
+// the volume id in the boot sector, which tools/fat bumps every time it changes
+// the image. Other tools don't, so the root directory checksum catches them
+// moving or resizing the kernel or adding /boot.cfg, and the kernel checksum
+// catches them rewriting it in place.
+//
+// The kernel is copied to its load address as one piece, so tools/fat writes no
+// blocklist for a kernel with a section table (kernelimage.h) or a /boot.cfg.
+
+#define BLOCKLIST_MAGIC                 0x4B4C4248      // "HBLK"
+#define BLOCKLIST_MAX_EXTENTS           59
+#define BLOCKLIST_MAX_ROOT_SECTORS      127             // what stage2 has room for after the boot sector
+#define BLOCKLIST_RESERVED_OFFSET       14              // offset of ReservedSectors in the boot sector
+#define BLOCKLIST_VOLUME_ID_OFFSET      39              // offset of VolumeId in the boot sector
+#define BLOCKLIST_STAGE2_LIST_OFFSET    480             // stage1's list of stage2 sectors
+#define BLOCKLIST_STAGE2_LIST_ENTRIES   6
+
+typedef struct
+{
+    uint32_t Lba;
+    uint32_t Count;
+} __attribute__((packed)) BlocklistExtent;
+
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t Generation;
+    uint32_t KernelSize;
+    uint32_t KernelChecksum;        // CRC-32 of the kernel image
+    uint32_t RootLba;               // the FAT12/16 root directory, /kernel.bin and /boot.cfg live there
+    uint32_t RootSectors;
+    uint32_t RootChecksum;          // CRC-32 of the root directory
+    uint32_t ExtentCount;
+    BlocklistExtent Extents[BLOCKLIST_MAX_EXTENTS];
+    uint8_t _Padding[512 - 32 - 8 * BLOCKLIST_MAX_EXTENTS - 4];
+    uint32_t HeaderChecksum;        // CRC-32 of everything above
+} __attribute__((packed)) Blocklist;
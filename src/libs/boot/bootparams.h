@@ -0,0 +1,191 @@
+#pragma once
+#include <stdint.h>
+#include "kernelimage.h"
+
+// Handed from stage2 to the kernel entry point: void start(BootParams* params)
+
+#define BOOT_MAX_MODULES        16
+#define BOOT_MODULE_NAME_SIZE   64
+
+enum BootModuleType {
+    BOOT_MODULE_KERNEL = 0,
+    BOOT_MODULE_INITRD = 1,
+    BOOT_MODULE_MODULE = 2,
+};
+
+typedef struct
+{
+    uint32_t Start;         // physical address the file was loaded to
+    uint32_t Size;          // file size in bytes
+    uint32_t Type;          // BootModuleType
+    char Name[BOOT_MODULE_NAME_SIZE];
+} BootModule;
+
+enum BootMemoryType {
+    BOOT_MEMORY_USABLE = 1,
+    BOOT_MEMORY_RESERVED = 2,
+    BOOT_MEMORY_ACPI_RECLAIMABLE = 3,
+    BOOT_MEMORY_ACPI_NVS = 4,
+    BOOT_MEMORY_BAD = 5,
+};
+
+#define BOOT_MAX_MEMORY_REGIONS 64
+
+typedef struct
+{
+    uint64_t Base;
+    uint64_t Length;
+    uint32_t Type;          // BootMemoryType, other values are reserved too
+} BootMemoryRegion;
+
+// The BIOS memory map (E820), sorted by base. Regions may overlap, where they
+// do the more restrictive type wins. Usable memory still holds everything else
+// BootParams points at, the kernel has to reserve that itself.
+typedef struct
+{
+    uint32_t RegionCount;   // 0 if the BIOS had no map
+    BootMemoryRegion Regions[BOOT_MAX_MEMORY_REGIONS];
+} BootMemoryMap;
+
+enum BootPagingMode {
+    BOOT_PAGING_OFF = 0,    // kernel is entered with paging disabled
+    BOOT_PAGING_PSE = 1,    // 2-level tables with 4 MiB pages
+    BOOT_PAGING_PAE = 2,    // PDPT and page directories with 2 MiB pages
+    BOOT_PAGING_AUTO = 3,   // stage2 only: PSE if the CPU has it, else PAE
+};
+
+// With paging enabled, physical memory from 0 up to MappedSize is mapped twice:
+// identity, so the kernel still starts at its physical entry point, and at
+// BOOT_KERNEL_VIRTUAL_BASE for a higher half kernel.
+#define BOOT_KERNEL_VIRTUAL_BASE    0xC0000000
+
+typedef struct
+{
+    uint32_t Mode;          // BootPagingMode
+    uint32_t Cr3;           // physical address of the page directory (PAE: PDPT)
+    uint32_t TablesStart;   // physical memory holding the tables, keep it reserved
+    uint32_t TablesSize;
+    uint32_t MappedSize;
+} BootPaging;
+
+enum BootDiskType {
+    BOOT_DISK_BIOS = 0,     // INT 13h, BootDevice is the drive number
+    BOOT_DISK_AHCI = 1,     // SATA, DiskPort is the AHCI port
+    BOOT_DISK_VIRTIO = 2,   // virtio-blk, DiskPort is the index among virtio-blk PCI functions
+    BOOT_DISK_FDC = 3,      // floppy controller, DiskPort is the drive
+    BOOT_DISK_IDE = 4,      // bus-master IDE, DiskPort is channel * 2 + slave
+};
+
+#define BOOT_MAX_KERNEL_EXTENTS     64
+
+typedef struct
+{
+    uint32_t Lba;
+    uint32_t Sectors;
+} BootExtent;
+
+// Everything the kernel needs to read its lazy sections itself: how the boot
+// disk was accessed and where kernel.bin lies on it, in file order.
+typedef struct
+{
+    uint32_t SectionCount;      // 0 when kernel.bin had no section table, or it was loaded whole
+    KernelSection Sections[KERNEL_IMAGE_MAX_SECTIONS];
+    uint32_t DiskType;          // BootDiskType
+    uint32_t DiskPort;
+    uint16_t Cylinders;
+    uint16_t Heads;
+    uint16_t SectorsPerTrack;
+    uint32_t ExtentCount;
+    BootExtent Extents[BOOT_MAX_KERNEL_EXTENTS];
+} BootKernelImage;
+
+#define BOOT_MAX_CPUS           16
+
+// Application processors stage2 started are left in 32-bit protected mode with
+// paging and interrupts off, halted in a loop inside ParkStart..ParkSize. They
+// need INIT-SIPI-SIPI like any other AP; keep the park memory reserved until then.
+typedef struct
+{
+    uint32_t CpuCount;          // 1 when only the BSP ran
+    uint32_t LocalApicBase;     // physical address, 0 without a local APIC
+    uint32_t ParkStart;
+    uint32_t ParkSize;
+    uint8_t ApicIds[BOOT_MAX_CPUS];     // [0] is the BSP
+} BootSmp;
+
+#define BOOT_MAX_FS_FILES       32
+#define BOOT_MAX_FS_RUNS        32
+#define BOOT_FS_PATH_SIZE       64
+
+// A directory entry stage2 resolved while opening files
+typedef struct
+{
+    char Path[BOOT_FS_PATH_SIZE];   // absolute, as it was opened
+    uint32_t FirstCluster;
+    uint32_t Size;
+    uint32_t Attributes;
+} BootFsFile;
+
+// Sectors stage2 still holds in memory
+typedef struct
+{
+    uint32_t Lba;
+    uint32_t Sectors;
+    uint32_t Address;
+} BootFsRun;
+
+// The boot volume as stage2 mounted it, enough to mount it again without disk
+// I/O. The boot sector, FAT and runs all lie in RegionStart..RegionSize, which
+// the kernel has to keep reserved (or copy) until it has adopted them. After a
+// blocklist boot only the boot sector and the root directory run are there, the
+// FAT has to be read from the disk.
+typedef struct
+{
+    uint32_t FatType;           // 12, or 0 if stage2 never mounted the volume
+    uint32_t RegionStart;
+    uint32_t RegionSize;
+
+    // parsed BPB
+    uint32_t BytesPerSector;
+    uint32_t SectorsPerCluster;
+    uint32_t ReservedSectors;
+    uint32_t FatCount;
+    uint32_t RootEntryCount;
+    uint32_t SectorsPerFat;
+    uint32_t TotalSectors;
+    uint32_t VolumeId;
+
+    // derived layout, in sectors from the start of the volume
+    uint32_t FatLba;
+    uint32_t RootDirectoryLba;
+    uint32_t DataLba;
+    uint32_t ClusterCount;
+
+    uint32_t BootSectorStart;   // physical address of the raw boot sector
+    uint32_t FatStart;          // first FAT copy, SectorsPerFat sectors, 0 if stage2 didn't read it
+    uint32_t FileCount;
+    BootFsFile Files[BOOT_MAX_FS_FILES];
+    uint32_t RunCount;
+    BootFsRun Runs[BOOT_MAX_FS_RUNS];
+} BootFilesystem;
+
+// The boot log stage2 printed into, see logring.h. The kernel can keep writing
+// to it and drain it itself; it lies in stage2's memory, below 1 MiB.
+typedef struct
+{
+    uint32_t RingStart;         // physical address of the LogRing
+    uint32_t RingSize;
+} BootLog;
+
+typedef struct
+{
+    uint8_t BootDevice;
+    uint32_t ModuleCount;   // Modules[0] is always the kernel
+    BootModule Modules[BOOT_MAX_MODULES];
+    BootPaging Paging;
+    BootKernelImage KernelImage;
+    BootSmp Smp;
+    BootFilesystem Filesystem;
+    BootMemoryMap MemoryMap;
+    BootLog Log;
+} BootParams;
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+// Optional section table inside kernel.bin. Stage2 looks for it on a 4 byte
+// boundary within the first KERNEL_IMAGE_SEARCH_SIZE bytes of the file. Without
+// one the whole file is loaded to MEMORY_KERNEL_ADDR as before.
+//
+// Sections marked lazy are not read at boot; their memory is reserved but left
+// undefined, and BootParams.KernelImage tells the kernel where to read them
+// from. File offsets and memory offsets have to be sector (512 byte) aligned,
+// the memory up to the next sector boundary after a section may be overwritten.
+
+#define KERNEL_IMAGE_MAGIC          0x4C4E524B      // "KRNL"
+#define KERNEL_IMAGE_SEARCH_SIZE    8192
+#define KERNEL_IMAGE_MAX_SECTIONS   16
+
+enum KernelSectionFlags {
+    KERNEL_SECTION_LAZY = 1 << 0,
+};
+
+typedef struct
+{
+    uint32_t FileOffset;        // in kernel.bin
+    uint32_t MemoryOffset;      // from the kernel load address
+    uint32_t Size;              // bytes
+    uint32_t Flags;             // KernelSectionFlags
+} KernelSection;
+
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t SectionCount;
+    KernelSection Sections[];
+} KernelImageHeader;
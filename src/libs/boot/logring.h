@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+
+// Boot log shared by stage2 and the kernel. Any CPU may write, including from
+// interrupt handlers, and nobody ever waits for anybody else:
+//
+// - a writer claims position Head by moving Head from pos to pos + 1 with a
+//   compare-exchange, after checking Records[pos % RecordCount].State == pos.
+//   A State below pos means the ring is full: the writer bumps Dropped and
+//   gives up instead of waiting.
+// - it fills in the record and commits it by storing State = pos + 1 (release).
+// - a single consumer at a time (whoever wins Draining) prints the record at
+//   Tail once its State is Tail + 1, then frees it for the next lap by storing
+//   State = Tail + RecordCount and moving Tail on. A claimed record that isn't
+//   committed yet stops the consumer until the next drain.
+//
+// Drained records keep their text until a writer reuses them, so the kernel can
+// still show the messages from before it took over the ring: the ones with
+// Sequence between Tail - RecordCount and Tail.
+
+#define LOG_RING_MAGIC          0x474F4C42      // "BLOG"
+#define LOG_RECORD_SIZE         128
+#define LOG_RECORD_TEXT_SIZE    (LOG_RECORD_SIZE - 3 * sizeof(uint32_t))
+
+typedef struct
+{
+    volatile uint32_t State;
+    uint32_t Sequence;          // the position the record was written at
+    uint32_t Length;            // bytes of Text, not terminated
+    char Text[LOG_RECORD_TEXT_SIZE];
+} LogRecord;
+
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t RecordCount;       // power of two
+    volatile uint32_t Dropped;  // records lost to a full ring
+    volatile uint32_t Draining; // set while a consumer runs
+
+    // writers and the consumer hammer different cache lines
+    volatile uint32_t Head __attribute__((aligned(64)));
+    volatile uint32_t Tail __attribute__((aligned(64)));
+    LogRecord Records[] __attribute__((aligned(64)));
+} LogRing;
@@ -0,0 +1,539 @@
+// Host micro-benchmarks for the stage2 functions that run thousands of times per
+// boot. The stage2 objects are linked in with every symbol prefixed by s2_ (see the
+// Makefile). The fixed buffers in memdefs.h and the VGA text buffer live in a
+// stand-in for the low megabyte, see lowmem.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "disk.h"
+#include "fat.h"
+
+#define SECTOR_SIZE         512
+#define LOWMEM_SIZE         0x100000
+#define LOWMEM_VGA          0xB8000
+#define MIN_RUN_NS          50000000ull
+#define MAX_BENCHMARKS      64
+#define DEFAULT_THRESHOLD   10.0
+
+// 1.44 MB FAT12 floppy
+#define FLOPPY_SECTORS      2880
+#define FLOPPY_SPT          18
+#define FLOPPY_HEADS        2
+#define FLOPPY_FAT_SECTORS  9
+#define FLOPPY_ROOT_ENTRIES 224
+#define FLOPPY_DATA_LBA     33
+#define BENCH_FILE_CLUSTERS 512
+
+// stage2, see the s2_ prefix in the Makefile
+bool s2_disk_Initialize(DISK* disk, uint8_t driveNumber);
+void s2_disk_LBA2CHS(DISK* disk, uint32_t lba, uint16_t* cylinderOut, uint16_t* sectorOut, uint16_t* headOut);
+bool s2_fat_Initialize(DISK* disk);
+uint32_t s2_fat_NextCluster(uint32_t currentCluster);
+fat_File* s2_fat_Open(DISK* disk, const char* path);
+uint32_t s2_fat_Read(DISK* disk, fat_File* file, uint32_t byteCount, void* dataOut);
+void s2_fat_Close(fat_File* file);
+void s2_printf(const char* fmt, ...);
+void* s2_log_Reserve();
+void s2_log_Commit(void* record, uint32_t length);
+void s2_log_Initialize();
+void s2_putc(char c);
+void s2_scrollback(int lines);
+void s2_clrscr();
+const char* s2_strchr(const char* str, char chr);
+unsigned s2_strlen(const char* str);
+void s2_cpu_Initialize();
+void s2_memory_Initialize();
+const char* s2_memory_Implementation();
+void* s2_memcpy(void* dst, const void* src, uint32_t num);
+void* s2_memcpy_movsd(void* dst, const void* src, uint32_t num);
+void* s2_memcpy_sse2(void* dst, const void* src, uint32_t num);
+void* s2_memcpy_erms(void* dst, const void* src, uint32_t num);
+
+// shim.c
+extern const uint8_t* s2_bench_DiskImage;
+extern uint32_t s2_bench_DiskSectors;
+extern uint16_t s2_bench_DiskSectorsPerTrack;
+extern uint16_t s2_bench_DiskHeads;
+extern uint32_t s2_bench_DiskReads;
+extern uintptr_t s2_bench_LowMemory;
+
+// stdio.c
+extern uint8_t* s2_g_ScreenBuffer;
+
+typedef struct
+{
+    const char* Name;
+    double NsPerOp;
+    double AllocsPerOp;
+    double Baseline;        // < 0 if not in the baseline file
+} bench_Result;
+
+static bench_Result g_Results[MAX_BENCHMARKS];
+static int g_ResultCount;
+static const char* g_Filter;
+
+static uint64_t g_Allocations;
+static volatile uint64_t g_Sink;
+
+static uint8_t g_Image[FLOPPY_SECTORS * SECTOR_SIZE];
+static DISK g_Disk;
+static uint32_t g_FileSize;
+
+// counts heap use while a benchmark runs, stage2 itself has no heap so anything
+// showing up here comes from the harness or a stage2 change that pulled one in
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+    g_Allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    g_Allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    g_Allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+static uint64_t bench_Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Runs fn with growing iteration counts until one run takes at least MIN_RUN_NS.
+static void bench_Run(const char* name, void (*fn)(uint64_t iterations))
+{
+    if (g_Filter != NULL && strstr(name, g_Filter) == NULL)
+        return;
+
+    if (g_ResultCount == MAX_BENCHMARKS)
+    {
+        fprintf(stderr, "bench: too many benchmarks, skipping %s\n", name);
+        return;
+    }
+
+    uint64_t iterations = 1;
+    uint64_t elapsed, allocations;
+    for (;;)
+    {
+        allocations = g_Allocations;
+        uint64_t start = bench_Now();
+        fn(iterations);
+        elapsed = bench_Now() - start;
+        allocations = g_Allocations - allocations;
+
+        if (elapsed >= MIN_RUN_NS)
+            break;
+
+        // aim a bit past the minimum so the next run is usually the last one
+        uint64_t next = elapsed > 0 ? iterations * MIN_RUN_NS * 12 / 10 / elapsed : iterations * 100;
+        iterations = next > iterations * 100 ? iterations * 100 : (next > iterations ? next : iterations * 2);
+    }
+
+    bench_Result* result = &g_Results[g_ResultCount++];
+    result->Name = name;
+    result->NsPerOp = (double)elapsed / iterations;
+    result->AllocsPerOp = (double)allocations / iterations;
+    result->Baseline = -1;
+}
+
+//
+// Benchmarks
+//
+
+static void bench_FatNextCluster(uint64_t iterations)
+{
+    uint32_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        sum += s2_fat_NextCluster(2 + i % (FLOPPY_SECTORS - FLOPPY_DATA_LBA));
+    g_Sink += sum;
+}
+
+static void bench_LBA2CHS(uint64_t iterations)
+{
+    uint16_t cylinder, sector, head;
+    uint32_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        s2_disk_LBA2CHS(&g_Disk, i % FLOPPY_SECTORS, &cylinder, &sector, &head);
+        sum += cylinder + sector + head;
+    }
+    g_Sink += sum;
+}
+
+// one op reads the whole fragmented test file in chunks of the given size
+static void bench_FatReadChunks(uint64_t iterations, uint32_t chunk)
+{
+    static uint8_t buffer[4096];
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        fat_File* file = s2_fat_Open(&g_Disk, "/bench.bin");
+        uint32_t total = 0, read;
+        while ((read = s2_fat_Read(&g_Disk, file, chunk, buffer)) > 0)
+            total += read;
+        s2_fat_Close(file);
+        g_Sink += total;
+    }
+}
+
+static void bench_FatRead16(uint64_t iterations) { bench_FatReadChunks(iterations, 16); }
+static void bench_FatRead512(uint64_t iterations) { bench_FatReadChunks(iterations, 512); }
+static void bench_FatRead4096(uint64_t iterations) { bench_FatReadChunks(iterations, 4096); }
+
+// formats into the log ring and drains it to the screen right away, like stage2 does
+static void bench_Printf10(uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+        s2_printf("%u", (unsigned)(i * 2654435761u));
+}
+
+static void bench_Printf16(uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+        s2_printf("%x", (unsigned)(i * 2654435761u));
+}
+
+// empty records, so this is the ring alone: a drain every time it fills up
+static void bench_LogRecord(uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        void* record = s2_log_Reserve();
+        if (record != NULL)
+            s2_log_Commit(record, 0);
+    }
+}
+
+static const char g_Line[] = "module /modules/serial.mod                        # 64 bytes\n";
+
+static void bench_Strlen(uint64_t iterations)
+{
+    unsigned sum = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        sum += s2_strlen(g_Line + (i & 7));
+    g_Sink += sum;
+}
+
+static void bench_Strchr(uint64_t iterations)
+{
+    uintptr_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        sum += (uintptr_t)s2_strchr(g_Line + (i & 7), '\n');
+    g_Sink += sum;
+}
+
+// copies between two low memory buffers, like the bounce buffer copies in stage2
+static void bench_Memcpy(uint64_t iterations, void* (*fn)(void*, const void*, uint32_t), uint32_t size)
+{
+    uint8_t* src = (uint8_t*)s2_bench_LowMemory + 0x30000;
+    uint8_t* dst = (uint8_t*)s2_bench_LowMemory + 0x70000;
+    for (uint64_t i = 0; i < iterations; i++)
+        fn(dst, src, size);
+    g_Sink += dst[size - 1];
+}
+
+static void bench_Memcpy512(uint64_t iterations) { bench_Memcpy(iterations, s2_memcpy, 512); }
+static void bench_Memcpy64K(uint64_t iterations) { bench_Memcpy(iterations, s2_memcpy, 0x10000); }
+static void bench_MemcpyMovsd64K(uint64_t iterations) { bench_Memcpy(iterations, s2_memcpy_movsd, 0x10000); }
+static void bench_MemcpySse264K(uint64_t iterations) { bench_Memcpy(iterations, s2_memcpy_sse2, 0x10000); }
+static void bench_MemcpyErms64K(uint64_t iterations) { bench_Memcpy(iterations, s2_memcpy_erms, 0x10000); }
+
+// a full line every 80 characters, so this includes one scroll per line
+static void bench_Putc(uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+        s2_putc('a' + i % 26);
+}
+
+static void bench_Scrollback(uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+        s2_scrollback(1);
+}
+
+//
+// Setup
+//
+
+static void bench_SetFatEntry(uint8_t* fat, uint32_t cluster, uint32_t value)
+{
+    uint32_t index = cluster * 3 / 2;
+    if (cluster % 2 == 0)
+    {
+        fat[index] = value & 0xFF;
+        fat[index + 1] = (fat[index + 1] & 0xF0) | ((value >> 8) & 0x0F);
+    }
+    else
+    {
+        fat[index] = (fat[index] & 0x0F) | ((value << 4) & 0xF0);
+        fat[index + 1] = (value >> 4) & 0xFF;
+    }
+}
+
+// even clusters of the file from cluster 2 on, odd ones from right after that
+static uint32_t bench_FileCluster(uint32_t index)
+{
+    return (index % 2 == 0 ? 2 : 2 + BENCH_FILE_CLUSTERS) + index / 2;
+}
+
+// Formats g_Image as a floppy with one file whose clusters alternate between two
+// areas of the disk, so every cluster starts a new extent.
+static void bench_MakeImage()
+{
+    uint8_t* bs = g_Image;
+    bs[0] = 0xEB; bs[1] = 0x3C; bs[2] = 0x90;
+    memcpy(bs + 3, "MSWIN4.1", 8);
+    *(uint16_t*)(bs + 11) = SECTOR_SIZE;
+    bs[13] = 1;                                         // sectors per cluster
+    *(uint16_t*)(bs + 14) = 1;                          // reserved sectors
+    bs[16] = 2;                                         // FAT count
+    *(uint16_t*)(bs + 17) = FLOPPY_ROOT_ENTRIES;
+    *(uint16_t*)(bs + 19) = FLOPPY_SECTORS;
+    bs[21] = 0xF0;
+    *(uint16_t*)(bs + 22) = FLOPPY_FAT_SECTORS;
+    *(uint16_t*)(bs + 24) = FLOPPY_SPT;
+    *(uint16_t*)(bs + 26) = FLOPPY_HEADS;
+    bs[510] = 0x55; bs[511] = 0xAA;
+
+    uint8_t* fat = g_Image + SECTOR_SIZE;
+    bench_SetFatEntry(fat, 0, 0xFF0);
+    bench_SetFatEntry(fat, 1, 0xFFF);
+
+    for (uint32_t i = 0; i < BENCH_FILE_CLUSTERS; i++)
+    {
+        uint32_t cluster = bench_FileCluster(i);
+        bench_SetFatEntry(fat, cluster, i + 1 == BENCH_FILE_CLUSTERS ? 0xFFF : bench_FileCluster(i + 1));
+
+        uint8_t* data = g_Image + (FLOPPY_DATA_LBA + cluster - 2) * SECTOR_SIZE;
+        for (uint32_t j = 0; j < SECTOR_SIZE; j++)
+            data[j] = (uint8_t)(i + j);
+    }
+    memcpy(fat + FLOPPY_FAT_SECTORS * SECTOR_SIZE, fat, FLOPPY_FAT_SECTORS * SECTOR_SIZE);
+
+    g_FileSize = BENCH_FILE_CLUSTERS * SECTOR_SIZE - 100;
+    uint8_t* entry = g_Image + (1 + 2 * FLOPPY_FAT_SECTORS) * SECTOR_SIZE;
+    memcpy(entry, "BENCH   BIN", 11);
+    *(uint16_t*)(entry + 26) = 2;                       // first cluster
+    *(uint32_t*)(entry + 28) = g_FileSize;
+}
+
+static bool bench_Setup()
+{
+    // stage2 truncates addresses to 32 bits for the DMA boundary and low memory
+    // checks, with the low megabyte at a multiple of 4 GiB they come out as on
+    // real hardware. Only the address space is reserved, the megabyte is mapped.
+    uint64_t alignment = sizeof(void*) > 4 ? 1ull << 32 : 0x10000;
+    uint8_t* reserved = mmap(NULL, alignment + LOWMEM_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    uintptr_t low = ((uintptr_t)reserved + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (reserved == MAP_FAILED || mprotect((void*)low, LOWMEM_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        fprintf(stderr, "bench: can't map a stand-in for low memory\n");
+        return false;
+    }
+
+    s2_bench_LowMemory = low;
+    s2_g_ScreenBuffer = (uint8_t*)low + LOWMEM_VGA;
+
+    bench_MakeImage();
+    s2_bench_DiskImage = g_Image;
+    s2_bench_DiskSectors = FLOPPY_SECTORS;
+    s2_bench_DiskSectorsPerTrack = FLOPPY_SPT;
+    s2_bench_DiskHeads = FLOPPY_HEADS;
+
+    s2_cpu_Initialize();
+    s2_memory_Initialize();
+    s2_clrscr();
+    s2_log_Initialize();
+
+    // drive 0x10 is neither a hard disk nor a drive the floppy controller is tried on
+    if (!s2_disk_Initialize(&g_Disk, 0x10) || !s2_fat_Initialize(&g_Disk))
+    {
+        fprintf(stderr, "bench: stage2 couldn't mount the test image\n");
+        return false;
+    }
+
+    // a benchmark of a broken fat_Read isn't worth anything
+    static uint8_t contents[BENCH_FILE_CLUSTERS * SECTOR_SIZE];
+    fat_File* file = s2_fat_Open(&g_Disk, "/bench.bin");
+    if (file == NULL || s2_fat_Read(&g_Disk, file, sizeof(contents), contents) != g_FileSize)
+    {
+        fprintf(stderr, "bench: stage2 couldn't read the test file\n");
+        return false;
+    }
+    s2_fat_Close(file);
+
+    for (uint32_t i = 0; i < g_FileSize; i++)
+    {
+        if (contents[i] != (uint8_t)(i / SECTOR_SIZE + i % SECTOR_SIZE))
+        {
+            fprintf(stderr, "bench: stage2 read the test file wrong at offset %u\n", i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//
+// Baseline
+//
+
+static bench_Result* bench_Find(const char* name)
+{
+    for (int i = 0; i < g_ResultCount; i++)
+        if (strcmp(g_Results[i].Name, name) == 0)
+            return &g_Results[i];
+
+    return NULL;
+}
+
+static void bench_LoadBaseline(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "bench: no baseline at %s\n", path);
+        return;
+    }
+
+    char line[256], name[128];
+    double ns;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#' || sscanf(line, "%127s %lf", name, &ns) != 2)
+            continue;
+
+        bench_Result* result = bench_Find(name);
+        if (result != NULL)
+            result->Baseline = ns;
+    }
+
+    fclose(file);
+}
+
+static bool bench_SaveBaseline(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "bench: can't write %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "# name ns/op, written by tools/bench (memcpy dispatches to %s)\n", s2_memory_Implementation());
+    for (int i = 0; i < g_ResultCount; i++)
+        fprintf(file, "%s %.2f\n", g_Results[i].Name, g_Results[i].NsPerOp);
+
+    fclose(file);
+    return true;
+}
+
+// Returns the number of benchmarks slower than the baseline by more than threshold percent.
+static int bench_Report(double threshold)
+{
+    int regressions = 0;
+
+    printf("%-24s %12s %10s %12s %9s\n", "benchmark", "ns/op", "allocs/op", "baseline", "delta");
+    for (int i = 0; i < g_ResultCount; i++)
+    {
+        bench_Result* result = &g_Results[i];
+        printf("%-24s %12.2f %10.2f", result->Name, result->NsPerOp, result->AllocsPerOp);
+
+        if (result->Baseline > 0)
+        {
+            double delta = (result->NsPerOp - result->Baseline) * 100.0 / result->Baseline;
+            bool regressed = delta > threshold;
+            printf(" %12.2f %+8.1f%%%s", result->Baseline, delta, regressed ? " !" : "");
+            regressions += regressed;
+        }
+
+        printf("\n");
+    }
+
+    return regressions;
+}
+
+static void bench_Usage(const char* self)
+{
+    fprintf(stderr, "Usage: %s [-b baseline] [-w baseline] [-t percent] [filter]\n", self);
+    fprintf(stderr, "  -b  compare against a baseline file\n");
+    fprintf(stderr, "  -w  write the results as a new baseline file\n");
+    fprintf(stderr, "  -t  fail if a benchmark is slower than the baseline by more than this (default %.0f)\n", DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char** argv)
+{
+    const char* baseline = NULL;
+    const char* save = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            baseline = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            save = argv[++i];
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (argv[i][0] != '-' && g_Filter == NULL)
+            g_Filter = argv[i];
+        else
+        {
+            bench_Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!bench_Setup())
+        return 1;
+
+    bench_Run("fat_NextCluster", bench_FatNextCluster);
+    bench_Run("disk_LBA2CHS", bench_LBA2CHS);
+    bench_Run("fat_Read/16", bench_FatRead16);
+    bench_Run("fat_Read/512", bench_FatRead512);
+    bench_Run("fat_Read/4096", bench_FatRead4096);
+    bench_Run("printf/10", bench_Printf10);
+    bench_Run("printf/16", bench_Printf16);
+    bench_Run("log_Record", bench_LogRecord);
+    bench_Run("strlen", bench_Strlen);
+    bench_Run("strchr", bench_Strchr);
+    bench_Run("memcpy/512", bench_Memcpy512);
+    bench_Run("memcpy/64K", bench_Memcpy64K);
+    bench_Run("memcpy_movsd/64K", bench_MemcpyMovsd64K);
+    bench_Run("memcpy_sse2/64K", bench_MemcpySse264K);
+    bench_Run("memcpy_erms/64K", bench_MemcpyErms64K);
+    bench_Run("putc", bench_Putc);
+    bench_Run("scrollback", bench_Scrollback);
+
+    if (baseline != NULL)
+        bench_LoadBaseline(baseline);
+
+    printf("memcpy dispatches to %s\n", s2_memory_Implementation());
+    int regressions = bench_Report(threshold);
+
+    if (save != NULL && !bench_SaveBaseline(save))
+        return 1;
+
+    if (regressions > 0)
+    {
+        printf("%d benchmark(s) regressed by more than %.0f%%\n", regressions, threshold);
+        return 2;
+    }
+
+    return 0;
+}
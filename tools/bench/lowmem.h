@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+// Force-included into the host build of stage2: memdefs.h addresses become
+// offsets into the buffer bench.c maps as the low megabyte, so the harness needs
+// no fixed low mappings (root, or a lowered vm.mmap_min_addr).
+extern uintptr_t bench_LowMemory;
+#define MEMORY_BASE bench_LowMemory
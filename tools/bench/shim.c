@@ -0,0 +1,92 @@
+// Stands in for x86.asm when the stage2 sources are built for the host. Compiled
+// together with them, so it is linked against stage2's memcpy and gets the same
+// symbol prefix.
+#include "x86.h"
+#include "memory.h"
+#include <cpuid.h>
+
+#define SECTOR_SIZE 512
+
+const uint8_t* bench_DiskImage;
+uint32_t bench_DiskSectors;
+uint16_t bench_DiskSectorsPerTrack;
+uint16_t bench_DiskHeads;
+uint32_t bench_DiskReads;
+uintptr_t bench_LowMemory;
+
+void x86_outb(uint16_t port, uint8_t value) { }
+uint8_t x86_inb(uint16_t port) { return 0xFF; }
+void x86_outw(uint16_t port, uint16_t value) { }
+uint16_t x86_inw(uint16_t port) { return 0xFFFF; }
+void x86_outl(uint16_t port, uint32_t value) { }
+uint32_t x86_inl(uint16_t port) { return 0xFFFFFFFF; }
+
+bool x86_Disk_GetDriveParams(uint8_t drive, uint8_t* driveTypeOut, uint16_t* cylindersOut, uint16_t* sectorsOut, uint16_t* headsOut)
+{
+    *driveTypeOut = 4;
+    *sectorsOut = bench_DiskSectorsPerTrack;
+    *headsOut = bench_DiskHeads;
+    *cylindersOut = bench_DiskSectors / (bench_DiskSectorsPerTrack * bench_DiskHeads);
+    return true;
+}
+
+bool x86_Disk_Reset(uint8_t drive)
+{
+    return true;
+}
+
+bool x86_Disk_Read(uint8_t drive, uint16_t cylinder, uint16_t sector, uint16_t head, uint8_t count, void* lowerDataOut)
+{
+    uint32_t lba = (cylinder * bench_DiskHeads + head) * bench_DiskSectorsPerTrack + sector - 1;
+    if (lba + count > bench_DiskSectors)
+        return false;
+
+    bench_DiskReads++;
+    memcpy(lowerDataOut, bench_DiskImage + lba * SECTOR_SIZE, count * SECTOR_SIZE);
+    return true;
+}
+
+bool x86_Disk_ExtensionsPresent(uint8_t drive)
+{
+    return true;
+}
+
+bool x86_Disk_ExtendedRead(uint8_t drive, uint32_t lba, uint16_t count, void* lowerDataOut)
+{
+    if (lba + count > bench_DiskSectors)
+        return false;
+
+    bench_DiskReads++;
+    memcpy(lowerDataOut, bench_DiskImage + lba * SECTOR_SIZE, count * SECTOR_SIZE);
+    return true;
+}
+
+uint16_t x86_Keyboard_Poll()
+{
+    return 0;
+}
+
+int x86_E820GetNextBlock(x86_E820Block* blockOut, uint32_t* continuationId)
+{
+    return -1;
+}
+
+bool x86_CPUID_Supported()
+{
+    return true;
+}
+
+void x86_CPUID(uint32_t leaf, uint32_t subleaf, uint32_t* regsOut)
+{
+    __cpuid_count(leaf, subleaf, regsOut[0], regsOut[1], regsOut[2], regsOut[3]);
+}
+
+// the host OS already runs with SSE enabled and paging is never turned on here
+void x86_EnableSSE() { }
+void x86_EnablePaging(uint32_t cr3, uint32_t cr4Flags) { }
+
+// smp.asm, nothing here submits SMP work so the trampoline is never copied
+uint8_t smp_Trampoline[1];
+uint8_t smp_TrampolineParams[1];
+uint8_t smp_TrampolineProtectedMode[1];
+uint8_t smp_TrampolineEnd[1];
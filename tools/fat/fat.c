@@ -1,22 +1,36 @@
-#include "fat.h"
-#include "stdio.h"
-#include "string.h"
-#include "memory.h"
-#include "ctype.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "../../src/libs/boot/blocklist.h"
+#include "../../src/libs/boot/kernelimage.h"
 
 #define SECTOR_SIZE             512
 #define MAX_PATH_SIZE           256
-#define MAX_FILE_HANDLES        10
-#define ROOT_DIRECTORY_HANDLE   -1
-#define MEMORY_FAT_SIZE         0x10000
+#define MAX_DIR_SECTORS         4096
+#define DELETED_ENTRY           0xE5
+#define MAX_WRITE_VECTORS       1024
+#define MAX_DIR_DEPTH           32
+#define MAX_WORKERS             64
 
 #define min(a,b)    ((a) < (b) ? (a) : (b))
 #define max(a,b)    ((a) > (b) ? (a) : (b))
 
 #pragma pack(push, 1)
 
-typedef struct 
+typedef struct
 {
     uint8_t BootJumpInstruction[3];
     uint8_t OemIdentifier[8];
@@ -45,329 +59,1754 @@ typedef struct
 
 } FAT_BootSector;
 
+typedef struct
+{
+    uint8_t Name[11];
+    uint8_t Attributes;
+    uint8_t _Reserved;
+    uint8_t CreatedTimeTenths;
+    uint16_t CreatedTime;
+    uint16_t CreatedDate;
+    uint16_t AccessedDate;
+    uint16_t FirstClusterHigh;
+    uint16_t ModifiedTime;
+    uint16_t ModifiedDate;
+    uint16_t FirstClusterLow;
+    uint32_t Size;
+} FAT_DirectoryEntry;
+
 #pragma pack(pop)
 
+enum FAT_Attributes
+{
+    FAT_ATTRIBUTE_READ_ONLY         = 0x01,
+    FAT_ATTRIBUTE_HIDDEN            = 0x02,
+    FAT_ATTRIBUTE_SYSTEM            = 0x04,
+    FAT_ATTRIBUTE_VOLUME_ID         = 0x08,
+    FAT_ATTRIBUTE_DIRECTORY         = 0x10,
+    FAT_ATTRIBUTE_ARCHIVE           = 0x20,
+    FAT_ATTRIBUTE_LFN               = FAT_ATTRIBUTE_READ_ONLY | FAT_ATTRIBUTE_HIDDEN | FAT_ATTRIBUTE_SYSTEM | FAT_ATTRIBUTE_VOLUME_ID
+};
 
+// Sectors outside the FAT (directories) are cached here until FAT_Flush
 typedef struct
 {
-    FAT_File Public;
-    bool Opened;
-    uint32_t FirstCluster;
-    uint32_t CurrentCluster;
-    uint32_t CurrentSectorInCluster;
-    uint8_t Buffer[SECTOR_SIZE];
-
-} FAT_FileData;
+    uint32_t Lba;
+    bool Dirty;
+    uint8_t Data[SECTOR_SIZE];
+} FAT_CachedSector;
 
+// A directory is either the fixed root directory region or a cluster chain;
+// entries are addressed by their index across the directory's sectors
 typedef struct
 {
-    union
-    {
-        FAT_BootSector BootSector;
-        uint8_t BootSectorBytes[SECTOR_SIZE];
-    } BS;
+    uint32_t FirstCluster;      // 0 for the root directory
+    uint32_t Sectors[MAX_DIR_SECTORS];
+    uint32_t SectorCount;
+} FAT_Directory;
 
-    FAT_FileData RootDirectory;
+// A directory entry found while walking the tree, with its full path
+typedef struct
+{
+    char Path[MAX_PATH_SIZE];
+    FAT_DirectoryEntry Entry;
+} FAT_WalkEntry;
 
-    FAT_FileData OpenedFiles[MAX_FILE_HANDLES];
+typedef bool (*FAT_WalkCallback)(const FAT_WalkEntry* entry, void* context);
 
-} FAT_Data;
+typedef struct
+{
+    uint32_t Lba;
+    uint32_t Sectors;
+} FAT_Extent;
 
-static FAT_Data g_ActualData;
-static FAT_Data far* g_Data;
-static uint8_t far* g_Fat = NULL;
+static int g_Disk = -1;
+static const uint8_t* g_Image = NULL;   // read-only commands map the whole image instead of reading it
+static size_t g_ImageSize;
+static union
+{
+    FAT_BootSector BootSector;
+    uint8_t BootSectorBytes[SECTOR_SIZE];
+} g_BS;
+static uint8_t* g_Fat = NULL;           // in-memory copy of the first FAT, written back to every copy
+static bool* g_FatDirty = NULL;         // one flag per FAT sector
+static bool g_IsFat16;
+static uint32_t g_ClusterCount;         // highest valid cluster is g_ClusterCount + 1
+static uint32_t g_RootDirLba;
+static uint32_t g_RootDirSectors;
 static uint32_t g_DataSectionLba;
+static uint32_t g_ClusterSize;
 
+static FAT_CachedSector** g_Cache = NULL;
+static uint32_t g_CacheCount = 0;
+static uint32_t g_CacheCapacity = 0;
 
-bool FAT_ReadBootSector(DISK* disk)
+// Returns the sectors inside the mapped image, or NULL if they are past its end
+const uint8_t* mappedSectors(uint32_t lba, uint32_t count)
 {
-    return DISK_ReadSectors(disk, 0, 1, g_Data->BS.BootSectorBytes);
+    if (((uint64_t)lba + count) * SECTOR_SIZE > g_ImageSize)
+        return NULL;
+
+    return g_Image + (size_t)lba * SECTOR_SIZE;
 }
 
-bool FAT_ReadFat(DISK* disk)
+bool readSectors(uint32_t lba, uint32_t count, void* bufferOut)
 {
-    return DISK_ReadSectors(disk, g_Data->BS.BootSector.ReservedSectors, g_Data->BS.BootSector.SectorsPerFat, g_Fat);
+    ssize_t bytes = (ssize_t)count * SECTOR_SIZE;
+
+    if (g_Image != NULL)
+    {
+        const uint8_t* data = mappedSectors(lba, count);
+        if (data == NULL)
+            return false;
+
+        memcpy(bufferOut, data, bytes);
+        return true;
+    }
+
+    return pread(g_Disk, bufferOut, bytes, (off_t)lba * SECTOR_SIZE) == bytes;
 }
 
-bool FAT_Initialize(DISK* disk)
+bool writeSectors(uint32_t lba, uint32_t count, const void* buffer)
 {
-    g_Data = &g_ActualData;
+    ssize_t bytes = (ssize_t)count * SECTOR_SIZE;
+    return pwrite(g_Disk, buffer, bytes, (off_t)lba * SECTOR_SIZE) == bytes;
+}
 
-    // read boot sector
-    if (!FAT_ReadBootSector(disk))
+bool FAT_Initialize(const char* imagePath, bool writable)
+{
+    g_Disk = open(imagePath, writable ? O_RDWR : O_RDONLY);
+    if (g_Disk < 0)
     {
-        printf("FAT: read boot sector failed\r\n");
+        fprintf(stderr, "Cannot open disk image %s!\n", imagePath);
         return false;
     }
 
-    // read FAT
-    uint32_t fatSize = g_Data->BS.BootSector.BytesPerSector * g_Data->BS.BootSector.SectorsPerFat;
-    g_Fat = (uint8_t*)malloc(fatSize + SECTOR_SIZE);
-    if (sizeof(FAT_Data) + fatSize >= MEMORY_FAT_SIZE)
+    // writes go through the sector cache and FAT_Flush, everything else reads the mapping
+    if (!writable)
     {
-        printf("FAT: not enough memory to read FAT! Required %lu, only have %u\r\n", sizeof(FAT_Data) + fatSize, MEMORY_FAT_SIZE);
-        return false;
+        struct stat st;
+        void* image = fstat(g_Disk, &st) == 0 && st.st_size > 0
+            ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, g_Disk, 0)
+            : MAP_FAILED;
+
+        if (image == MAP_FAILED)
+        {
+            fprintf(stderr, "Cannot map disk image %s!\n", imagePath);
+            return false;
+        }
+
+        madvise(image, st.st_size, MADV_WILLNEED);
+        g_Image = (const uint8_t*)image;
+        g_ImageSize = st.st_size;
     }
 
-    if (!FAT_ReadFat(disk))
+    // read boot sector
+    if (!readSectors(0, 1, g_BS.BootSectorBytes))
     {
-        printf("FAT: read FAT failed\r\n");
+        fprintf(stderr, "FAT: read boot sector failed\n");
         return false;
     }
 
-    // open root directory file
-    uint32_t rootDirLba = g_Data->BS.BootSector.ReservedSectors + g_Data->BS.BootSector.SectorsPerFat * g_Data->BS.BootSector.FatCount;
-    uint32_t rootDirSize = sizeof(FAT_DirectoryEntry) * g_Data->BS.BootSector.DirEntryCount;
+    if (g_BS.BootSector.BytesPerSector != SECTOR_SIZE || g_BS.BootSector.SectorsPerCluster == 0 || g_BS.BootSector.FatCount == 0)
+    {
+        fprintf(stderr, "FAT: unsupported boot sector\n");
+        return false;
+    }
 
-    g_Data->RootDirectory.Public.Handle = ROOT_DIRECTORY_HANDLE;
-    g_Data->RootDirectory.Public.IsDirectory = true;
-    g_Data->RootDirectory.Public.Position = 0;
-    g_Data->RootDirectory.Public.Size = sizeof(FAT_DirectoryEntry) * g_Data->BS.BootSector.DirEntryCount;
-    g_Data->RootDirectory.Opened = true;
-    g_Data->RootDirectory.FirstCluster = 
-    g_Data->RootDirectory.CurrentCluster = 0;
-    g_Data->RootDirectory.CurrentSectorInCluster = 0;
+    // read FAT, or use it in place when it is never modified
+    uint32_t fatSectors = g_BS.BootSector.SectorsPerFat;
+    g_FatDirty = (bool*)calloc(fatSectors, sizeof(bool));
+    if (g_Image != NULL)
+        g_Fat = (uint8_t*)mappedSectors(g_BS.BootSector.ReservedSectors, fatSectors);
+    else if ((g_Fat = (uint8_t*)malloc(fatSectors * SECTOR_SIZE)) != NULL
+             && !readSectors(g_BS.BootSector.ReservedSectors, fatSectors, g_Fat))
+        g_Fat = NULL;
 
-    if (!DISK_ReadSectors(disk, rootDirLba, 1, g_Data->RootDirectory.Buffer))
+    if (g_Fat == NULL)
     {
-        printf("FAT: read root directory failed\r\n");
+        fprintf(stderr, "FAT: read FAT failed\n");
         return false;
     }
 
-    // calculate data section
-    uint32_t rootDirSectors = (rootDirSize + g_Data->BS.BootSector.BytesPerSector - 1) / g_Data->BS.BootSector.BytesPerSector;
-    g_DataSectionLba = rootDirLba + rootDirSectors;
-
-    // reset opened files
-    for (int i = 0; i < MAX_FILE_HANDLES; i++)
-        g_Data->OpenedFiles[i].Opened = false;
+    // calculate layout
+    uint32_t totalSectors = g_BS.BootSector.TotalSectors ? g_BS.BootSector.TotalSectors : g_BS.BootSector.LargeSectorCount;
+    g_RootDirLba = g_BS.BootSector.ReservedSectors + fatSectors * g_BS.BootSector.FatCount;
+    g_RootDirSectors = (g_BS.BootSector.DirEntryCount * sizeof(FAT_DirectoryEntry) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    g_DataSectionLba = g_RootDirLba + g_RootDirSectors;
+    g_ClusterSize = g_BS.BootSector.SectorsPerCluster * SECTOR_SIZE;
+    g_ClusterCount = (totalSectors - g_DataSectionLba) / g_BS.BootSector.SectorsPerCluster;
+    g_IsFat16 = g_ClusterCount >= 4085;
 
+    // the FAT must be able to describe every cluster
+    uint32_t fatEntries = g_IsFat16 ? fatSectors * SECTOR_SIZE / 2 : fatSectors * SECTOR_SIZE * 2 / 3;
+    g_ClusterCount = min(g_ClusterCount, fatEntries - 2);
     return true;
 }
 
 uint32_t FAT_ClusterToLba(uint32_t cluster)
 {
-    return g_DataSectionLba + (cluster - 2) * g_Data->BS.BootSector.SectorsPerCluster;
+    return g_DataSectionLba + (cluster - 2) * g_BS.BootSector.SectorsPerCluster;
+}
+
+uint32_t FAT_NextCluster(uint32_t currentCluster)
+{
+    if (g_IsFat16)
+        return ((uint16_t*)g_Fat)[currentCluster];
+
+    uint32_t fatIndex = currentCluster * 3 / 2;
+    uint16_t value = g_Fat[fatIndex] | (g_Fat[fatIndex + 1] << 8);
+
+    if (currentCluster % 2 == 0)
+        return value & 0x0FFF;
+    else
+        return value >> 4;
 }
 
-FAT_File far* FAT_OpenEntry(DISK* disk, FAT_DirectoryEntry* entry)
+void FAT_SetCluster(uint32_t cluster, uint32_t value)
 {
-    // find empty handle
-    int handle = -1;
-    for (int i = 0; i < MAX_FILE_HANDLES && handle < 0; i++)
+    uint32_t fatIndex;
+
+    if (g_IsFat16)
+    {
+        fatIndex = cluster * 2;
+        g_Fat[fatIndex] = value & 0xFF;
+        g_Fat[fatIndex + 1] = (value >> 8) & 0xFF;
+    }
+    else
     {
-        if (!g_Data->OpenedFiles[i].Opened)
-            handle = i;
+        fatIndex = cluster * 3 / 2;
+        if (cluster % 2 == 0)
+        {
+            g_Fat[fatIndex] = value & 0xFF;
+            g_Fat[fatIndex + 1] = (g_Fat[fatIndex + 1] & 0xF0) | ((value >> 8) & 0x0F);
+        }
+        else
+        {
+            g_Fat[fatIndex] = (g_Fat[fatIndex] & 0x0F) | ((value << 4) & 0xF0);
+            g_Fat[fatIndex + 1] = (value >> 4) & 0xFF;
+        }
     }
 
-    // out of handles
-    if (handle < 0)
+    g_FatDirty[fatIndex / SECTOR_SIZE] = true;
+    g_FatDirty[(fatIndex + 1) / SECTOR_SIZE] = true;
+}
+
+uint32_t FAT_EndOfChain()
+{
+    return g_IsFat16 ? 0xFFFF : 0x0FFF;
+}
+
+bool FAT_IsValidCluster(uint32_t cluster)
+{
+    return cluster >= 2 && cluster < g_ClusterCount + 2;
+}
+
+bool FAT_IsEndOfChain(uint32_t value)
+{
+    return value >= (g_IsFat16 ? 0xFFF8 : 0x0FF8);
+}
+
+bool FAT_IsBadCluster(uint32_t value)
+{
+    return value == (g_IsFat16 ? 0xFFF7 : 0x0FF7);
+}
+
+// Returns a cached copy of the sector, loading it on first use. Read-only
+// commands get the sector straight from the mapped image.
+uint8_t* FAT_GetSector(uint32_t lba)
+{
+    if (g_Image != NULL)
     {
-        printf("FAT: out of file handles\r\n");
-        return false;
+        uint8_t* sector = (uint8_t*)mappedSectors(lba, 1);
+        if (sector == NULL)
+            fprintf(stderr, "FAT: read error at lba %u\n", lba);
+        return sector;
     }
 
-    // setup vars
-    FAT_FileData far* fd = &g_Data->OpenedFiles[handle];
-    fd->Public.Handle = handle;
-    fd->Public.IsDirectory = (entry->Attributes & FAT_ATTRIBUTE_DIRECTORY) != 0;
-    fd->Public.Position = 0;
-    fd->Public.Size = entry->Size;
-    fd->FirstCluster = entry->FirstClusterLow + ((uint32_t)entry->FirstClusterHigh << 16);
-    fd->CurrentCluster = fd->FirstCluster;
-    fd->CurrentSectorInCluster = 0;
+    for (uint32_t i = 0; i < g_CacheCount; i++)
+        if (g_Cache[i]->Lba == lba)
+            return g_Cache[i]->Data;
 
-    if (!DISK_ReadSectors(disk, FAT_ClusterToLba(fd->CurrentCluster), 1, fd->Buffer))
+    if (g_CacheCount == g_CacheCapacity)
     {
-        printf("FAT: read error\r\n");
-        return false;
+        g_CacheCapacity = max(16, g_CacheCapacity * 2);
+        g_Cache = (FAT_CachedSector**)realloc(g_Cache, g_CacheCapacity * sizeof(FAT_CachedSector*));
     }
 
-    fd->Opened = true;
-    return &fd->Public;
+    // sectors are allocated individually so pointers into them stay valid
+    FAT_CachedSector* sector = (FAT_CachedSector*)malloc(sizeof(FAT_CachedSector));
+    if (!readSectors(lba, 1, sector->Data))
+    {
+        fprintf(stderr, "FAT: read error at lba %u\n", lba);
+        free(sector);
+        return NULL;
+    }
+
+    sector->Lba = lba;
+    sector->Dirty = false;
+    g_Cache[g_CacheCount++] = sector;
+    return sector->Data;
 }
 
-uint32_t FAT_NextCluster(uint32_t currentCluster)
+void FAT_MarkDirty(uint32_t lba)
 {
-    uint32_t fatIndex = currentCluster * 3 / 2;
+    for (uint32_t i = 0; i < g_CacheCount; i++)
+        if (g_Cache[i]->Lba == lba)
+            g_Cache[i]->Dirty = true;
+}
 
-    if (currentCluster % 2 == 0)
-        return (*(uint16_t*)(g_Fat + fatIndex)) & 0x0FFF;
-    else
-        return (*(uint16_t*)(g_Fat + fatIndex)) >> 4;
+typedef struct
+{
+    uint32_t Lba;
+    const uint8_t* Data;
+} FAT_PendingWrite;
+
+static int FAT_ComparePendingWrites(const void* a, const void* b)
+{
+    uint32_t lbaA = ((const FAT_PendingWrite*)a)->Lba;
+    uint32_t lbaB = ((const FAT_PendingWrite*)b)->Lba;
+    return (lbaA > lbaB) - (lbaA < lbaB);
 }
 
-uint32_t FAT_Read(DISK* disk, FAT_File far* file, uint32_t byteCount, void* dataOut)
+// Writes every dirty FAT sector (to all FAT copies) and dirty cached sector in
+// one pass, sorted by LBA, with adjacent sectors combined into a single write
+bool FAT_Flush()
 {
-    // get file data
-    FAT_FileData far* fd = (file->Handle == ROOT_DIRECTORY_HANDLE) 
-        ? &g_Data->RootDirectory 
-        : &g_Data->OpenedFiles[file->Handle];
+    uint32_t fatSectors = g_BS.BootSector.SectorsPerFat;
+    FAT_PendingWrite* writes = (FAT_PendingWrite*)malloc((fatSectors * g_BS.BootSector.FatCount + g_CacheCount) * sizeof(FAT_PendingWrite));
+    uint32_t count = 0;
 
-    uint8_t* u8DataOut = (uint8_t*)dataOut;
+    for (uint32_t copy = 0; copy < g_BS.BootSector.FatCount; copy++)
+    {
+        for (uint32_t i = 0; i < fatSectors; i++)
+        {
+            if (!g_FatDirty[i])
+                continue;
 
-    // don't read past the end of the file
-    if (!fd->Public.IsDirectory) 
-        byteCount = min(byteCount, fd->Public.Size - fd->Public.Position);
+            writes[count].Lba = g_BS.BootSector.ReservedSectors + copy * fatSectors + i;
+            writes[count].Data = g_Fat + i * SECTOR_SIZE;
+            count++;
+        }
+    }
 
-    while (byteCount > 0)
+    for (uint32_t i = 0; i < g_CacheCount; i++)
     {
-        uint32_t leftInBuffer = SECTOR_SIZE - (fd->Public.Position % SECTOR_SIZE);
-        uint32_t take = min(byteCount, leftInBuffer);
+        if (!g_Cache[i]->Dirty)
+            continue;
 
-        memcpy(u8DataOut, fd->Buffer + fd->Public.Position % SECTOR_SIZE, take);
-        u8DataOut += take;
-        fd->Public.Position += take;
-        byteCount -= take;
+        writes[count].Lba = g_Cache[i]->Lba;
+        writes[count].Data = g_Cache[i]->Data;
+        count++;
+    }
+
+    qsort(writes, count, sizeof(FAT_PendingWrite), FAT_ComparePendingWrites);
+
+    bool ok = true;
+    struct iovec iov[MAX_WRITE_VECTORS];
+    uint32_t first = 0;
+    while (first < count && ok)
+    {
+        uint32_t last = first;
+        iov[0].iov_base = (void*)writes[first].Data;
+        iov[0].iov_len = SECTOR_SIZE;
 
-        // See if we need to read more data
-        if (leftInBuffer == take)
+        while (last + 1 < count && last + 1 - first < MAX_WRITE_VECTORS && writes[last + 1].Lba == writes[last].Lba + 1)
         {
-            // Special handling for root directory
-            if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
-            {
-                ++fd->CurrentCluster;
-
-                // read next sector
-                if (!DISK_ReadSectors(disk, fd->CurrentCluster, 1, fd->Buffer))
-                {
-                    printf("FAT: read error!\r\n");
-                    break;
-                }
-            }
-            else
-            {
-                // calculate next cluster & sector to read
-                if (++fd->CurrentSectorInCluster >= g_Data->BS.BootSector.SectorsPerCluster)
-                {
-                    fd->CurrentSectorInCluster = 0;
-                    fd->CurrentCluster = FAT_NextCluster(fd->CurrentCluster);
-                }
-
-                if (fd->CurrentCluster >= 0xFF8)
-                {
-                    // Mark end of file
-                    fd->Public.Size = fd->Public.Position;
-                    break;
-                }
-
-                // read next sector
-                if (!DISK_ReadSectors(disk, FAT_ClusterToLba(fd->CurrentCluster) + fd->CurrentSectorInCluster, 1, fd->Buffer))
-                {
-                    printf("FAT: read error!\r\n");
-                    break;
-                }
-            }
+            last++;
+            iov[last - first].iov_base = (void*)writes[last].Data;
+            iov[last - first].iov_len = SECTOR_SIZE;
         }
+
+        ssize_t bytes = (ssize_t)(last - first + 1) * SECTOR_SIZE;
+        ok = pwritev(g_Disk, iov, last - first + 1, (off_t)writes[first].Lba * SECTOR_SIZE) == bytes;
+        first = last + 1;
     }
 
-    return u8DataOut - (uint8_t*)dataOut;
-}
+    free(writes);
+    if (!ok)
+    {
+        fprintf(stderr, "FAT: write error while flushing\n");
+        return false;
+    }
 
-bool FAT_ReadEntry(DISK* disk, FAT_File far* file, FAT_DirectoryEntry* dirEntry)
-{
-    return FAT_Read(disk, file, sizeof(FAT_DirectoryEntry), dirEntry) == sizeof(FAT_DirectoryEntry);
+    memset(g_FatDirty, 0, fatSectors * sizeof(bool));
+    for (uint32_t i = 0; i < g_CacheCount; i++)
+        g_Cache[i]->Dirty = false;
+
+    return fsync(g_Disk) == 0;
 }
 
-void FAT_Close(FAT_File far* file)
+bool FAT_OpenDirectory(uint32_t firstCluster, FAT_Directory* dirOut)
 {
-    if (file->Handle == ROOT_DIRECTORY_HANDLE)
+    dirOut->FirstCluster = firstCluster;
+    dirOut->SectorCount = 0;
+
+    if (firstCluster == 0)
     {
-        file->Position = 0;
-        g_Data->RootDirectory.CurrentCluster = g_Data->RootDirectory.FirstCluster;
+        for (uint32_t i = 0; i < g_RootDirSectors; i++)
+            dirOut->Sectors[dirOut->SectorCount++] = g_RootDirLba + i;
+        return true;
     }
-    else
+
+    for (uint32_t cluster = firstCluster; FAT_IsValidCluster(cluster); cluster = FAT_NextCluster(cluster))
     {
-        g_Data->OpenedFiles[file->Handle].Opened = false;
+        for (uint32_t i = 0; i < g_BS.BootSector.SectorsPerCluster; i++)
+        {
+            if (dirOut->SectorCount == MAX_DIR_SECTORS)
+            {
+                fprintf(stderr, "FAT: directory too large\n");
+                return false;
+            }
+            dirOut->Sectors[dirOut->SectorCount++] = FAT_ClusterToLba(cluster) + i;
+        }
     }
+
+    return true;
 }
 
-bool FAT_FindFile(DISK* disk, FAT_File far* file, const char* name, FAT_DirectoryEntry* entryOut)
+uint32_t FAT_DirectoryEntryCount(FAT_Directory* dir)
 {
-    char fatName[11];
-    FAT_DirectoryEntry entry;
+    return dir->SectorCount * (SECTOR_SIZE / sizeof(FAT_DirectoryEntry));
+}
+
+FAT_DirectoryEntry* FAT_GetEntry(FAT_Directory* dir, uint32_t index)
+{
+    uint32_t perSector = SECTOR_SIZE / sizeof(FAT_DirectoryEntry);
+    uint8_t* sector = FAT_GetSector(dir->Sectors[index / perSector]);
+    if (sector == NULL)
+        return NULL;
+
+    return (FAT_DirectoryEntry*)sector + index % perSector;
+}
+
+void FAT_MarkEntryDirty(FAT_Directory* dir, uint32_t index)
+{
+    FAT_MarkDirty(dir->Sectors[index / (SECTOR_SIZE / sizeof(FAT_DirectoryEntry))]);
+}
+
+uint32_t FAT_EntryCluster(const FAT_DirectoryEntry* entry)
+{
+    return entry->FirstClusterLow + ((uint32_t)entry->FirstClusterHigh << 16);
+}
 
-    // convert from name to fat name
-    memset(fatName, ' ', sizeof(fatName));
+bool FAT_ToShortName(const char* name, char fatName[11])
+{
+    memset(fatName, ' ', 11);
 
-    const char* ext = strchr(name, '.');
+    const char* ext = strrchr(name, '.');
     if (ext == NULL)
-        ext = name + 11;
+        ext = name + strlen(name);
+
+    if (ext - name == 0 || ext - name > 8 || strlen(ext) > 4)
+        return false;
 
-    for (int i = 0; i < 8 && name[i] && name + i < ext; i++)
+    for (int i = 0; name + i < ext; i++)
         fatName[i] = toupper(name[i]);
 
-    if (ext != NULL)
+    if (*ext == '.')
+        for (int i = 0; ext[i + 1]; i++)
+            fatName[i + 8] = toupper(ext[i + 1]);
+
+    return true;
+}
+
+// Returns the entry index of name in dir, or -1
+int FAT_FindEntry(FAT_Directory* dir, const char* name)
+{
+    char fatName[11];
+    if (!FAT_ToShortName(name, fatName))
+        return -1;
+
+    uint32_t count = FAT_DirectoryEntryCount(dir);
+    for (uint32_t i = 0; i < count; i++)
     {
-        for (int i = 0; i < 3 && ext[i+1]; i++)
-            fatName[i + 8] = toupper(ext[i+1]);
+        FAT_DirectoryEntry* entry = FAT_GetEntry(dir, i);
+        if (entry == NULL || entry->Name[0] == 0x00)
+            break;
+
+        if (entry->Name[0] == DELETED_ENTRY || entry->Attributes == FAT_ATTRIBUTE_LFN || (entry->Attributes & FAT_ATTRIBUTE_VOLUME_ID))
+            continue;
+
+        if (memcmp(fatName, entry->Name, 11) == 0)
+            return (int)i;
     }
 
-    while (FAT_ReadEntry(disk, file, &entry))
+    return -1;
+}
+
+// Splits path into its parent directory and the last component
+bool FAT_ResolveParent(const char* path, FAT_Directory* parentOut, char* nameOut)
+{
+    char component[MAX_PATH_SIZE];
+
+    while (*path == '/')
+        path++;
+
+    if (!FAT_OpenDirectory(0, parentOut))
+        return false;
+
+    while (true)
     {
-        if (memcmp(fatName, entry.Name, 11) == 0)
+        const char* delim = strchr(path, '/');
+        uint32_t len = delim ? (uint32_t)(delim - path) : strlen(path);
+        if (len == 0 || len >= MAX_PATH_SIZE)
+        {
+            fprintf(stderr, "FAT: invalid path\n");
+            return false;
+        }
+
+        memcpy(component, path, len);
+        component[len] = '\0';
+
+        if (delim == NULL)
         {
-            *entryOut = entry;
+            strcpy(nameOut, component);
             return true;
         }
+
+        int index = FAT_FindEntry(parentOut, component);
+        FAT_DirectoryEntry* entry = index >= 0 ? FAT_GetEntry(parentOut, index) : NULL;
+        if (entry == NULL || !(entry->Attributes & FAT_ATTRIBUTE_DIRECTORY))
+        {
+            fprintf(stderr, "FAT: directory %s not found\n", component);
+            return false;
+        }
+
+        if (!FAT_OpenDirectory(FAT_EntryCluster(entry), parentOut))
+            return false;
+
+        path = delim + 1;
     }
-    
-    return false;
 }
 
-FAT_File far* FAT_Open(DISK* disk, const char* path)
+void FAT_FreeChain(uint32_t cluster)
 {
-    char name[MAX_PATH_SIZE];
+    while (FAT_IsValidCluster(cluster))
+    {
+        uint32_t next = FAT_NextCluster(cluster);
+        FAT_SetCluster(cluster, 0);
+        cluster = next;
+    }
+}
 
-    // ignore leading slash
-    if (path[0] == '/')
-        path++;
+// Allocates a chain of count clusters. A single contiguous run is preferred,
+// otherwise free clusters are taken in disk order. Returns the first cluster or 0.
+uint32_t FAT_AllocateChain(uint32_t count)
+{
+    uint32_t first = 0;
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
 
-    FAT_File far* current = &g_Data->RootDirectory.Public;
+    if (count == 0)
+        return 0;
 
-    while (*path) {
-        // extract next file name from path
-        bool isLast = false;
-        const char* delim = strchr(path, '/');
-        if (delim != NULL)
+    for (uint32_t cluster = 2; cluster < g_ClusterCount + 2 && runLength < count; cluster++)
+    {
+        if (FAT_NextCluster(cluster) != 0)
         {
-            memcpy(name, path, delim - path);
-            name[delim - path + 1] = '\0';
-            path = delim + 1;
+            runLength = 0;
+            continue;
         }
-        else
+
+        if (runLength++ == 0)
+            runStart = cluster;
+    }
+
+    uint32_t previous = 0;
+    uint32_t allocated = 0;
+    if (runLength >= count)
+    {
+        for (uint32_t i = 0; i < count; i++)
         {
-            unsigned len = strlen(path);
-            memcpy(name, path, len);
-            name[len + 1] = '\0';
-            path += len;
-            isLast = true;
+            if (previous != 0)
+                FAT_SetCluster(previous, runStart + i);
+            previous = runStart + i;
         }
-        
-        // find directory entry in current directory
-        FAT_DirectoryEntry entry;
-        if (FAT_FindFile(disk, current, name, &entry))
+        first = runStart;
+        allocated = count;
+    }
+    else
+    {
+        for (uint32_t cluster = 2; cluster < g_ClusterCount + 2 && allocated < count; cluster++)
         {
-            FAT_Close(current);
+            if (FAT_NextCluster(cluster) != 0)
+                continue;
 
-            // check if directory
-            if (!isLast && entry.Attributes & FAT_ATTRIBUTE_DIRECTORY == 0)
-            {
-                printf("FAT: %s not a directory\r\n", name);
-                return NULL;
-            }
+            if (previous != 0)
+                FAT_SetCluster(previous, cluster);
+            else
+                first = cluster;
+
+            // mark it used right away so it isn't picked twice
+            FAT_SetCluster(cluster, FAT_EndOfChain());
+            previous = cluster;
+            allocated++;
+        }
+    }
+
+    if (allocated < count)
+    {
+        FAT_FreeChain(first);
+        fprintf(stderr, "FAT: disk full\n");
+        return 0;
+    }
+
+    FAT_SetCluster(previous, FAT_EndOfChain());
+    return first;
+}
+
+// Writes data along the chain, one write per contiguous run of clusters
+bool FAT_WriteChain(uint32_t cluster, const uint8_t* data, uint32_t size)
+{
+    uint32_t clusters = (size + g_ClusterSize - 1) / g_ClusterSize;
+    uint8_t* padded = (uint8_t*)calloc(clusters, g_ClusterSize);
+    if (padded == NULL)
+    {
+        fprintf(stderr, "FAT: out of memory\n");
+        return false;
+    }
+
+    memcpy(padded, data, size);
+
+    bool ok = true;
+    uint32_t done = 0;
+    while (ok && done < clusters)
+    {
+        uint32_t runStart = cluster;
+        uint32_t runLength = 1;
+        cluster = FAT_NextCluster(cluster);
+        while (done + runLength < clusters && cluster == runStart + runLength)
+        {
+            runLength++;
+            cluster = FAT_NextCluster(cluster);
+        }
+
+        ok = writeSectors(FAT_ClusterToLba(runStart), runLength * g_BS.BootSector.SectorsPerCluster, padded + done * g_ClusterSize);
+        done += runLength;
+    }
+
+    free(padded);
+    if (!ok)
+        fprintf(stderr, "FAT: write error\n");
+
+    return ok;
+}
+
+void FAT_SetTimestamp(FAT_DirectoryEntry* entry)
+{
+    time_t now = time(NULL);
+    struct tm* tm = localtime(&now);
+
+    entry->ModifiedDate = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+    entry->ModifiedTime = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+    entry->AccessedDate = entry->ModifiedDate;
+}
+
+// Returns the index of a free entry, growing subdirectories by a cluster if needed
+int FAT_FindFreeEntry(FAT_Directory* dir)
+{
+    uint32_t count = FAT_DirectoryEntryCount(dir);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        FAT_DirectoryEntry* entry = FAT_GetEntry(dir, i);
+        if (entry == NULL)
+            return -1;
+
+        if (entry->Name[0] == 0x00 || entry->Name[0] == DELETED_ENTRY)
+            return (int)i;
+    }
+
+    if (dir->FirstCluster == 0)
+    {
+        fprintf(stderr, "FAT: root directory is full\n");
+        return -1;
+    }
+
+    uint32_t last = dir->FirstCluster;
+    while (FAT_IsValidCluster(FAT_NextCluster(last)))
+        last = FAT_NextCluster(last);
+
+    uint32_t cluster = FAT_AllocateChain(1);
+    if (cluster == 0)
+        return -1;
+
+    FAT_SetCluster(last, cluster);
+    for (uint32_t i = 0; i < g_BS.BootSector.SectorsPerCluster; i++)
+    {
+        uint8_t* sector = FAT_GetSector(FAT_ClusterToLba(cluster) + i);
+        if (sector == NULL)
+            return -1;
+
+        memset(sector, 0, SECTOR_SIZE);
+        FAT_MarkDirty(FAT_ClusterToLba(cluster) + i);
+    }
+
+    if (!FAT_OpenDirectory(dir->FirstCluster, dir))
+        return -1;
+
+    return (int)count;
+}
+
+// Formats an 8.3 name as NAME.EXT
+void FAT_FromShortName(const uint8_t fatName[11], char* nameOut)
+{
+    int length = 0;
+    for (int i = 0; i < 8 && fatName[i] != ' '; i++)
+        nameOut[length++] = fatName[i];
+
+    if (fatName[8] != ' ')
+    {
+        nameOut[length++] = '.';
+        for (int i = 8; i < 11 && fatName[i] != ' '; i++)
+            nameOut[length++] = fatName[i];
+    }
+
+    nameOut[length] = '\0';
+}
+
+// A path component that stays where it is put on the host: not empty, "." or
+// "..", and free of separators and control bytes a corrupt or hostile image
+// could smuggle into a short name
+bool FAT_IsSafeName(const char* name, size_t length)
+{
+    if (length == 0 || (length == 1 && name[0] == '.') || (length == 2 && name[0] == '.' && name[1] == '.'))
+        return false;
 
-            // open new directory entry
-            current = FAT_OpenEntry(disk, &entry);
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)name[i];
+        if (c < 0x20 || c == 0x7F || c == '/' || c == '\\')
+            return false;
+    }
+
+    return true;
+}
+
+// Collects the runs of contiguous clusters holding the first size bytes of the
+// chain. Returns false if the chain ends early or leaves the data area.
+bool FAT_GetExtents(uint32_t cluster, uint32_t size, FAT_Extent** extentsOut, uint32_t* countOut)
+{
+    uint32_t clusters = (size + g_ClusterSize - 1) / g_ClusterSize;
+    uint32_t capacity = 0;
+    uint32_t count = 0;
+    FAT_Extent* extents = NULL;
+
+    for (uint32_t i = 0; i < clusters; i++)
+    {
+        if (!FAT_IsValidCluster(cluster))
+        {
+            free(extents);
+            return false;
+        }
+
+        uint32_t lba = FAT_ClusterToLba(cluster);
+        if (count > 0 && extents[count - 1].Lba + extents[count - 1].Sectors == lba)
+        {
+            extents[count - 1].Sectors += g_BS.BootSector.SectorsPerCluster;
         }
         else
         {
-            FAT_Close(current);
+            if (count == capacity)
+            {
+                capacity = max(16, capacity * 2);
+                extents = (FAT_Extent*)realloc(extents, capacity * sizeof(FAT_Extent));
+            }
 
-            printf("FAT: %s not found\r\n", name);
-            return NULL;
+            extents[count].Lba = lba;
+            extents[count].Sectors = g_BS.BootSector.SectorsPerCluster;
+            count++;
         }
+
+        cluster = FAT_NextCluster(cluster);
     }
 
-    return current;
+    *extentsOut = extents;
+    *countOut = count;
+    return true;
+}
+
+// Calls callback for every file and directory below the directory, parents
+// before their contents. Stops early if the callback returns false.
+bool FAT_Walk(uint32_t firstCluster, const char* path, int depth, FAT_WalkCallback callback, void* context)
+{
+    if (depth > MAX_DIR_DEPTH)
+    {
+        fprintf(stderr, "FAT: %s is nested too deep\n", path);
+        return false;
+    }
+
+    FAT_Directory* dir = (FAT_Directory*)malloc(sizeof(FAT_Directory));
+    bool ok = FAT_OpenDirectory(firstCluster, dir);
+
+    uint32_t count = ok ? FAT_DirectoryEntryCount(dir) : 0;
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        FAT_DirectoryEntry* entry = FAT_GetEntry(dir, i);
+        if (entry == NULL || entry->Name[0] == 0x00)
+            break;
+
+        if (entry->Name[0] == DELETED_ENTRY || entry->Name[0] == '.' || entry->Attributes == FAT_ATTRIBUTE_LFN || (entry->Attributes & FAT_ATTRIBUTE_VOLUME_ID))
+            continue;
+
+        FAT_WalkEntry walkEntry;
+        char name[13];
+        FAT_FromShortName(entry->Name, name);
+        if (!FAT_IsSafeName(name, strlen(name)))
+        {
+            fprintf(stderr, "FAT: skipping entry with an invalid name in %s\n", path);
+            continue;
+        }
+
+        snprintf(walkEntry.Path, sizeof(walkEntry.Path), "%s/%s", strcmp(path, "/") == 0 ? "" : path, name);
+        walkEntry.Entry = *entry;
+
+        ok = callback(&walkEntry, context);
+
+        if (ok && (walkEntry.Entry.Attributes & FAT_ATTRIBUTE_DIRECTORY) && FAT_IsValidCluster(FAT_EntryCluster(&walkEntry.Entry)))
+            ok = FAT_Walk(FAT_EntryCluster(&walkEntry.Entry), walkEntry.Path, depth + 1, callback, context);
+    }
+
+    free(dir);
+    return ok;
+}
+
+uint32_t crc32(uint32_t crc, const void* data, uint32_t size)
+{
+    static uint32_t table[256];
+    const uint8_t* u8Data = (const uint8_t*)data;
+
+    if (table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++)
+                value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+            table[i] = value;
+        }
+    }
+
+    crc = ~crc;
+    while (size--)
+        crc = table[(crc ^ *u8Data++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+// The blocklist lives in the last reserved sector, which must not hold part of stage2
+bool FAT_BlocklistSectorFree(uint32_t lba)
+{
+    if (g_BS.BootSector.ReservedSectors < 2)
+        return false;
+
+    for (int i = 0; i < BLOCKLIST_STAGE2_LIST_ENTRIES; i++)
+    {
+        const uint8_t* entry = g_BS.BootSectorBytes + BLOCKLIST_STAGE2_LIST_OFFSET + i * 5;
+        uint32_t stage2Lba = entry[0] | (entry[1] << 8) | (entry[2] << 16) | ((uint32_t)entry[3] << 24);
+        if (stage2Lba == 0)
+            break;
+
+        if (lba >= stage2Lba && lba < stage2Lba + entry[4])
+            return false;
+    }
+
+    return true;
+}
+
+bool FAT_HasBlocklist()
+{
+    uint32_t lba = g_BS.BootSector.ReservedSectors - 1;
+    if (!FAT_BlocklistSectorFree(lba))
+        return false;
+
+    const Blocklist* blocklist = (const Blocklist*)FAT_GetSector(lba);
+    return blocklist != NULL && blocklist->Magic == BLOCKLIST_MAGIC;
+}
+
+// Rebuilds the kernel blocklist and bumps the volume generation. The blocklist is
+// left cleared if the kernel can't be described by one (stage2 then uses the FAT).
+bool FAT_UpdateBlocklist()
+{
+    static FAT_Directory dir;
+    char name[MAX_PATH_SIZE];
+    uint32_t lba = g_BS.BootSector.ReservedSectors - 1;
+
+    if (!FAT_BlocklistSectorFree(lba))
+    {
+        fprintf(stderr, "No free reserved sector for the blocklist, reserve one more sector than stage2 needs!\n");
+        return false;
+    }
+
+    Blocklist* blocklist = (Blocklist*)FAT_GetSector(lba);
+    uint8_t* bootSector = FAT_GetSector(0);
+    if (blocklist == NULL || bootSector == NULL)
+        return false;
+
+    memset(blocklist, 0, sizeof(Blocklist));
+    FAT_MarkDirty(lba);
+
+    // the root directory is checksummed in one read, so stage2 can tell when another tool changed it
+    if (g_RootDirSectors == 0 || g_RootDirSectors > BLOCKLIST_MAX_ROOT_SECTORS)
+    {
+        fprintf(stderr, "Root directory is not a fixed region stage2 can check, blocklist disabled\n");
+        return true;
+    }
+
+    // modules listed in the manifest still need the FAT
+    if (!FAT_ResolveParent("/boot.cfg", &dir, name) || FAT_FindEntry(&dir, name) >= 0)
+    {
+        fprintf(stderr, "Image has a boot manifest, blocklist disabled\n");
+        return true;
+    }
+
+    int index = FAT_ResolveParent("/kernel.bin", &dir, name) ? FAT_FindEntry(&dir, name) : -1;
+    if (index < 0)
+    {
+        fprintf(stderr, "No /kernel.bin, blocklist disabled\n");
+        return true;
+    }
+
+    FAT_DirectoryEntry* entry = FAT_GetEntry(&dir, index);
+    uint32_t size = entry->Size;
+    uint32_t sectorsLeft = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint8_t* kernel = (uint8_t*)malloc(sectorsLeft * SECTOR_SIZE + 1);
+    uint8_t* kernelEnd = kernel;
+
+    for (uint32_t cluster = FAT_EntryCluster(entry); sectorsLeft > 0 && FAT_IsValidCluster(cluster); cluster = FAT_NextCluster(cluster))
+    {
+        uint32_t clusterLba = FAT_ClusterToLba(cluster);
+        uint32_t take = min(sectorsLeft, g_BS.BootSector.SectorsPerCluster);
+
+        if (blocklist->ExtentCount > 0
+            && blocklist->Extents[blocklist->ExtentCount - 1].Lba + blocklist->Extents[blocklist->ExtentCount - 1].Count == clusterLba)
+        {
+            blocklist->Extents[blocklist->ExtentCount - 1].Count += take;
+        }
+        else if (blocklist->ExtentCount == BLOCKLIST_MAX_EXTENTS)
+        {
+            fprintf(stderr, "Kernel is too fragmented, blocklist disabled\n");
+            memset(blocklist, 0, sizeof(Blocklist));
+            free(kernel);
+            return true;
+        }
+        else
+        {
+            blocklist->Extents[blocklist->ExtentCount].Lba = clusterLba;
+            blocklist->Extents[blocklist->ExtentCount].Count = take;
+            blocklist->ExtentCount++;
+        }
+
+        if (!readSectors(clusterLba, take, kernelEnd))
+        {
+            fprintf(stderr, "Could not read kernel!\n");
+            free(kernel);
+            return false;
+        }
+
+        kernelEnd += take * SECTOR_SIZE;
+        sectorsLeft -= take;
+    }
+
+    if (sectorsLeft > 0)
+    {
+        fprintf(stderr, "Kernel cluster chain is broken, blocklist disabled\n");
+        memset(blocklist, 0, sizeof(Blocklist));
+        free(kernel);
+        return true;
+    }
+
+    // the fast path copies the file as is, sections with their own layout or lazy loading need the loader
+    for (uint32_t offset = 0; offset + sizeof(uint32_t) <= min(size, KERNEL_IMAGE_SEARCH_SIZE); offset += 4)
+    {
+        uint32_t magic;
+        memcpy(&magic, kernel + offset, sizeof(magic));
+        if (magic == KERNEL_IMAGE_MAGIC)
+        {
+            fprintf(stderr, "Kernel has a section table, blocklist disabled\n");
+            memset(blocklist, 0, sizeof(Blocklist));
+            free(kernel);
+            return true;
+        }
+    }
+
+    g_BS.BootSector.VolumeId++;
+    memcpy(bootSector + BLOCKLIST_VOLUME_ID_OFFSET, &g_BS.BootSector.VolumeId, sizeof(uint32_t));
+    FAT_MarkDirty(0);
+
+    blocklist->Magic = BLOCKLIST_MAGIC;
+    blocklist->Generation = g_BS.BootSector.VolumeId;
+    blocklist->KernelSize = size;
+    blocklist->KernelChecksum = crc32(0, kernel, size);
+    blocklist->RootLba = g_RootDirLba;
+    blocklist->RootSectors = g_RootDirSectors;
+    for (uint32_t i = 0; i < g_RootDirSectors; i++)
+    {
+        const uint8_t* sector = FAT_GetSector(g_RootDirLba + i);
+        if (sector == NULL)
+        {
+            free(kernel);
+            return false;
+        }
+
+        blocklist->RootChecksum = crc32(blocklist->RootChecksum, sector, SECTOR_SIZE);
+    }
+    blocklist->HeaderChecksum = crc32(0, blocklist, offsetof(Blocklist, HeaderChecksum));
+
+    free(kernel);
+    return true;
+}
+
+uint8_t* readHostFile(const char* path, uint32_t* sizeOut)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Cannot open %s!\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = (uint8_t*)malloc(max(size, 1));
+    if (size < 0 || fread(data, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "Cannot read %s!\n", path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *sizeOut = (uint32_t)size;
+    return data;
+}
+
+int cmdRead(const char* path)
+{
+    static FAT_Directory dir;
+    char name[MAX_PATH_SIZE];
+
+    if (!FAT_ResolveParent(path, &dir, name))
+        return -2;
+
+    int index = FAT_FindEntry(&dir, name);
+    if (index < 0)
+    {
+        fprintf(stderr, "Could not find file %s!\n", path);
+        return -3;
+    }
+
+    FAT_DirectoryEntry entry = *FAT_GetEntry(&dir, index);
+    FAT_Extent* extents;
+    uint32_t count;
+    if (!FAT_GetExtents(FAT_EntryCluster(&entry), entry.Size, &extents, &count))
+    {
+        fprintf(stderr, "Cluster chain of %s is broken!\n", path);
+        return -4;
+    }
+
+    // whole extents go out straight from the mapping
+    uint32_t left = entry.Size;
+    for (uint32_t i = 0; i < count && left > 0; i++)
+    {
+        const uint8_t* data = mappedSectors(extents[i].Lba, extents[i].Sectors);
+        if (data == NULL)
+        {
+            fprintf(stderr, "Could not read file %s!\n", path);
+            break;
+        }
+
+        uint32_t take = min(left, extents[i].Sectors * SECTOR_SIZE);
+        fwrite(data, 1, take, stdout);
+        left -= take;
+    }
+
+    free(extents);
+    return left == 0 ? 0 : -4;
+}
+
+int cmdList(const char* path)
+{
+    static FAT_Directory dir;
+    uint32_t firstCluster = 0;
+
+    if (path != NULL && strcmp(path, "/") != 0)
+    {
+        char name[MAX_PATH_SIZE];
+        if (!FAT_ResolveParent(path, &dir, name))
+            return -2;
+
+        int index = FAT_FindEntry(&dir, name);
+        FAT_DirectoryEntry* entry = index >= 0 ? FAT_GetEntry(&dir, index) : NULL;
+        if (entry == NULL || !(entry->Attributes & FAT_ATTRIBUTE_DIRECTORY))
+        {
+            fprintf(stderr, "Could not find directory %s!\n", path);
+            return -3;
+        }
+        firstCluster = FAT_EntryCluster(entry);
+    }
+
+    if (!FAT_OpenDirectory(firstCluster, &dir))
+        return -2;
+
+    uint32_t count = FAT_DirectoryEntryCount(&dir);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        FAT_DirectoryEntry* entry = FAT_GetEntry(&dir, i);
+        if (entry == NULL || entry->Name[0] == 0x00)
+            break;
+
+        if (entry->Name[0] == DELETED_ENTRY || entry->Attributes == FAT_ATTRIBUTE_LFN || (entry->Attributes & FAT_ATTRIBUTE_VOLUME_ID))
+            continue;
+
+        printf("%.8s %.3s %s %10u  cluster %u\n", entry->Name, entry->Name + 8,
+               (entry->Attributes & FAT_ATTRIBUTE_DIRECTORY) ? "<DIR>" : "     ",
+               entry->Size, FAT_EntryCluster(entry));
+    }
+
+    return 0;
+}
+
+int writeFile(const char* path, const uint8_t* data, uint32_t size)
+{
+    static FAT_Directory dir;
+    char name[MAX_PATH_SIZE];
+    char fatName[11];
+    uint32_t oldCluster = 0;
+
+    bool hadBlocklist = FAT_HasBlocklist();
+
+    if (!FAT_ResolveParent(path, &dir, name))
+        return -2;
+
+    if (!FAT_ToShortName(name, fatName))
+    {
+        fprintf(stderr, "%s is not a valid 8.3 name!\n", name);
+        return -3;
+    }
+
+    int index = FAT_FindEntry(&dir, name);
+    bool replace = index >= 0;
+    if (replace)
+    {
+        FAT_DirectoryEntry* entry = FAT_GetEntry(&dir, index);
+        if (entry->Attributes & FAT_ATTRIBUTE_DIRECTORY)
+        {
+            fprintf(stderr, "%s is a directory!\n", path);
+            return -3;
+        }
+
+        // the old chain stays allocated until the entry points at the new one, so
+        // the old contents survive anything that fails before the flush
+        oldCluster = FAT_EntryCluster(entry);
+    }
+    else
+    {
+        index = FAT_FindFreeEntry(&dir);
+        if (index < 0)
+            return -4;
+    }
+
+    uint32_t cluster = FAT_AllocateChain((size + g_ClusterSize - 1) / g_ClusterSize);
+    if (size > 0 && (cluster == 0 || !FAT_WriteChain(cluster, data, size)))
+        return -4;
+
+    FAT_FreeChain(oldCluster);
+
+    FAT_DirectoryEntry* entry = FAT_GetEntry(&dir, index);
+    if (!replace)
+    {
+        memset(entry, 0, sizeof(FAT_DirectoryEntry));
+        memcpy(entry->Name, fatName, 11);
+        entry->Attributes = FAT_ATTRIBUTE_ARCHIVE;
+        FAT_SetTimestamp(entry);
+        entry->CreatedDate = entry->ModifiedDate;
+        entry->CreatedTime = entry->ModifiedTime;
+    }
+
+    entry->FirstClusterLow = cluster & 0xFFFF;
+    entry->FirstClusterHigh = cluster >> 16;
+    entry->Size = size;
+    FAT_SetTimestamp(entry);
+    FAT_MarkEntryDirty(&dir, index);
+
+    // data is written already, keep an existing blocklist pointing at the current kernel
+    if (hadBlocklist && !FAT_UpdateBlocklist())
+        return -5;
+
+    return FAT_Flush() ? 0 : -5;
+}
+
+int cmdWrite(const char* path, const char* hostPath)
+{
+    uint32_t size;
+    uint8_t* data = readHostFile(hostPath, &size);
+    if (data == NULL)
+        return -2;
+
+    int result = writeFile(path, data, size);
+    free(data);
+    return result;
+}
+
+int cmdDelete(const char* path)
+{
+    static FAT_Directory dir;
+    char name[MAX_PATH_SIZE];
+    bool hadBlocklist = FAT_HasBlocklist();
+
+    if (!FAT_ResolveParent(path, &dir, name))
+        return -2;
+
+    int index = FAT_FindEntry(&dir, name);
+    if (index < 0)
+    {
+        fprintf(stderr, "Could not find file %s!\n", path);
+        return -3;
+    }
+
+    FAT_DirectoryEntry* entry = FAT_GetEntry(&dir, index);
+    if (entry->Attributes & FAT_ATTRIBUTE_DIRECTORY)
+    {
+        fprintf(stderr, "Deleting directories is not supported!\n");
+        return -3;
+    }
+
+    FAT_FreeChain(FAT_EntryCluster(entry));
+    entry->Name[0] = DELETED_ENTRY;
+    FAT_MarkEntryDirty(&dir, index);
+
+    // long name entries belonging to the file go with it
+    for (int i = index - 1; i >= 0; i--)
+    {
+        FAT_DirectoryEntry* lfn = FAT_GetEntry(&dir, i);
+        if (lfn == NULL || lfn->Attributes != FAT_ATTRIBUTE_LFN || lfn->Name[0] == DELETED_ENTRY)
+            break;
+
+        lfn->Name[0] = DELETED_ENTRY;
+        FAT_MarkEntryDirty(&dir, i);
+    }
+
+    if (hadBlocklist && !FAT_UpdateBlocklist())
+        return -5;
+
+    return FAT_Flush() ? 0 : -5;
+}
+
+typedef struct
+{
+    char ImagePath[MAX_PATH_SIZE];
+    char HostPath[2 * MAX_PATH_SIZE];
+    uint32_t Cluster;
+    uint32_t Size;
+} ExtractJob;
+
+typedef struct
+{
+    const char* HostDirectory;
+    ExtractJob* Jobs;
+    uint32_t JobCount;
+    uint32_t JobCapacity;
+    uint32_t NextJob;           // claimed atomically by the workers
+    uint32_t Failed;
+} ExtractState;
+
+bool writeAll(int fd, const uint8_t* data, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+
+    return true;
+}
+
+// Directories are created right away so they exist before any worker starts, files become jobs
+bool extractCollect(const FAT_WalkEntry* entry, void* context)
+{
+    ExtractState* state = (ExtractState*)context;
+    char hostPath[2 * MAX_PATH_SIZE];
+
+    // every component must be a plain name, or the joined path could leave HostDirectory
+    for (const char* component = entry->Path; *component == '/'; )
+    {
+        const char* end = strchr(component + 1, '/');
+        size_t length = end != NULL ? (size_t)(end - component - 1) : strlen(component + 1);
+        if (!FAT_IsSafeName(component + 1, length))
+        {
+            fprintf(stderr, "Refusing to extract %s outside of %s!\n", entry->Path, state->HostDirectory);
+            return false;
+        }
+
+        if (end == NULL)
+            break;
+        component = end;
+    }
+
+    snprintf(hostPath, sizeof(hostPath), "%s%s", state->HostDirectory, entry->Path);
+
+    if (entry->Entry.Attributes & FAT_ATTRIBUTE_DIRECTORY)
+    {
+        if (mkdir(hostPath, 0755) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "Cannot create %s!\n", hostPath);
+            return false;
+        }
+        return true;
+    }
+
+    if (state->JobCount == state->JobCapacity)
+    {
+        state->JobCapacity = max(64, state->JobCapacity * 2);
+        state->Jobs = (ExtractJob*)realloc(state->Jobs, state->JobCapacity * sizeof(ExtractJob));
+    }
+
+    ExtractJob* job = &state->Jobs[state->JobCount++];
+    strcpy(job->ImagePath, entry->Path);
+    strcpy(job->HostPath, hostPath);
+    job->Cluster = FAT_EntryCluster(&entry->Entry);
+    job->Size = entry->Entry.Size;
+    return true;
+}
+
+bool extractFile(const ExtractJob* job)
+{
+    FAT_Extent* extents = NULL;
+    uint32_t count = 0;
+    if (job->Size > 0 && !FAT_GetExtents(job->Cluster, job->Size, &extents, &count))
+    {
+        fprintf(stderr, "Cluster chain of %s is broken!\n", job->ImagePath);
+        return false;
+    }
+
+    // don't follow a link left in the target directory out of it
+    int fd = open(job->HostPath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot create %s!\n", job->HostPath);
+        free(extents);
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t done = 0;
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        const uint8_t* data = mappedSectors(extents[i].Lba, extents[i].Sectors);
+        uint32_t take = min(job->Size - done, extents[i].Sectors * SECTOR_SIZE);
+
+        ok = data != NULL && writeAll(fd, data, take, done);
+        done += take;
+    }
+
+    if (close(fd) != 0 || !ok)
+    {
+        fprintf(stderr, "Could not extract %s!\n", job->ImagePath);
+        ok = false;
+    }
+
+    free(extents);
+    return ok;
+}
+
+void* extractWorker(void* context)
+{
+    ExtractState* state = (ExtractState*)context;
+    uint32_t job;
+
+    while ((job = __atomic_fetch_add(&state->NextJob, 1, __ATOMIC_RELAXED)) < state->JobCount)
+        if (!extractFile(&state->Jobs[job]))
+            __atomic_fetch_add(&state->Failed, 1, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+static int compareJobSize(const void* a, const void* b)
+{
+    uint32_t sizeA = ((const ExtractJob*)a)->Size;
+    uint32_t sizeB = ((const ExtractJob*)b)->Size;
+    return (sizeA < sizeB) - (sizeA > sizeB);
+}
+
+// Adds path (a file, a directory or "/") and everything below it to the jobs
+bool extractCollectPath(ExtractState* state, const char* path)
+{
+    static FAT_Directory dir;
+    FAT_WalkEntry entry;
+    char name[MAX_PATH_SIZE];
+
+    while (*path == '/')
+        path++;
+
+    if (*path == '\0')
+        return FAT_Walk(0, "/", 0, extractCollect, state);
+
+    if (!FAT_ResolveParent(path, &dir, name))
+        return false;
+
+    int index = FAT_FindEntry(&dir, name);
+    if (index < 0)
+    {
+        fprintf(stderr, "Could not find %s!\n", path);
+        return false;
+    }
+
+    // parent directories of a nested path have to exist on the host too
+    snprintf(entry.Path, sizeof(entry.Path), "/%s", path);
+    for (char* slash = strchr(entry.Path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        char hostPath[2 * MAX_PATH_SIZE];
+        snprintf(hostPath, sizeof(hostPath), "%s%.*s", state->HostDirectory, (int)(slash - entry.Path), entry.Path);
+        mkdir(hostPath, 0755);
+    }
+
+    entry.Entry = *FAT_GetEntry(&dir, index);
+    if (!extractCollect(&entry, state))
+        return false;
+
+    if ((entry.Entry.Attributes & FAT_ATTRIBUTE_DIRECTORY) && FAT_IsValidCluster(FAT_EntryCluster(&entry.Entry)))
+        return FAT_Walk(FAT_EntryCluster(&entry.Entry), entry.Path, 1, extractCollect, state);
+
+    return true;
+}
+
+int cmdExtract(const char* hostDirectory, int argc, char** argv)
+{
+    ExtractState state = { 0 };
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int pathCount = 0;
+
+    state.HostDirectory = hostDirectory;
+    if (mkdir(hostDirectory, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Cannot create %s!\n", hostDirectory);
+        return -2;
+    }
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            workers = atol(argv[++i]);
+            continue;
+        }
+
+        if (!extractCollectPath(&state, argv[i]))
+            return -3;
+        pathCount++;
+    }
+
+    if (pathCount == 0 && !extractCollectPath(&state, "/"))
+        return -3;
+
+    // biggest files first, so one large file doesn't end up last on a single worker
+    qsort(state.Jobs, state.JobCount, sizeof(ExtractJob), compareJobSize);
+
+    workers = max(1, min(workers, min(MAX_WORKERS, (long)state.JobCount)));
+    pthread_t threads[MAX_WORKERS];
+    int started = 0;
+    while (started < workers - 1 && pthread_create(&threads[started], NULL, extractWorker, &state) == 0)
+        started++;
+
+    extractWorker(&state);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(state.Jobs);
+    if (state.Failed > 0)
+    {
+        fprintf(stderr, "%u of %u files could not be extracted\n", state.Failed, state.JobCount);
+        return -4;
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    uint32_t* Owners;           // per cluster, 1 + index into Paths of the entry using it
+    char (*Paths)[MAX_PATH_SIZE];
+    uint32_t Count;
+    uint32_t Capacity;
+    uint32_t Errors;
+} VerifyState;
+
+bool verifyEntry(const FAT_WalkEntry* entry, void* context)
+{
+    VerifyState* state = (VerifyState*)context;
+    bool isDirectory = (entry->Entry.Attributes & FAT_ATTRIBUTE_DIRECTORY) != 0;
+
+    if (state->Count == state->Capacity)
+    {
+        state->Capacity = max(64, state->Capacity * 2);
+        state->Paths = realloc(state->Paths, state->Capacity * sizeof(*state->Paths));
+    }
+
+    uint32_t owner = ++state->Count;
+    strcpy(state->Paths[owner - 1], entry->Path);
+
+    uint32_t cluster = FAT_EntryCluster(&entry->Entry);
+    uint32_t expected = (entry->Entry.Size + g_ClusterSize - 1) / g_ClusterSize;
+    uint32_t length = 0;
+    bool ok = true;
+
+    if (cluster == 0)
+    {
+        if (isDirectory || expected == 0)
+            return true;
+
+        printf("%s: size is %u but there are no clusters\n", entry->Path, entry->Entry.Size);
+        state->Errors++;
+        return true;
+    }
+
+    while (ok)
+    {
+        if (!FAT_IsValidCluster(cluster))
+        {
+            printf("%s: chain points outside the data area (cluster %u)\n", entry->Path, cluster);
+            ok = false;
+            break;
+        }
+
+        if (state->Owners[cluster] == owner)
+        {
+            printf("%s: chain loops back to cluster %u\n", entry->Path, cluster);
+            ok = false;
+            break;
+        }
+
+        if (state->Owners[cluster] != 0)
+        {
+            printf("%s: cross-linked with %s at cluster %u\n", entry->Path, state->Paths[state->Owners[cluster] - 1], cluster);
+            ok = false;
+            break;
+        }
+
+        state->Owners[cluster] = owner;
+        length++;
+
+        uint32_t next = FAT_NextCluster(cluster);
+        if (FAT_IsEndOfChain(next))
+            break;
+
+        if (next == 0 || FAT_IsBadCluster(next))
+        {
+            printf("%s: chain runs into a %s cluster after cluster %u\n", entry->Path, next == 0 ? "free" : "bad", cluster);
+            ok = false;
+        }
+
+        cluster = next;
+    }
+
+    if (ok && !isDirectory && length != expected)
+    {
+        printf("%s: chain has %u clusters, its size needs %u\n", entry->Path, length, expected);
+        ok = false;
+    }
+
+    state->Errors += !ok;
+    return true;
+}
+
+int cmdVerify()
+{
+    VerifyState state = { 0 };
+    state.Owners = (uint32_t*)calloc(g_ClusterCount + 2, sizeof(uint32_t));
+
+    if (!FAT_Walk(0, "/", 0, verifyEntry, &state))
+        state.Errors++;
+
+    uint32_t lost = 0;
+    for (uint32_t cluster = 2; cluster < g_ClusterCount + 2; cluster++)
+    {
+        uint32_t value = FAT_NextCluster(cluster);
+        if (value != 0 && !FAT_IsBadCluster(value) && state.Owners[cluster] == 0)
+            lost++;
+    }
+
+    if (lost > 0)
+    {
+        printf("%u allocated clusters don't belong to any file\n", lost);
+        state.Errors++;
+    }
+
+    uint32_t fatBytes = g_BS.BootSector.SectorsPerFat * SECTOR_SIZE;
+    for (uint32_t copy = 1; copy < g_BS.BootSector.FatCount; copy++)
+    {
+        const uint8_t* fatCopy = mappedSectors(g_BS.BootSector.ReservedSectors + copy * g_BS.BootSector.SectorsPerFat, g_BS.BootSector.SectorsPerFat);
+        if (fatCopy == NULL || memcmp(fatCopy, g_Fat, fatBytes) != 0)
+        {
+            printf("FAT copy %u differs from the first FAT\n", copy);
+            state.Errors++;
+        }
+    }
+
+    printf("%u entries checked, %u problem(s)\n", state.Count, state.Errors);
+    free(state.Owners);
+    free(state.Paths);
+    return state.Errors == 0 ? 0 : -6;
+}
+
+typedef struct
+{
+    char Path[MAX_PATH_SIZE];
+    uint32_t Size;
+    uint32_t Extents;
+} FragFile;
+
+typedef struct
+{
+    FragFile* Files;
+    uint32_t Count;
+    uint32_t Capacity;
+    uint32_t Broken;
+} FragState;
+
+bool fragEntry(const FAT_WalkEntry* entry, void* context)
+{
+    FragState* state = (FragState*)context;
+    FAT_Extent* extents;
+    uint32_t count;
+
+    if ((entry->Entry.Attributes & FAT_ATTRIBUTE_DIRECTORY) || entry->Entry.Size == 0)
+        return true;
+
+    if (!FAT_GetExtents(FAT_EntryCluster(&entry->Entry), entry->Entry.Size, &extents, &count))
+    {
+        printf("%s: cluster chain is broken\n", entry->Path);
+        state->Broken++;
+        return true;
+    }
+    free(extents);
+
+    if (state->Count == state->Capacity)
+    {
+        state->Capacity = max(64, state->Capacity * 2);
+        state->Files = (FragFile*)realloc(state->Files, state->Capacity * sizeof(FragFile));
+    }
+
+    FragFile* file = &state->Files[state->Count++];
+    strcpy(file->Path, entry->Path);
+    file->Size = entry->Entry.Size;
+    file->Extents = count;
+    return true;
+}
+
+static int compareFragExtents(const void* a, const void* b)
+{
+    uint32_t extentsA = ((const FragFile*)a)->Extents;
+    uint32_t extentsB = ((const FragFile*)b)->Extents;
+    return (extentsA < extentsB) - (extentsA > extentsB);
+}
+
+int cmdFrag()
+{
+    FragState state = { 0 };
+    FAT_Walk(0, "/", 0, fragEntry, &state);
+
+    qsort(state.Files, state.Count, sizeof(FragFile), compareFragExtents);
+
+    uint32_t fragmented = 0;
+    uint64_t extents = 0;
+    for (uint32_t i = 0; i < state.Count; i++)
+    {
+        extents += state.Files[i].Extents;
+        if (state.Files[i].Extents > 1)
+        {
+            printf("%6u extents %10u bytes  %s\n", state.Files[i].Extents, state.Files[i].Size, state.Files[i].Path);
+            fragmented++;
+        }
+    }
+
+    // free space fragmentation decides whether the next write can be contiguous
+    uint32_t freeClusters = 0, freeRuns = 0, run = 0, largestRun = 0;
+    for (uint32_t cluster = 2; cluster < g_ClusterCount + 2; cluster++)
+    {
+        if (FAT_NextCluster(cluster) == 0)
+        {
+            freeClusters++;
+            freeRuns += run++ == 0;
+            largestRun = max(largestRun, run);
+        }
+        else
+            run = 0;
+    }
+
+    printf("%u files, %u fragmented (%.1f%%), %.2f extents per file\n", state.Count, fragmented,
+           state.Count ? fragmented * 100.0 / state.Count : 0.0, state.Count ? (double)extents / state.Count : 0.0);
+    printf("%u free clusters in %u runs, largest run %u clusters (%u bytes)\n", freeClusters, freeRuns, largestRun, largestRun * g_ClusterSize);
+
+    free(state.Files);
+    return state.Broken == 0 ? 0 : -6;
+}
+
+void usage(const char* program)
+{
+    fprintf(stderr, "Syntax: %s <disk image> <command> [args]\n", program);
+    fprintf(stderr, "Commands:\n");
+    fprintf(stderr, "    read <path>                print a file to stdout\n");
+    fprintf(stderr, "    list [<directory>]         list a directory\n");
+    fprintf(stderr, "    write <path> <host file>   create or replace a file\n");
+    fprintf(stderr, "    delete <path>              delete a file\n");
+    fprintf(stderr, "    blocklist                  write the kernel blocklist for stage2's fast path\n");
+    fprintf(stderr, "    extract <host dir> [-j <workers>] [<path>...]\n");
+    fprintf(stderr, "                               copy files (default: everything) out of the image in parallel\n");
+    fprintf(stderr, "    verify                     check every cluster chain, cross-links, lost clusters and FAT copies\n");
+    fprintf(stderr, "    frag                       list fragmented files and free space fragmentation\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    const char* command = argv[2];
+    bool writable = strcmp(command, "write") == 0 || strcmp(command, "delete") == 0 || strcmp(command, "blocklist") == 0;
+
+    if (!FAT_Initialize(argv[1], writable))
+        return -1;
+
+    int result;
+    if (strcmp(command, "read") == 0 && argc == 4)
+        result = cmdRead(argv[3]);
+    else if (strcmp(command, "list") == 0 && argc <= 4)
+        result = cmdList(argc == 4 ? argv[3] : NULL);
+    else if (strcmp(command, "write") == 0 && argc == 5)
+        result = cmdWrite(argv[3], argv[4]);
+    else if (strcmp(command, "delete") == 0 && argc == 4)
+        result = cmdDelete(argv[3]);
+    else if (strcmp(command, "blocklist") == 0 && argc == 3)
+        result = (FAT_UpdateBlocklist() && FAT_Flush()) ? 0 : -5;
+    else if (strcmp(command, "extract") == 0 && argc >= 4)
+        result = cmdExtract(argv[3], argc - 4, argv + 4);
+    else if (strcmp(command, "verify") == 0 && argc == 3)
+        result = cmdVerify();
+    else if (strcmp(command, "frag") == 0 && argc == 3)
+        result = cmdFrag();
+    else
+    {
+        usage(argv[0]);
+        result = -1;
+    }
+
+    if (g_Image != NULL)
+        munmap((void*)g_Image, g_ImageSize);
+
+    close(g_Disk);
+    return result;
 }
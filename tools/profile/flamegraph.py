@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Turns profiler samples captured from the serial port into flame graph input.
+
+Each sample is one line, anywhere in the serial log:
+
+    PROF <cpu> <eip> [<return address> ...]
+
+with all numbers in hex, the return addresses innermost first as found by
+walking the frame pointers. Addresses are resolved against the ld map file
+(build/kernel.map, or build/stage2.map) and the output is one folded stack
+per line with its sample count, as read by flamegraph.pl or speedscope:
+
+    kmain;scheduler_Run;memcpy 42
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'symbols'))
+from mapfile import read_map
+
+SAMPLE_RE = re.compile(r'PROF\s+([0-9a-fA-F]+)((?:\s+(?:0x)?[0-9a-fA-F]+)+)\s*$')
+
+
+class SymbolTable:
+    def __init__(self, path):
+        symbols, text_end = read_map(path)
+        self.addresses = [address for address, _ in symbols]
+        self.names = [name for _, name in symbols]
+        self.end = text_end or None
+
+    def resolve(self, address):
+        i = bisect.bisect_right(self.addresses, address) - 1
+        if i < 0 or (self.end is not None and address >= self.end):
+            return '[0x%08x]' % address
+        return self.names[i]
+
+
+def read_samples(files, cpu):
+    for f in files:
+        for line in f:
+            match = SAMPLE_RE.search(line)
+            if not match:
+                continue
+            if cpu is not None and int(match.group(1), 16) != cpu:
+                continue
+            yield [int(a, 16) for a in match.group(2).split()]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('map', help='ld map file, e.g. build/kernel.map')
+    parser.add_argument('logs', nargs='*', help='serial logs to read (default: stdin)')
+    parser.add_argument('--cpu', type=lambda s: int(s, 0), help='only use samples taken on this CPU')
+    parser.add_argument('--flat', action='store_true', help='print a flat profile of the sampled functions instead')
+    args = parser.parse_args()
+
+    symbols = SymbolTable(args.map)
+    files = [open(p, errors='replace') for p in args.logs] or [sys.stdin]
+
+    stacks = collections.Counter()
+    total = 0
+    for addresses in read_samples(files, args.cpu):
+        # return addresses point after the call, step back into the calling instruction
+        frames = [symbols.resolve(addresses[0])] + [symbols.resolve(a - 1) for a in addresses[1:]]
+        stacks[';'.join(reversed(frames))] += 1
+        total += 1
+
+    if total == 0:
+        print('no samples found', file=sys.stderr)
+        return 1
+
+    if args.flat:
+        flat = collections.Counter()
+        for stack, count in stacks.items():
+            flat[stack.rsplit(';', 1)[-1]] += count
+        for name, count in flat.most_common():
+            print('%6.2f%% %8d  %s' % (count * 100.0 / total, count, name))
+    else:
+        for stack, count in sorted(stacks.items()):
+            print('%s %d' % (stack, count))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
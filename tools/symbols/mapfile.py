@@ -0,0 +1,33 @@
+"""Reads the function symbols out of a GNU ld map file (build/kernel.map,
+build/stage2.map). Shared by symtab.py and tools/profile/flamegraph.py."""
+
+import re
+
+SECTION_RE = re.compile(r'^\s*(\.\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+\S')
+SYMBOL_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_.$][\w.$]*)\s*$')
+
+
+def read_map(path):
+    """Returns the .text symbols as sorted (address, name) pairs, and the end of .text."""
+    symbols = {}
+    text_end = 0
+    in_text = False
+
+    with open(path, errors='replace') as f:
+        for line in f:
+            # output sections start in column 0: ".text  0x00100000  0x1234"
+            if line.startswith('.'):
+                in_text = line.split()[0].startswith('.text')
+
+            symbol = SYMBOL_RE.match(line)
+            if symbol:
+                if in_text:
+                    symbols.setdefault(int(symbol.group(1), 16), symbol.group(2))
+                continue
+
+            section = SECTION_RE.match(line)
+            if section and in_text:
+                start, size = int(section.group(2), 16), int(section.group(3), 16)
+                text_end = max(text_end, start + size)
+
+    return sorted(symbols.items()), text_end
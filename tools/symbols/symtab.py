@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Builds the kernel's symbol table (see src/kernel/debug/symtab.h) from an ld map.
+
+Writes a C file defining g_SymbolTable. Without a map the table is empty, which
+is what the first link of the kernel uses; see src/kernel/Makefile.
+
+    symtab.py [--map build/kernel.map] build/kernel/symtab_gen.c
+"""
+
+import argparse
+import struct
+import sys
+
+from mapfile import read_map
+
+MAGIC = 0x544D5953
+BLOCK_SIZE = 16
+MAX_NAME = 255
+
+
+def build_table(symbols, text_end):
+    addresses = b''.join(struct.pack('<I', address) for address, _ in symbols)
+    blocks = b''
+    names = bytearray()
+    previous = b''
+
+    for i, (_, name) in enumerate(symbols):
+        name = name.encode()[:MAX_NAME]
+        shared = 0
+        if i % BLOCK_SIZE == 0:
+            blocks += struct.pack('<I', len(names))
+        else:
+            while shared < min(len(name), len(previous)) and name[shared] == previous[shared]:
+                shared += 1
+
+        names += bytes([shared, len(name) - shared]) + name[shared:]
+        previous = name
+
+    header_size = 16
+    names_offset = header_size + len(addresses) + len(blocks)
+    header = struct.pack('<IIII', MAGIC, len(symbols), text_end, names_offset)
+    return header + addresses + blocks + bytes(names)
+
+
+def write_c(path, table, count):
+    with open(path, 'w') as f:
+        f.write('// Generated by tools/symbols/symtab.py, %d symbols in %d bytes\n' % (count, len(table)))
+        f.write('#include <stdint.h>\n\n')
+        f.write('const uint8_t g_SymbolTable[] __attribute__((aligned(4))) = {\n')
+        for i in range(0, len(table), 16):
+            f.write('    ' + ', '.join('0x%02x' % b for b in table[i:i + 16]) + ',\n')
+        f.write('};\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--map', help='ld map file to take the symbols from')
+    parser.add_argument('output', help='C file to write')
+    args = parser.parse_args()
+
+    symbols, text_end = read_map(args.map) if args.map else ([], 0)
+    write_c(args.output, build_table(symbols, text_end), len(symbols))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())